@@ -12,6 +12,7 @@
 #define JPEG_INTERNALS
 #include "jinclude.h"
 #include "jpeglib.h"
+#include "jsimd.h"		/* SIMD replacement for ycc_rgb_convert */
 
 
 /* Private subobject */
@@ -676,6 +677,8 @@ jinit_color_deconverter (j_decompress_ptr cinfo)
       break;
     case JCS_YCbCr:
       cconvert->pub.color_convert = ycc_rgb_convert;
+      if (jsimd_select_ycc_rgb(cinfo) != NULL)
+	cconvert->pub.color_convert = jsimd_select_ycc_rgb(cinfo);
       build_ycc_rgb_table(cinfo);
       break;
     case JCS_BG_YCC:
@@ -20,6 +20,7 @@
 #include "jinclude.h"
 #include "jpeglib.h"
 #include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"		/* SIMD replacements for some IDCT routines */
 
 
 /*
@@ -256,6 +257,14 @@ start_pass (j_decompress_ptr cinfo)
 	       compptr->DCT_h_scaled_size, compptr->DCT_v_scaled_size);
       break;
     }
+    /* Prefer a vector version of the islow-style routine, if one exists */
+    if (method == JDCT_ISLOW) {
+      inverse_DCT_method_ptr simd_ptr =
+	jsimd_select_idct(cinfo, compptr->DCT_h_scaled_size,
+			  compptr->DCT_v_scaled_size);
+      if (simd_ptr != NULL)
+	method_ptr = simd_ptr;
+    }
     idct->pub.inverse_DCT[ci] = method_ptr;
     /* Create multiplier table from quant table.
      * However, we can skip this if the component is uninteresting
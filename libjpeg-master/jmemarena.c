@@ -0,0 +1,398 @@
+/*
+ * jmemarena.c
+ *
+ * This file is part of the Independent JPEG Group's software.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file provides a system-dependent portion of the JPEG memory manager
+ * that recycles memory across images.  Like jmemnobs.c it assumes that no
+ * backing-store files are needed.  Unlike it, blocks released by jmemmgr.c
+ * do not go back to free(): they are kept in free lists sorted into size
+ * classes (four per power of two, so at most 25% slack), and the arena
+ * holding those lists outlives the JPEG object that used it.  Decoding or
+ * thumbnailing a folder of similar images therefore does no malloc/free
+ * traffic once the first file has been through.
+ *
+ * An arena is bound to one JPEG object at a time, so its free lists need no
+ * locking; only taking and returning arenas and the global byte accounting
+ * go through a spin lock.  The arena is found through the header of the
+ * memory manager's control block, which is the first object jmemmgr.c
+ * allocates (while cinfo->mem is still NULL) and the last one it frees.
+ */
+
+#define JPEG_INTERNALS
+#include "jinclude.h"
+#include "jpeglib.h"
+#include "jmemsys.h"		/* import the system-dependent declarations */
+#include "jmemarena.h"
+
+#ifndef HAVE_STDLIB_H		/* <stdlib.h> should declare malloc(),free() */
+extern void * malloc JPP((size_t size));
+extern void free JPP((void *ptr));
+#endif
+
+#ifndef ARENA_DEFAULT_IDLE	/* cache kept by idle arenas unless changed */
+#define ARENA_DEFAULT_IDLE  ((size_t) 256 << 20)
+#endif
+
+#define MIN_CLASS_SHIFT  8	/* smallest block is 256 bytes */
+#define NUM_CLASSES  (1 + 4 * (8 * (int) SIZEOF(size_t) - MIN_CLASS_SHIFT))
+
+
+/* Spin lock for the shared state; held only for a few instructions, or
+ * while trimming caches.
+ */
+
+static volatile long arena_lock = 0;
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define ARENA_LOCK()	while (_InterlockedExchange(&arena_lock, 1) != 0) \
+			  while (arena_lock != 0) { }
+#define ARENA_UNLOCK()	_InterlockedExchange(&arena_lock, 0)
+#elif defined(__GNUC__)
+#define ARENA_LOCK()	while (__sync_lock_test_and_set(&arena_lock, 1) != 0) \
+			  while (arena_lock != 0) { }
+#define ARENA_UNLOCK()	__sync_lock_release(&arena_lock)
+#else				/* no threads assumed */
+#define ARENA_LOCK()
+#define ARENA_UNLOCK()
+#endif
+
+
+typedef struct arena_struct * arena_ptr;
+
+typedef union block_hdr {	/* precedes every block handed to jmemmgr */
+  struct {
+    arena_ptr owner;		/* arena whose free lists take the block back */
+    union block_hdr * next;	/* link while the block is cached */
+    size_t size;		/* usable bytes after the header */
+    int size_class;		/* free list index */
+  } b;
+  double dummy;			/* included in union to ensure alignment */
+  char pad[32];			/* and keep payloads 16-byte aligned */
+} block_hdr;
+
+struct arena_struct {
+  block_hdr * free_list[NUM_CLASSES];
+  size_t cached;		/* bytes, with headers, in the free lists */
+  arena_ptr next_idle;		/* link in the idle stack */
+};
+
+#define ARENA_OF(object)  (((block_hdr *) (object) - 1)->b.owner)
+#define BLOCK_BYTES(blk)  (SIZEOF(block_hdr) + (blk)->b.size)
+
+/* Shared state, guarded by arena_lock */
+static arena_ptr idle_arenas = NULL;	/* most recently released first */
+static size_t held_bytes = 0;		/* everything obtained from malloc */
+static size_t idle_bytes = 0;		/* of which cached in idle arenas */
+static size_t limit_total = 0;
+static size_t limit_idle = ARENA_DEFAULT_IDLE;
+static long system_allocs = 0;
+
+
+/*
+ * Size classes: 256 bytes, then 2^k * 5/4, 6/4, 7/4, 8/4 for each k >= 8.
+ * Returns -1 for absurd sizes.
+ */
+
+LOCAL(int)
+size_class (size_t size, size_t * class_size)
+{
+  size_t base, step;
+  int k, j;
+
+  if (size <= ((size_t) 1 << MIN_CLASS_SHIFT)) {
+    *class_size = (size_t) 1 << MIN_CLASS_SHIFT;
+    return 0;
+  }
+  if (size > ((size_t) -1) / 4)
+    return -1;
+  for (k = MIN_CLASS_SHIFT; ((size_t) 1 << (k + 1)) < size; k++)
+    ;
+  base = (size_t) 1 << k;	/* base < size <= 2 * base */
+  step = base >> 2;
+  j = (int) ((size - base + step - 1) / step);
+  *class_size = base + (size_t) j * step;
+  return 1 + 4 * (k - MIN_CLASS_SHIFT) + (j - 1);
+}
+
+
+/* Free the largest cached block of an arena; returns the bytes released.
+ * Caller holds the lock.
+ */
+
+LOCAL(size_t)
+drop_largest (arena_ptr arena, boolean is_idle)
+{
+  block_hdr * blk;
+  size_t bytes;
+  int c;
+
+  for (c = NUM_CLASSES-1; c >= 0; c--) {
+    if ((blk = arena->free_list[c]) != NULL) {
+      arena->free_list[c] = blk->b.next;
+      bytes = BLOCK_BYTES(blk);
+      arena->cached -= bytes;
+      held_bytes -= bytes;
+      if (is_idle)
+	idle_bytes -= bytes;
+      free((void *) blk);
+      return bytes;
+    }
+  }
+  return 0;
+}
+
+
+/* Shrink the idle arenas' caches to limit_idle, sparing first the arena
+ * most recently released.  Caller holds the lock.
+ */
+
+LOCAL(void)
+trim_idle (size_t limit)
+{
+  arena_ptr arena;
+
+  if (idle_arenas == NULL)
+    return;
+  for (arena = idle_arenas->next_idle; arena != NULL && idle_bytes > limit;
+       arena = arena->next_idle)
+    while (idle_bytes > limit && drop_largest(arena, TRUE) != 0)
+      ;
+  while (idle_bytes > limit && drop_largest(idle_arenas, TRUE) != 0)
+    ;
+}
+
+
+LOCAL(void *)
+arena_alloc (arena_ptr arena, size_t sizeofobject)
+{
+  block_hdr * blk;
+  size_t class_size, bytes;
+  int c, k;
+
+  if ((c = size_class(sizeofobject, &class_size)) < 0)
+    return NULL;
+
+  /* A cached block of this class, or of one of the next two (<= 50% more) */
+  for (k = c; k < NUM_CLASSES && k <= c + 2; k++) {
+    if ((blk = arena->free_list[k]) != NULL) {
+      arena->free_list[k] = blk->b.next;
+      arena->cached -= BLOCK_BYTES(blk);
+      return (void *) (blk + 1);
+    }
+  }
+
+  /* Need a new block: make room under limit_total, idle caches first */
+  bytes = SIZEOF(block_hdr) + class_size;
+  ARENA_LOCK();
+  if (limit_total != 0 && held_bytes + bytes > limit_total) {
+    trim_idle(held_bytes + bytes - limit_total < idle_bytes ?
+	      idle_bytes - (held_bytes + bytes - limit_total) : 0);
+    while (held_bytes + bytes > limit_total && drop_largest(arena, FALSE) != 0)
+      ;
+    if (held_bytes + bytes > limit_total) {
+      ARENA_UNLOCK();
+      return NULL;		/* jmemmgr reports JERR_OUT_OF_MEMORY */
+    }
+  }
+  held_bytes += bytes;		/* reserved before malloc, undone on failure */
+  system_allocs++;
+  ARENA_UNLOCK();
+
+  blk = (block_hdr *) malloc(bytes);
+  if (blk == NULL) {
+    ARENA_LOCK();
+    held_bytes -= bytes;
+    ARENA_UNLOCK();
+    return NULL;
+  }
+  blk->b.owner = arena;
+  blk->b.next = NULL;
+  blk->b.size = class_size;
+  blk->b.size_class = c;
+  return (void *) (blk + 1);
+}
+
+
+LOCAL(void)
+arena_free (void * object)
+{
+  block_hdr * blk = (block_hdr *) object - 1;
+  arena_ptr arena = blk->b.owner;
+
+  blk->b.next = arena->free_list[blk->b.size_class];
+  arena->free_list[blk->b.size_class] = blk;
+  arena->cached += BLOCK_BYTES(blk);
+}
+
+
+/* Take the most recently released arena (warmest cache), or make one */
+
+LOCAL(arena_ptr)
+acquire_arena (void)
+{
+  arena_ptr arena;
+
+  ARENA_LOCK();
+  arena = idle_arenas;
+  if (arena != NULL) {
+    idle_arenas = arena->next_idle;
+    idle_bytes -= arena->cached;
+  }
+  ARENA_UNLOCK();
+
+  if (arena == NULL) {
+    arena = (arena_ptr) malloc(SIZEOF(struct arena_struct));
+    if (arena != NULL)
+      MEMZERO(arena, SIZEOF(struct arena_struct));
+  }
+  return arena;
+}
+
+
+LOCAL(void)
+release_arena (arena_ptr arena)
+{
+  ARENA_LOCK();
+  arena->next_idle = idle_arenas;
+  idle_arenas = arena;
+  idle_bytes += arena->cached;
+  if (limit_idle != 0)
+    trim_idle(limit_idle);
+  ARENA_UNLOCK();
+}
+
+
+/*
+ * The jmemsys.h interface.  "Large" objects are treated the same as
+ * "small" ones.
+ */
+
+GLOBAL(void *)
+jpeg_get_small (j_common_ptr cinfo, size_t sizeofobject)
+{
+  arena_ptr arena;
+  void * object;
+
+  if (cinfo->mem != NULL)
+    return arena_alloc(ARENA_OF(cinfo->mem), sizeofobject);
+
+  /* jmemmgr's control block: bind an arena to this JPEG object */
+  if ((arena = acquire_arena()) == NULL)
+    return NULL;
+  if ((object = arena_alloc(arena, sizeofobject)) == NULL)
+    release_arena(arena);
+  return object;
+}
+
+GLOBAL(void)
+jpeg_free_small (j_common_ptr cinfo, void * object, size_t sizeofobject)
+{
+  arena_ptr arena = ARENA_OF(object);
+
+  arena_free(object);
+  /* The control block goes last; the arena with its cache is then idle */
+  if (object == (void *) cinfo->mem)
+    release_arena(arena);
+}
+
+GLOBAL(void FAR *)
+jpeg_get_large (j_common_ptr cinfo, size_t sizeofobject)
+{
+  return (void FAR *) jpeg_get_small(cinfo, sizeofobject);
+}
+
+GLOBAL(void)
+jpeg_free_large (j_common_ptr cinfo, void FAR * object, size_t sizeofobject)
+{
+  arena_free((void *) object);
+}
+
+
+/*
+ * This routine computes the total memory space available for allocation.
+ * As in jmemnobs.c we promise everything; limit_total is enforced when
+ * the blocks are actually requested.
+ */
+
+GLOBAL(long)
+jpeg_mem_available (j_common_ptr cinfo, long min_bytes_needed,
+		    long max_bytes_needed, long already_allocated)
+{
+  return max_bytes_needed;
+}
+
+
+/*
+ * Backing store (temporary file) management.
+ * Since jpeg_mem_available always promised the moon,
+ * this should never be called and we can just error out.
+ */
+
+GLOBAL(void)
+jpeg_open_backing_store (j_common_ptr cinfo, backing_store_ptr info,
+			 long total_bytes_needed)
+{
+  ERREXIT(cinfo, JERR_NO_BACKING_STORE);
+}
+
+
+/*
+ * These routines take care of any system-dependent initialization and
+ * cleanup required.  The arena is bound and released by the first and
+ * last block requests instead, see above.
+ */
+
+GLOBAL(long)
+jpeg_mem_init (j_common_ptr cinfo)
+{
+  return 0;			/* just set max_memory_to_use to 0 */
+}
+
+GLOBAL(void)
+jpeg_mem_term (j_common_ptr cinfo)
+{
+  /* no work */
+}
+
+
+/*
+ * Application interface, see jmemarena.h.
+ */
+
+GLOBAL(void)
+jpeg_arena_limits (size_t max_total, size_t max_idle)
+{
+  ARENA_LOCK();
+  limit_total = max_total;
+  limit_idle = max_idle;
+  if (limit_idle != 0)
+    trim_idle(limit_idle);
+  if (limit_total != 0 && held_bytes > limit_total)
+    trim_idle(held_bytes - limit_total < idle_bytes ?
+	      idle_bytes - (held_bytes - limit_total) : 0);
+  ARENA_UNLOCK();
+}
+
+GLOBAL(void)
+jpeg_arena_trim (void)
+{
+  ARENA_LOCK();
+  trim_idle(0);
+  ARENA_UNLOCK();
+}
+
+GLOBAL(void)
+jpeg_arena_stats (size_t * held, size_t * idle, long * allocs)
+{
+  ARENA_LOCK();
+  if (held != NULL)
+    *held = held_bytes;
+  if (idle != NULL)
+    *idle = idle_bytes;
+  if (allocs != NULL)
+    *allocs = system_allocs;
+  ARENA_UNLOCK();
+}
@@ -0,0 +1,41 @@
+/*
+ * jmemarena.h
+ *
+ * This file is part of the Independent JPEG Group's software.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * Application interface of the arena memory backend (jmemarena.c), which
+ * replaces jmemnobs.c.  Every JPEG object gets an arena when it is created
+ * and hands it back, with all of its blocks cached, when it is destroyed;
+ * the next object reuses those blocks instead of calling malloc again.
+ * The functions are thread-safe and may be called at any time.
+ */
+
+#ifndef JMEMARENA_H
+#define JMEMARENA_H
+
+/* Short forms of external names for systems with brain-damaged linkers. */
+
+#ifdef NEED_SHORT_EXTERNAL_NAMES
+#define jpeg_arena_limits	jArenaLimits
+#define jpeg_arena_trim		jArenaTrim
+#define jpeg_arena_stats	jArenaStats
+#endif /* NEED_SHORT_EXTERNAL_NAMES */
+
+/* max_total caps all memory the backend holds (in use plus cached); an
+ * allocation beyond it first evicts cached blocks, then fails, which
+ * libjpeg reports as JERR_OUT_OF_MEMORY.  max_idle caps what arenas keep
+ * cached while no JPEG object owns them.  0 means no limit.
+ */
+EXTERN(void) jpeg_arena_limits JPP((size_t max_total, size_t max_idle));
+
+/* Return every cached block of the idle arenas to the system. */
+EXTERN(void) jpeg_arena_trim JPP((void));
+
+/* Current totals: bytes held, bytes cached in idle arenas, and the number
+ * of blocks obtained from malloc since startup.  Any pointer may be NULL.
+ */
+EXTERN(void) jpeg_arena_stats JPP((size_t * held, size_t * idle,
+				   long * system_allocs));
+
+#endif /* JMEMARENA_H */
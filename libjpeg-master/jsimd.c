@@ -0,0 +1,719 @@
+/*
+ * jsimd.c
+ *
+ * This file is part of the Independent JPEG Group's software.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file contains SSE2 and AVX2 versions of the decompression kernels
+ * that dominate a full-size decode of a typical YCbCr JPEG:
+ *   jpeg_idct_islow   8x8 blocks (luma, and chroma at 1/2 scale);
+ *   jpeg_idct_16x16   4:2:0 chroma, which libjpeg 9 upsamples inside the
+ *                     scaled IDCT ("fancy upsampling" by DCT scaling);
+ *   jpeg_idct_16x8    4:2:2 chroma, likewise;
+ *   ycc_rgb_convert   YCbCr -> interleaved RGB.
+ * All of them reproduce the integer arithmetic of the C code exactly, so
+ * decoded images are bit-identical whichever path runs.
+ *
+ * The instruction set is chosen at run time (AVX2 if the CPU and OS
+ * support it, otherwise SSE2); on other architectures, or with
+ * JSIMD_FORCENONE set in the environment, the C routines stay in use.
+ */
+
+#define JPEG_INTERNALS
+#include "jinclude.h"
+#include "jpeglib.h"
+#include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"
+
+#if BITS_IN_JSAMPLE == 8 && DCTSIZE == 8 && \
+    (defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define JSIMD_SUPPORTED
+#endif
+
+#ifdef JSIMD_SUPPORTED
+
+#include <stdlib.h>		/* getenv */
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+#ifdef _MSC_VER
+#define JSIMD_INLINE  __forceinline
+#define JSIMD_AVX2_TARGET
+#else
+#define JSIMD_INLINE  __inline__ __attribute__((always_inline))
+#define JSIMD_AVX2_TARGET  __attribute__((target("avx2")))
+#endif
+
+#define JSIMD_NONE  0
+#define JSIMD_SSE2  1
+#define JSIMD_AVX2  2
+
+
+/* Same scaling and constants as jidctint.c */
+
+#define CONST_BITS  13
+#define PASS1_BITS  2
+
+#define FIX_0_298631336  ((INT32)  2446)	/* FIX(0.298631336) */
+#define FIX_0_390180644  ((INT32)  3196)	/* FIX(0.390180644) */
+#define FIX_0_541196100  ((INT32)  4433)	/* FIX(0.541196100) */
+#define FIX_0_765366865  ((INT32)  6270)	/* FIX(0.765366865) */
+#define FIX_0_899976223  ((INT32)  7373)	/* FIX(0.899976223) */
+#define FIX_1_175875602  ((INT32)  9633)	/* FIX(1.175875602) */
+#define FIX_1_501321110  ((INT32)  12299)	/* FIX(1.501321110) */
+#define FIX_1_847759065  ((INT32)  15137)	/* FIX(1.847759065) */
+#define FIX_1_961570560  ((INT32)  16069)	/* FIX(1.961570560) */
+#define FIX_2_053119869  ((INT32)  16819)	/* FIX(2.053119869) */
+#define FIX_2_562915447  ((INT32)  20995)	/* FIX(2.562915447) */
+#define FIX_3_072711026  ((INT32)  25172)	/* FIX(3.072711026) */
+
+#define DEQUANTIZE(coef,quantval)  (((ISLOW_MULT_TYPE) (coef)) * (quantval))
+
+/* Same scaling and constants as the YCbCr->RGB tables in jdcolor.c */
+
+#define SCALEBITS	16
+#define ONE_HALF	((INT32) 1 << (SCALEBITS-1))
+#define CFIX(x)		((INT32) ((x) * (1L<<SCALEBITS) + 0.5))
+
+
+/*
+ * CPU detection.  AVX2 additionally needs the OS to save YMM state.
+ */
+
+LOCAL(int)
+jsimd_detect (void)
+{
+  unsigned int eax, ebx, ecx, edx, ecx7, xcr0;
+  int level = JSIMD_SSE2;	/* guaranteed by the compile-time test above */
+#ifdef _MSC_VER
+  int regs[4];
+#endif
+
+#ifndef NO_GETENV
+  if (getenv("JSIMD_FORCENONE") != NULL)
+    return JSIMD_NONE;
+  if (getenv("JSIMD_FORCESSE2") != NULL)
+    return JSIMD_SSE2;
+#endif
+
+#ifdef _MSC_VER
+  __cpuid(regs, 0);
+  if (regs[0] < 7)
+    return level;
+  __cpuid(regs, 1);
+  ecx = (unsigned int) regs[2];
+  __cpuidex(regs, 7, 0);
+  ebx = (unsigned int) regs[1];
+#else
+  if (__get_cpuid_max(0, NULL) < 7)
+    return level;
+  __cpuid(1, eax, ebx, ecx, edx);
+  __cpuid_count(7, 0, eax, ebx, ecx7, edx);
+#endif
+  /* OSXSAVE and AVX in leaf 1, AVX2 in leaf 7 */
+  if ((ecx & (1U << 27)) == 0 || (ecx & (1U << 28)) == 0 ||
+      (ebx & (1U << 5)) == 0)
+    return level;
+#ifdef _MSC_VER
+  xcr0 = (unsigned int) _xgetbv(0);
+#else
+  __asm__ __volatile__ ("xgetbv" : "=a" (xcr0), "=d" (edx) : "c" (0));
+#endif
+  if ((xcr0 & 6) == 6)		/* XMM and YMM state enabled */
+    level = JSIMD_AVX2;
+  return level;
+}
+
+
+LOCAL(int)
+jsimd_level (void)
+{
+  /* Every thread computes the same value, so a racy first call is harmless */
+  static volatile int level = -1;
+
+  if (level < 0)
+    level = jsimd_detect();
+  return level;
+}
+
+
+/*
+ * Helpers shared by both instruction sets (plain SSE2).
+ */
+
+/* Half of the post-IDCT range-limit table; see prepare_range_limit_table */
+#define RANGE_HALF  ((RANGE_MASK + 1) / 2)
+
+
+/* Check that IDCT_range_limit(cinfo)[x & RANGE_MASK] is the clamp that
+ * jsimd_store_row computes arithmetically.
+ */
+
+LOCAL(boolean)
+jsimd_range_table_ok (j_decompress_ptr cinfo)
+{
+  JSAMPLE * range_limit = IDCT_range_limit(cinfo);
+  int i, v;
+
+  for (i = 0; i <= RANGE_MASK; i++) {
+    v = ((i + RANGE_HALF) & RANGE_MASK) - RANGE_HALF + CENTERJSAMPLE;
+    if (v < 0) v = 0;
+    if (v > MAXJSAMPLE) v = MAXJSAMPLE;
+    if (GETJSAMPLE(range_limit[i]) != v)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+
+/* Range-limit n (8 or 16) descaled IDCT outputs and store them as samples */
+
+JSIMD_INLINE LOCAL(void)
+jsimd_store_row (JSAMPROW outptr, const int * vals, int n)
+{
+  const __m128i half = _mm_set1_epi32(RANGE_HALF);
+  const __m128i mask = _mm_set1_epi32(RANGE_MASK);
+  const __m128i center = _mm_set1_epi32(CENTERJSAMPLE - RANGE_HALF);
+  __m128i v0, v1, v2, v3, w0, w1;
+
+#define RANGE_LIMIT(v) \
+  _mm_add_epi32(_mm_and_si128(_mm_add_epi32(v, half), mask), center)
+
+  v0 = RANGE_LIMIT(_mm_loadu_si128((const __m128i *) vals));
+  v1 = RANGE_LIMIT(_mm_loadu_si128((const __m128i *) (vals + 4)));
+  w0 = _mm_packs_epi32(v0, v1);
+  if (n == 8) {
+    _mm_storel_epi64((__m128i *) outptr, _mm_packus_epi16(w0, w0));
+    return;
+  }
+  v2 = RANGE_LIMIT(_mm_loadu_si128((const __m128i *) (vals + 8)));
+  v3 = RANGE_LIMIT(_mm_loadu_si128((const __m128i *) (vals + 12)));
+  w1 = _mm_packs_epi32(v2, v3);
+  _mm_storeu_si128((__m128i *) outptr, _mm_packus_epi16(w0, w1));
+
+#undef RANGE_LIMIT
+}
+
+
+/* TRUE if all AC coefficients of the block are zero */
+
+JSIMD_INLINE LOCAL(boolean)
+jsimd_dc_only (JCOEFPTR coef_block)
+{
+  const __m128i * p = (const __m128i *) coef_block;
+  __m128i acc;
+
+  acc = _mm_and_si128(_mm_loadu_si128(p),
+		      _mm_setr_epi16(0, -1, -1, -1, -1, -1, -1, -1));
+  acc = _mm_or_si128(acc, _mm_loadu_si128(p + 1));
+  acc = _mm_or_si128(acc, _mm_loadu_si128(p + 2));
+  acc = _mm_or_si128(acc, _mm_loadu_si128(p + 3));
+  acc = _mm_or_si128(acc, _mm_loadu_si128(p + 4));
+  acc = _mm_or_si128(acc, _mm_loadu_si128(p + 5));
+  acc = _mm_or_si128(acc, _mm_loadu_si128(p + 6));
+  acc = _mm_or_si128(acc, _mm_loadu_si128(p + 7));
+  return _mm_movemask_epi8(_mm_cmpeq_epi16(acc, _mm_setzero_si128()))
+	 == 0xFFFF;
+}
+
+
+/* Output of a DC-only block: pass 1 gives dcval << PASS1_BITS everywhere,
+ * pass 2 descales that by PASS1_BITS+3 with rounding.
+ */
+
+JSIMD_INLINE LOCAL(void)
+jsimd_fill_dc (j_decompress_ptr cinfo, ISLOW_MULT_TYPE dcval,
+	       JSAMPARRAY output_buf, JDIMENSION output_col,
+	       int h_size, int v_size)
+{
+  JSAMPLE * range_limit = IDCT_range_limit(cinfo);
+  int ws = (int) dcval << PASS1_BITS;
+  JSAMPLE sample;
+  int ctr;
+  SHIFT_TEMPS
+
+  sample = range_limit[(int) DESCALE((INT32) ws, PASS1_BITS+3) & RANGE_MASK];
+  for (ctr = 0; ctr < v_size; ctr++)
+    memset(output_buf[ctr] + output_col, sample, (size_t) h_size);
+}
+
+
+/*
+ * SSE2 instantiation.  SSE2 lacks a 32-bit low multiply (pmulld is SSE4.1),
+ * but every multiplier here fits in 16 unsigned bits: the IDCT constants
+ * (negative ones are applied as a subtraction) and the quantization values.
+ * With a = hi * 2^16 + lo, a * c mod 2^32 = lo * c + ((hi * c) << 16),
+ * which pmullw/pmulhuw deliver in four instructions.
+ */
+
+JSIMD_INLINE LOCAL(__m128i)
+jsimd_mul16_sse2 (__m128i a, __m128i c16)
+/* c16 holds the multiplier in both 16-bit halves of every lane */
+{
+  return _mm_add_epi32(_mm_mullo_epi16(a, c16),
+		       _mm_slli_epi32(_mm_mulhi_epu16(a, c16), 16));
+}
+
+
+JSIMD_INLINE LOCAL(__m128i)
+jsimd_mulc_sse2 (__m128i a, INT32 c)
+{
+  if (c < 0)
+    return _mm_sub_epi32(_mm_setzero_si128(),
+			 jsimd_mul16_sse2(a, _mm_set1_epi16((short) -c)));
+  return jsimd_mul16_sse2(a, _mm_set1_epi16((short) c));
+}
+
+
+JSIMD_INLINE LOCAL(void)
+jsimd_transpose4_sse2 (const int * src, int sstride, int * dst, int dstride)
+{
+  __m128i r0 = _mm_loadu_si128((const __m128i *) src);
+  __m128i r1 = _mm_loadu_si128((const __m128i *) (src + sstride));
+  __m128i r2 = _mm_loadu_si128((const __m128i *) (src + 2 * sstride));
+  __m128i r3 = _mm_loadu_si128((const __m128i *) (src + 3 * sstride));
+  __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+  __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+  __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+  __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+  _mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi64(t0, t1));
+  _mm_storeu_si128((__m128i *) (dst + dstride), _mm_unpackhi_epi64(t0, t1));
+  _mm_storeu_si128((__m128i *) (dst + 2 * dstride),
+		   _mm_unpacklo_epi64(t2, t3));
+  _mm_storeu_si128((__m128i *) (dst + 3 * dstride),
+		   _mm_unpackhi_epi64(t2, t3));
+}
+
+
+#define VT		__m128i
+#define NL		4
+#define VLOADW(p)	_mm_srai_epi32(_mm_unpacklo_epi16( \
+			  _mm_loadl_epi64((const __m128i *) (p)), \
+			  _mm_loadl_epi64((const __m128i *) (p))), 16)
+#define VLOAD(p)	_mm_loadu_si128((const __m128i *) (p))
+#define VSTORE(p,v)	_mm_storeu_si128((__m128i *) (p), v)
+#define VSET1(c)	_mm_set1_epi32((int) (c))
+#define VADD(a,b)	_mm_add_epi32(a, b)
+#define VSUB(a,b)	_mm_sub_epi32(a, b)
+#define VMUL(a,b)	jsimd_mul16_sse2(a, _mm_or_si128(b, _mm_slli_epi32(b, 16)))
+#define VMULC(v,c)	jsimd_mulc_sse2(v, c)
+#define VSLL(v,n)	_mm_sll_epi32(v, _mm_cvtsi32_si128(n))
+#define VSRA(v,n)	_mm_sra_epi32(v, _mm_cvtsi32_si128(n))
+#define VTRANSPOSE(s,ss,d,ds)	jsimd_transpose4_sse2(s, ss, d, ds)
+#define VTARGET
+#define FN(name)	jsimd_##name##_sse2
+
+#include "jsimdidct.h"
+
+#undef VT
+#undef NL
+#undef VLOADW
+#undef VLOAD
+#undef VSTORE
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMUL
+#undef VMULC
+#undef VSLL
+#undef VSRA
+#undef VTRANSPOSE
+#undef VTARGET
+#undef FN
+
+
+/*
+ * AVX2 instantiation: eight lanes per vector.
+ */
+
+JSIMD_AVX2_TARGET JSIMD_INLINE LOCAL(void)
+jsimd_transpose8_avx2 (const int * src, int sstride, int * dst, int dstride)
+{
+  __m256i r0, r1, r2, r3, r4, r5, r6, r7;
+  __m256i t0, t1, t2, t3, t4, t5, t6, t7;
+  __m256i s0, s1, s2, s3, s4, s5, s6, s7;
+
+  r0 = _mm256_loadu_si256((const __m256i *) src);
+  r1 = _mm256_loadu_si256((const __m256i *) (src + sstride));
+  r2 = _mm256_loadu_si256((const __m256i *) (src + 2 * sstride));
+  r3 = _mm256_loadu_si256((const __m256i *) (src + 3 * sstride));
+  r4 = _mm256_loadu_si256((const __m256i *) (src + 4 * sstride));
+  r5 = _mm256_loadu_si256((const __m256i *) (src + 5 * sstride));
+  r6 = _mm256_loadu_si256((const __m256i *) (src + 6 * sstride));
+  r7 = _mm256_loadu_si256((const __m256i *) (src + 7 * sstride));
+  t0 = _mm256_unpacklo_epi32(r0, r1);
+  t1 = _mm256_unpackhi_epi32(r0, r1);
+  t2 = _mm256_unpacklo_epi32(r2, r3);
+  t3 = _mm256_unpackhi_epi32(r2, r3);
+  t4 = _mm256_unpacklo_epi32(r4, r5);
+  t5 = _mm256_unpackhi_epi32(r4, r5);
+  t6 = _mm256_unpacklo_epi32(r6, r7);
+  t7 = _mm256_unpackhi_epi32(r6, r7);
+  s0 = _mm256_unpacklo_epi64(t0, t2);
+  s1 = _mm256_unpackhi_epi64(t0, t2);
+  s2 = _mm256_unpacklo_epi64(t1, t3);
+  s3 = _mm256_unpackhi_epi64(t1, t3);
+  s4 = _mm256_unpacklo_epi64(t4, t6);
+  s5 = _mm256_unpackhi_epi64(t4, t6);
+  s6 = _mm256_unpacklo_epi64(t5, t7);
+  s7 = _mm256_unpackhi_epi64(t5, t7);
+  /* low 128-bit halves hold columns 0..3, high halves columns 4..7 */
+  _mm256_storeu_si256((__m256i *) dst,
+		      _mm256_permute2x128_si256(s0, s4, 0x20));
+  _mm256_storeu_si256((__m256i *) (dst + dstride),
+		      _mm256_permute2x128_si256(s1, s5, 0x20));
+  _mm256_storeu_si256((__m256i *) (dst + 2 * dstride),
+		      _mm256_permute2x128_si256(s2, s6, 0x20));
+  _mm256_storeu_si256((__m256i *) (dst + 3 * dstride),
+		      _mm256_permute2x128_si256(s3, s7, 0x20));
+  _mm256_storeu_si256((__m256i *) (dst + 4 * dstride),
+		      _mm256_permute2x128_si256(s0, s4, 0x31));
+  _mm256_storeu_si256((__m256i *) (dst + 5 * dstride),
+		      _mm256_permute2x128_si256(s1, s5, 0x31));
+  _mm256_storeu_si256((__m256i *) (dst + 6 * dstride),
+		      _mm256_permute2x128_si256(s2, s6, 0x31));
+  _mm256_storeu_si256((__m256i *) (dst + 7 * dstride),
+		      _mm256_permute2x128_si256(s3, s7, 0x31));
+}
+
+
+#define VT		__m256i
+#define NL		8
+#define VLOADW(p)	_mm256_cvtepi16_epi32( \
+			  _mm_loadu_si128((const __m128i *) (p)))
+#define VLOAD(p)	_mm256_loadu_si256((const __m256i *) (p))
+#define VSTORE(p,v)	_mm256_storeu_si256((__m256i *) (p), v)
+#define VSET1(c)	_mm256_set1_epi32((int) (c))
+#define VADD(a,b)	_mm256_add_epi32(a, b)
+#define VSUB(a,b)	_mm256_sub_epi32(a, b)
+#define VMUL(a,b)	_mm256_mullo_epi32(a, b)
+#define VMULC(v,c)	_mm256_mullo_epi32(v, VSET1(c))
+#define VSLL(v,n)	_mm256_sll_epi32(v, _mm_cvtsi32_si128(n))
+#define VSRA(v,n)	_mm256_sra_epi32(v, _mm_cvtsi32_si128(n))
+#define VTRANSPOSE(s,ss,d,ds)	jsimd_transpose8_avx2(s, ss, d, ds)
+#define VTARGET		JSIMD_AVX2_TARGET
+#define FN(name)	jsimd_##name##_avx2
+
+#include "jsimdidct.h"
+
+#undef VT
+#undef NL
+#undef VLOADW
+#undef VLOAD
+#undef VSTORE
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMUL
+#undef VMULC
+#undef VSLL
+#undef VSRA
+#undef VTRANSPOSE
+#undef VTARGET
+#undef FN
+
+
+/*
+ * YCbCr -> RGB conversion.
+ *
+ * jdcolor.c computes, with x = Cb or Cr - CENTERJSAMPLE,
+ *	R = Y + ((CFIX(1.402) * xr + ONE_HALF) >> 16)
+ *	G = Y + ((- CFIX(0.344136286) * xb + ONE_HALF
+ *		  - CFIX(0.714136286) * xr) >> 16)
+ *	B = Y + ((CFIX(1.772) * xb + ONE_HALF) >> 16)
+ * then clamps to 0..MAXJSAMPLE.  To use the 16-bit pmaddwd, each constant
+ * is split into a multiple of 2^16 (done as a plain add of x) plus a
+ * 16-bit remainder; ONE_HALF rides along as 2 * 16384 in the same pmaddwd.
+ */
+
+#define R_EXTRA   1				/* R += 1 * xr */
+#define R_MULT    (CFIX(1.402) - (1L<<SCALEBITS))
+#define B_EXTRA   2				/* B += 2 * xb */
+#define B_MULT    (CFIX(1.772) - (2L<<SCALEBITS))
+#define G_EXTRA   (-1)				/* G -= 1 * xr */
+#define G_MULT_B  (- CFIX(0.344136286))
+#define G_MULT_R  ((1L<<SCALEBITS) - CFIX(0.714136286))
+
+
+/* Scalar tail, same formulas as the table-driven C code */
+
+LOCAL(void)
+jsimd_ycc_rgb_tail (JSAMPROW inptr0, JSAMPROW inptr1, JSAMPROW inptr2,
+		    JSAMPROW outptr, JDIMENSION col, JDIMENSION num_cols)
+{
+  int y, cb, cr, v;
+  SHIFT_TEMPS
+
+  for (outptr += col * RGB_PIXELSIZE; col < num_cols; col++) {
+    y  = GETJSAMPLE(inptr0[col]);
+    cb = GETJSAMPLE(inptr1[col]) - CENTERJSAMPLE;
+    cr = GETJSAMPLE(inptr2[col]) - CENTERJSAMPLE;
+    v = y + (int) RIGHT_SHIFT(CFIX(1.402) * cr + ONE_HALF, SCALEBITS);
+    outptr[RGB_RED] = (JSAMPLE) (v < 0 ? 0 : v > MAXJSAMPLE ? MAXJSAMPLE : v);
+    v = y + (int) RIGHT_SHIFT(- CFIX(0.344136286) * cb + ONE_HALF
+			      - CFIX(0.714136286) * cr, SCALEBITS);
+    outptr[RGB_GREEN] = (JSAMPLE) (v < 0 ? 0 : v > MAXJSAMPLE ? MAXJSAMPLE : v);
+    v = y + (int) RIGHT_SHIFT(CFIX(1.772) * cb + ONE_HALF, SCALEBITS);
+    outptr[RGB_BLUE] = (JSAMPLE) (v < 0 ? 0 : v > MAXJSAMPLE ? MAXJSAMPLE : v);
+    outptr += RGB_PIXELSIZE;
+  }
+}
+
+
+/* Compute 8 pixels held as 16-bit lanes; xb and xr already centered */
+
+JSIMD_INLINE LOCAL(void)
+jsimd_ycc_rgb8_sse2 (__m128i y, __m128i xb, __m128i xr,
+		     __m128i * r, __m128i * g, __m128i * b)
+{
+  const __m128i two = _mm_set1_epi16(2);
+  const __m128i kr = _mm_setr_epi16((short) R_MULT, 16384, (short) R_MULT,
+				    16384, (short) R_MULT, 16384,
+				    (short) R_MULT, 16384);
+  const __m128i kb = _mm_setr_epi16((short) B_MULT, 16384, (short) B_MULT,
+				    16384, (short) B_MULT, 16384,
+				    (short) B_MULT, 16384);
+  const __m128i kg = _mm_setr_epi16((short) G_MULT_B, (short) G_MULT_R,
+				    (short) G_MULT_B, (short) G_MULT_R,
+				    (short) G_MULT_B, (short) G_MULT_R,
+				    (short) G_MULT_B, (short) G_MULT_R);
+  const __m128i half = _mm_set1_epi32(ONE_HALF);
+  __m128i lo, hi;
+
+  lo = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(xr, two), kr), 16);
+  hi = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(xr, two), kr), 16);
+  *r = _mm_add_epi16(_mm_add_epi16(y, xr), _mm_packs_epi32(lo, hi));
+
+  lo = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(xb, two), kb), 16);
+  hi = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(xb, two), kb), 16);
+  *b = _mm_add_epi16(_mm_add_epi16(y, _mm_add_epi16(xb, xb)),
+		     _mm_packs_epi32(lo, hi));
+
+  lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(xb, xr),
+						   kg), half), 16);
+  hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(xb, xr),
+						   kg), half), 16);
+  *g = _mm_add_epi16(_mm_sub_epi16(y, xr), _mm_packs_epi32(lo, hi));
+}
+
+
+METHODDEF(void)
+jsimd_ycc_rgb_convert_sse2 (j_decompress_ptr cinfo,
+			    JSAMPIMAGE input_buf, JDIMENSION input_row,
+			    JSAMPARRAY output_buf, int num_rows)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i center = _mm_set1_epi16(CENTERJSAMPLE);
+  JDIMENSION num_cols = cinfo->output_width;
+  JSAMPROW inptr0, inptr1, inptr2, outptr;
+  JDIMENSION col;
+  __m128i y, cb, cr, rl, gl, bl, rh, gh, bh;
+  JSAMPLE rgb[3][16];
+  int i;
+
+  while (--num_rows >= 0) {
+    inptr0 = input_buf[0][input_row];
+    inptr1 = input_buf[1][input_row];
+    inptr2 = input_buf[2][input_row];
+    input_row++;
+    outptr = *output_buf++;
+    for (col = 0; col + 16 <= num_cols; col += 16) {
+      y  = _mm_loadu_si128((const __m128i *) (inptr0 + col));
+      cb = _mm_loadu_si128((const __m128i *) (inptr1 + col));
+      cr = _mm_loadu_si128((const __m128i *) (inptr2 + col));
+      jsimd_ycc_rgb8_sse2(_mm_unpacklo_epi8(y, zero),
+			  _mm_sub_epi16(_mm_unpacklo_epi8(cb, zero), center),
+			  _mm_sub_epi16(_mm_unpacklo_epi8(cr, zero), center),
+			  &rl, &gl, &bl);
+      jsimd_ycc_rgb8_sse2(_mm_unpackhi_epi8(y, zero),
+			  _mm_sub_epi16(_mm_unpackhi_epi8(cb, zero), center),
+			  _mm_sub_epi16(_mm_unpackhi_epi8(cr, zero), center),
+			  &rh, &gh, &bh);
+      _mm_storeu_si128((__m128i *) rgb[0], _mm_packus_epi16(rl, rh));
+      _mm_storeu_si128((__m128i *) rgb[1], _mm_packus_epi16(gl, gh));
+      _mm_storeu_si128((__m128i *) rgb[2], _mm_packus_epi16(bl, bh));
+      /* SSE2 has no byte shuffle; interleave through the small buffer */
+      for (i = 0; i < 16; i++, outptr += RGB_PIXELSIZE) {
+	outptr[RGB_RED]   = rgb[0][i];
+	outptr[RGB_GREEN] = rgb[1][i];
+	outptr[RGB_BLUE]  = rgb[2][i];
+      }
+    }
+    jsimd_ycc_rgb_tail(inptr0, inptr1, inptr2, output_buf[-1], col, num_cols);
+  }
+}
+
+
+/* AVX2: 16 pixels per step in 256-bit registers, interleaved with pshufb */
+
+JSIMD_AVX2_TARGET JSIMD_INLINE LOCAL(void)
+jsimd_ycc_rgb16_avx2 (__m256i y, __m256i xb, __m256i xr,
+		      __m256i * r, __m256i * g, __m256i * b)
+{
+  const __m256i two = _mm256_set1_epi16(2);
+  const __m256i kr = _mm256_set1_epi32((int) ((16384L << 16) |
+					      (R_MULT & 0xFFFF)));
+  const __m256i kb = _mm256_set1_epi32((int) ((16384L << 16) |
+					      (B_MULT & 0xFFFF)));
+  const __m256i kg = _mm256_set1_epi32((int) ((G_MULT_R << 16) |
+					      (G_MULT_B & 0xFFFF)));
+  const __m256i half = _mm256_set1_epi32(ONE_HALF);
+  __m256i lo, hi;
+
+  /* unpack and pack both work within 128-bit lanes, so order is kept */
+  lo = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(xr, two),
+					   kr), 16);
+  hi = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(xr, two),
+					   kr), 16);
+  *r = _mm256_add_epi16(_mm256_add_epi16(y, xr), _mm256_packs_epi32(lo, hi));
+
+  lo = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(xb, two),
+					   kb), 16);
+  hi = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(xb, two),
+					   kb), 16);
+  *b = _mm256_add_epi16(_mm256_add_epi16(y, _mm256_add_epi16(xb, xb)),
+			_mm256_packs_epi32(lo, hi));
+
+  lo = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(
+	 _mm256_unpacklo_epi16(xb, xr), kg), half), 16);
+  hi = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(
+	 _mm256_unpackhi_epi16(xb, xr), kg), half), 16);
+  *g = _mm256_add_epi16(_mm256_sub_epi16(y, xr), _mm256_packs_epi32(lo, hi));
+}
+
+
+/* pshufb masks taking byte k of output block j from plane c; -1 = none */
+
+static signed char rgb_shuffle[3][3][16];
+static volatile int rgb_shuffle_ready = 0;
+
+LOCAL(void)
+jsimd_init_rgb_shuffle (void)
+{
+  int c, j, k, pos;
+  static const int offset[3] = { RGB_RED, RGB_GREEN, RGB_BLUE };
+
+  for (c = 0; c < 3; c++)
+    for (j = 0; j < 3; j++)
+      for (k = 0; k < 16; k++) {
+	pos = j * 16 + k;
+	rgb_shuffle[c][j][k] = (signed char)
+	  (pos % 3 == offset[c] ? pos / 3 : -1);
+      }
+  rgb_shuffle_ready = 1;
+}
+
+
+JSIMD_AVX2_TARGET METHODDEF(void)
+jsimd_ycc_rgb_convert_avx2 (j_decompress_ptr cinfo,
+			    JSAMPIMAGE input_buf, JDIMENSION input_row,
+			    JSAMPARRAY output_buf, int num_rows)
+{
+  const __m256i center = _mm256_set1_epi16(CENTERJSAMPLE);
+  JDIMENSION num_cols = cinfo->output_width;
+  JSAMPROW inptr0, inptr1, inptr2, outptr;
+  JDIMENSION col;
+  __m256i r, g, b;
+  __m128i r8, g8, b8, m[3][3];
+  int c, j;
+
+  for (c = 0; c < 3; c++)
+    for (j = 0; j < 3; j++)
+      m[c][j] = _mm_loadu_si128((const __m128i *) rgb_shuffle[c][j]);
+
+  while (--num_rows >= 0) {
+    inptr0 = input_buf[0][input_row];
+    inptr1 = input_buf[1][input_row];
+    inptr2 = input_buf[2][input_row];
+    input_row++;
+    outptr = *output_buf++;
+    for (col = 0; col + 16 <= num_cols; col += 16) {
+      jsimd_ycc_rgb16_avx2(
+	_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)
+					     (inptr0 + col))),
+	_mm256_sub_epi16(_mm256_cvtepu8_epi16(
+	  _mm_loadu_si128((const __m128i *) (inptr1 + col))), center),
+	_mm256_sub_epi16(_mm256_cvtepu8_epi16(
+	  _mm_loadu_si128((const __m128i *) (inptr2 + col))), center),
+	&r, &g, &b);
+      r8 = _mm_packus_epi16(_mm256_castsi256_si128(r),
+			    _mm256_extracti128_si256(r, 1));
+      g8 = _mm_packus_epi16(_mm256_castsi256_si128(g),
+			    _mm256_extracti128_si256(g, 1));
+      b8 = _mm_packus_epi16(_mm256_castsi256_si128(b),
+			    _mm256_extracti128_si256(b, 1));
+      for (j = 0; j < 3; j++, outptr += 16)
+	_mm_storeu_si128((__m128i *) outptr,
+	  _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r8, m[0][j]),
+				    _mm_shuffle_epi8(g8, m[1][j])),
+		       _mm_shuffle_epi8(b8, m[2][j])));
+    }
+    jsimd_ycc_rgb_tail(inptr0, inptr1, inptr2, output_buf[-1], col, num_cols);
+  }
+}
+
+
+/*
+ * Selection entry points.
+ */
+
+GLOBAL(inverse_DCT_method_ptr)
+jsimd_select_idct (j_decompress_ptr cinfo, int h_size, int v_size)
+{
+  int level = jsimd_level();
+
+  if (level == JSIMD_NONE || SIZEOF(ISLOW_MULT_TYPE) != SIZEOF(int) ||
+      ! jsimd_range_table_ok(cinfo))
+    return NULL;
+
+  switch ((h_size << 8) + v_size) {
+  case ((8 << 8) + 8):
+    return level == JSIMD_AVX2 ? jsimd_idct_islow_avx2 : jsimd_idct_islow_sse2;
+  case ((16 << 8) + 16):
+    return level == JSIMD_AVX2 ? jsimd_idct_16x16_avx2 : jsimd_idct_16x16_sse2;
+  case ((16 << 8) + 8):
+    return level == JSIMD_AVX2 ? jsimd_idct_16x8_avx2 : jsimd_idct_16x8_sse2;
+  default:
+    return NULL;
+  }
+}
+
+
+GLOBAL(jsimd_color_convert_ptr)
+jsimd_select_ycc_rgb (j_decompress_ptr cinfo)
+{
+  int level = jsimd_level();
+
+  if (level == JSIMD_NONE || RGB_PIXELSIZE != 3)
+    return NULL;
+  if (level == JSIMD_AVX2) {
+    if (! rgb_shuffle_ready)
+      jsimd_init_rgb_shuffle();
+    return jsimd_ycc_rgb_convert_avx2;
+  }
+  return jsimd_ycc_rgb_convert_sse2;
+}
+
+#else /* ! JSIMD_SUPPORTED */
+
+GLOBAL(inverse_DCT_method_ptr)
+jsimd_select_idct (j_decompress_ptr cinfo, int h_size, int v_size)
+{
+  return NULL;
+}
+
+
+GLOBAL(jsimd_color_convert_ptr)
+jsimd_select_ycc_rgb (j_decompress_ptr cinfo)
+{
+  return NULL;
+}
+
+#endif /* JSIMD_SUPPORTED */
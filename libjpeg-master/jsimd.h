@@ -0,0 +1,32 @@
+/*
+ * jsimd.h
+ *
+ * This file is part of the Independent JPEG Group's software.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * Private declarations for the SIMD (SSE2 / AVX2) decompression kernels
+ * in jsimd.c.  Each selector returns NULL when no vector version applies
+ * on this CPU or build, and the caller keeps the portable C routine.
+ * The vector routines are bit-exact replacements for the C ones.
+ *
+ * Setting the environment variable JSIMD_FORCENONE disables the kernels,
+ * JSIMD_FORCESSE2 restricts them to SSE2 (useful for comparisons).
+ */
+
+/* Short forms of external names for systems with brain-damaged linkers. */
+
+#ifdef NEED_SHORT_EXTERNAL_NAMES
+#define jsimd_select_idct	jSSelIdct
+#define jsimd_select_ycc_rgb	jSSelYccRgb
+#endif /* NEED_SHORT_EXTERNAL_NAMES */
+
+/* IDCT for a DCT_h_scaled_size x DCT_v_scaled_size block (islow only) */
+EXTERN(inverse_DCT_method_ptr) jsimd_select_idct
+	JPP((j_decompress_ptr cinfo, int h_size, int v_size));
+
+/* YCbCr -> RGB conversion (normal sYCC gamut only) */
+typedef JMETHOD(void, jsimd_color_convert_ptr,
+		(j_decompress_ptr cinfo, JSAMPIMAGE input_buf,
+		 JDIMENSION input_row, JSAMPARRAY output_buf, int num_rows));
+EXTERN(jsimd_color_convert_ptr) jsimd_select_ycc_rgb
+	JPP((j_decompress_ptr cinfo));
@@ -0,0 +1,316 @@
+/*
+ * jsimdidct.h
+ *
+ * This file is part of the Independent JPEG Group's software.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * Vector versions of the jidctint.c routines jpeg_idct_islow,
+ * jpeg_idct_16x16 and jpeg_idct_16x8.  This file is included by jsimd.c
+ * once per instruction set, after defining the vector primitives:
+ *
+ *	VT		vector of NL signed 32-bit lanes
+ *	VLOADW(p)	load NL JCOEFs, sign-extended
+ *	VLOAD(p)	load NL ints
+ *	VSTORE(p,v)	store NL ints
+ *	VSET1(c)	broadcast constant
+ *	VADD, VSUB	lane-wise add/subtract
+ *	VMULC(v,c)	lane-wise multiply by constant, low 32 bits
+ *	VMUL(a,b)	lane-wise multiply, low 32 bits
+ *	VSLL, VSRA	shift left / arithmetic shift right by constant
+ *	VTRANSPOSE(s,ss,d,ds)	transpose NL x NL ints, strides ss and ds
+ *	FN(name)	decorates a name with the instruction set suffix
+ *	VTARGET	function attribute enabling the instruction set
+ *
+ * Each 1-D pass works on NL columns (pass 1) or NL rows (pass 2) at once,
+ * using exactly the integer arithmetic of the C code, so the output is
+ * identical to it.  The work array is transposed between the passes.
+ * The C code's zero-AC shortcuts are omitted except for whole DC-only
+ * blocks; they are arithmetic identities, not approximations.
+ */
+
+
+/* Kernel input k: dequantized coefficients in pass 1 (coef != NULL),
+ * work array row k in pass 2.  Outputs go to dst row k.  Everything is
+ * inlined with constant arguments, so no vector arrays or loops remain.
+ */
+
+#define IN(k)  (coef != NULL ? \
+		VMUL(VLOADW(coef + DCTSIZE*(k)), VLOAD(quant + DCTSIZE*(k))) : \
+		VLOAD(src + sstride*(k)))
+#define OUT(k,v)  VSTORE(dst + dstride*(k), VSRA(v, shift))
+
+
+
+/* 8-point kernel of jpeg_idct_islow, cK represents sqrt(2) * cos(K*pi/16).
+ * bias is the descale fudge factor already scaled by CONST_BITS.
+ */
+
+VTARGET JSIMD_INLINE LOCAL(void)
+FN(idct_kernel8) (JCOEFPTR coef, ISLOW_MULT_TYPE * quant,
+		  const int * src, int sstride, int * dst, int dstride,
+		  VT bias, int shift)
+{
+  VT tmp0, tmp1, tmp2, tmp3, tmp10, tmp11, tmp12, tmp13, z1, z2, z3;
+
+  /* Even part */
+
+  z2 = IN(2);
+  z3 = IN(6);
+
+  z1 = VMULC(VADD(z2, z3), FIX_0_541196100);           /* c6 */
+  tmp2 = VADD(z1, VMULC(z2, FIX_0_765366865));         /* c2-c6 */
+  tmp3 = VSUB(z1, VMULC(z3, FIX_1_847759065));         /* c2+c6 */
+
+  z2 = IN(0);
+  z3 = IN(4);
+  tmp0 = VADD(VSLL(VADD(z2, z3), CONST_BITS), bias);
+  tmp1 = VADD(VSLL(VSUB(z2, z3), CONST_BITS), bias);
+
+  tmp10 = VADD(tmp0, tmp2);
+  tmp13 = VSUB(tmp0, tmp2);
+  tmp11 = VADD(tmp1, tmp3);
+  tmp12 = VSUB(tmp1, tmp3);
+
+  /* Odd part */
+
+  tmp0 = IN(7);
+  tmp1 = IN(5);
+  tmp2 = IN(3);
+  tmp3 = IN(1);
+
+  z2 = VADD(tmp0, tmp2);
+  z3 = VADD(tmp1, tmp3);
+
+  z1 = VMULC(VADD(z2, z3), FIX_1_175875602);           /*  c3 */
+  z2 = VMULC(z2, - FIX_1_961570560);                   /* -c3-c5 */
+  z3 = VMULC(z3, - FIX_0_390180644);                   /* -c3+c5 */
+  z2 = VADD(z2, z1);
+  z3 = VADD(z3, z1);
+
+  z1 = VMULC(VADD(tmp0, tmp3), - FIX_0_899976223);     /* -c3+c7 */
+  tmp0 = VADD(VMULC(tmp0, FIX_0_298631336), VADD(z1, z2));
+  tmp3 = VADD(VMULC(tmp3, FIX_1_501321110), VADD(z1, z3));
+
+  z1 = VMULC(VADD(tmp1, tmp2), - FIX_2_562915447);     /* -c1-c3 */
+  tmp1 = VADD(VMULC(tmp1, FIX_2_053119869), VADD(z1, z3));
+  tmp2 = VADD(VMULC(tmp2, FIX_3_072711026), VADD(z1, z2));
+
+  /* Final output stage */
+
+  OUT(0,  VADD(tmp10, tmp3));
+  OUT(7,  VSUB(tmp10, tmp3));
+  OUT(1,  VADD(tmp11, tmp2));
+  OUT(6,  VSUB(tmp11, tmp2));
+  OUT(2,  VADD(tmp12, tmp1));
+  OUT(5,  VSUB(tmp12, tmp1));
+  OUT(3,  VADD(tmp13, tmp0));
+  OUT(4,  VSUB(tmp13, tmp0));
+}
+
+
+/* 8-in, 16-out kernel of jpeg_idct_16x16 and jpeg_idct_16x8,
+ * cK represents sqrt(2) * cos(K*pi/32).
+ */
+
+VTARGET JSIMD_INLINE LOCAL(void)
+FN(idct_kernel16) (JCOEFPTR coef, ISLOW_MULT_TYPE * quant,
+		   const int * src, int sstride, int * dst, int dstride,
+		   VT bias, int shift)
+{
+  VT tmp0, tmp1, tmp2, tmp3, tmp10, tmp11, tmp12, tmp13;
+  VT tmp20, tmp21, tmp22, tmp23, tmp24, tmp25, tmp26, tmp27;
+  VT z1, z2, z3, z4;
+
+  /* Even part */
+
+  tmp0 = VADD(VSLL(IN(0), CONST_BITS), bias);
+
+  z1 = IN(4);
+  tmp1 = VMULC(z1, FIX(1.306562965));                  /* c4[16] = c2[8] */
+  tmp2 = VMULC(z1, FIX_0_541196100);                   /* c12[16] = c6[8] */
+
+  tmp10 = VADD(tmp0, tmp1);
+  tmp11 = VSUB(tmp0, tmp1);
+  tmp12 = VADD(tmp0, tmp2);
+  tmp13 = VSUB(tmp0, tmp2);
+
+  z1 = IN(2);
+  z2 = IN(6);
+  z3 = VSUB(z1, z2);
+  z4 = VMULC(z3, FIX(0.275899379));                    /* c14[16] = c7[8] */
+  z3 = VMULC(z3, FIX(1.387039845));                    /* c2[16] = c1[8] */
+
+  tmp0 = VADD(z3, VMULC(z2, FIX_2_562915447));         /* (c6+c2)[16] */
+  tmp1 = VADD(z4, VMULC(z1, FIX_0_899976223));         /* (c6-c14)[16] */
+  tmp2 = VSUB(z3, VMULC(z1, FIX(0.601344887)));        /* (c2-c10)[16] */
+  tmp3 = VSUB(z4, VMULC(z2, FIX(0.509795579)));        /* (c10-c14)[16] */
+
+  tmp20 = VADD(tmp10, tmp0);
+  tmp27 = VSUB(tmp10, tmp0);
+  tmp21 = VADD(tmp12, tmp1);
+  tmp26 = VSUB(tmp12, tmp1);
+  tmp22 = VADD(tmp13, tmp2);
+  tmp25 = VSUB(tmp13, tmp2);
+  tmp23 = VADD(tmp11, tmp3);
+  tmp24 = VSUB(tmp11, tmp3);
+
+  /* Odd part */
+
+  z1 = IN(1);
+  z2 = IN(3);
+  z3 = IN(5);
+  z4 = IN(7);
+
+  tmp11 = VADD(z1, z3);
+
+  tmp1  = VMULC(VADD(z1, z2), FIX(1.353318001));       /* c3 */
+  tmp2  = VMULC(tmp11,        FIX(1.247225013));       /* c5 */
+  tmp3  = VMULC(VADD(z1, z4), FIX(1.093201867));       /* c7 */
+  tmp10 = VMULC(VSUB(z1, z4), FIX(0.897167586));       /* c9 */
+  tmp11 = VMULC(tmp11,        FIX(0.666655658));       /* c11 */
+  tmp12 = VMULC(VSUB(z1, z2), FIX(0.410524528));       /* c13 */
+  tmp0  = VSUB(VADD(VADD(tmp1, tmp2), tmp3),
+	       VMULC(z1, FIX(2.286341144)));           /* c7+c5+c3-c1 */
+  tmp13 = VSUB(VADD(VADD(tmp10, tmp11), tmp12),
+	       VMULC(z1, FIX(1.835730603)));           /* c9+c11+c13-c15 */
+  z1    = VMULC(VADD(z2, z3), FIX(0.138617169));       /* c15 */
+  tmp1  = VADD(tmp1, VADD(z1, VMULC(z2, FIX(0.071888074))));
+  tmp2  = VADD(tmp2, VSUB(z1, VMULC(z3, FIX(1.125726048))));
+  z1    = VMULC(VSUB(z3, z2), FIX(1.407403738));       /* c1 */
+  tmp11 = VADD(tmp11, VSUB(z1, VMULC(z3, FIX(0.766367282))));
+  tmp12 = VADD(tmp12, VADD(z1, VMULC(z2, FIX(1.971951411))));
+  z2    = VADD(z2, z4);
+  z1    = VMULC(z2, - FIX(0.666655658));               /* -c11 */
+  tmp1  = VADD(tmp1, z1);
+  tmp3  = VADD(tmp3, VADD(z1, VMULC(z4, FIX(1.065388962))));
+  z2    = VMULC(z2, - FIX(1.247225013));               /* -c5 */
+  tmp10 = VADD(tmp10, VADD(z2, VMULC(z4, FIX(3.141271809))));
+  tmp12 = VADD(tmp12, z2);
+  z2    = VMULC(VADD(z3, z4), - FIX(1.353318001));     /* -c3 */
+  tmp2  = VADD(tmp2, z2);
+  tmp3  = VADD(tmp3, z2);
+  z2    = VMULC(VSUB(z4, z3), FIX(0.410524528));       /* c13 */
+  tmp10 = VADD(tmp10, z2);
+  tmp11 = VADD(tmp11, z2);
+
+  /* Final output stage */
+
+  OUT(0,  VADD(tmp20, tmp0));
+  OUT(15, VSUB(tmp20, tmp0));
+  OUT(1,  VADD(tmp21, tmp1));
+  OUT(14, VSUB(tmp21, tmp1));
+  OUT(2,  VADD(tmp22, tmp2));
+  OUT(13, VSUB(tmp22, tmp2));
+  OUT(3,  VADD(tmp23, tmp3));
+  OUT(12, VSUB(tmp23, tmp3));
+  OUT(4,  VADD(tmp24, tmp10));
+  OUT(11, VSUB(tmp24, tmp10));
+  OUT(5,  VADD(tmp25, tmp11));
+  OUT(10, VSUB(tmp25, tmp11));
+  OUT(6,  VADD(tmp26, tmp12));
+  OUT(9,  VSUB(tmp26, tmp12));
+  OUT(7,  VADD(tmp27, tmp13));
+  OUT(8,  VSUB(tmp27, tmp13));
+}
+
+
+/* Transpose a rows x cols int matrix (both multiples of NL). */
+
+VTARGET JSIMD_INLINE LOCAL(void)
+FN(transpose) (const int * src, int rows, int cols, int * dst)
+{
+  int r, c;
+
+  for (r = 0; r < rows; r += NL)
+    for (c = 0; c < cols; c += NL)
+      VTRANSPOSE(src + r * cols + c, cols, dst + c * rows + r, rows);
+}
+
+
+/* Shared body: pass 1 over the 8 coefficient columns with a kernel that
+ * yields v_size rows, pass 2 over those rows yielding h_size samples.
+ */
+
+VTARGET JSIMD_INLINE LOCAL(void)
+FN(idct_2pass) (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		JCOEFPTR coef_block,
+		JSAMPARRAY output_buf, JDIMENSION output_col,
+		int h_size, int v_size)
+{
+  ISLOW_MULT_TYPE * quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  VT bias;
+  int workspace[16*16];		/* pass 1 output, then pass 2 output */
+  int transposed[16*16];	/* column-major copy for pass 2 */
+  int ctr;
+
+  if (jsimd_dc_only(coef_block)) {
+    /* Every sample equals the descaled DC term, as in the C shortcuts */
+    jsimd_fill_dc(cinfo, DEQUANTIZE(coef_block[0], quantptr[0]),
+		  output_buf, output_col, h_size, v_size);
+    return;
+  }
+
+  /* Pass 1: process columns from input, store into work array. */
+
+  bias = VSET1(ONE << (CONST_BITS-PASS1_BITS-1));
+  for (ctr = 0; ctr < 8; ctr += NL) {
+    if (v_size == 16)
+      FN(idct_kernel16)(coef_block + ctr, quantptr + ctr, NULL, 0,
+			workspace + ctr, 8, bias, CONST_BITS-PASS1_BITS);
+    else
+      FN(idct_kernel8)(coef_block + ctr, quantptr + ctr, NULL, 0,
+		       workspace + ctr, 8, bias, CONST_BITS-PASS1_BITS);
+  }
+
+  /* Pass 2: process rows from work array, NL rows per step. */
+
+  FN(transpose)(workspace, v_size, 8, transposed);
+  bias = VSET1((ONE << (PASS1_BITS+2)) << CONST_BITS);
+  for (ctr = 0; ctr < v_size; ctr += NL) {
+    if (h_size == 16)
+      FN(idct_kernel16)(NULL, NULL, transposed + ctr, v_size,
+			workspace + ctr, v_size, bias,
+			CONST_BITS+PASS1_BITS+3);
+    else
+      FN(idct_kernel8)(NULL, NULL, transposed + ctr, v_size,
+		       workspace + ctr, v_size, bias,
+		       CONST_BITS+PASS1_BITS+3);
+  }
+
+  /* Back to row-major order, then range-limit and store. */
+
+  FN(transpose)(workspace, h_size, v_size, transposed);
+  for (ctr = 0; ctr < v_size; ctr++)
+    jsimd_store_row(output_buf[ctr] + output_col, transposed + h_size*ctr,
+		    h_size);
+}
+
+
+VTARGET METHODDEF(void)
+FN(idct_islow) (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		JCOEFPTR coef_block,
+		JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  FN(idct_2pass)(cinfo, compptr, coef_block, output_buf, output_col, 8, 8);
+}
+
+
+VTARGET METHODDEF(void)
+FN(idct_16x16) (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		JCOEFPTR coef_block,
+		JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  FN(idct_2pass)(cinfo, compptr, coef_block, output_buf, output_col, 16, 16);
+}
+
+
+VTARGET METHODDEF(void)
+FN(idct_16x8) (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+	       JCOEFPTR coef_block,
+	       JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  FN(idct_2pass)(cinfo, compptr, coef_block, output_buf, output_col, 16, 8);
+}
+
+#undef IN
+#undef OUT
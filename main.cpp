@@ -11,6 +11,38 @@
 #include "imgui_impl_opengl3.h"
 #include <cstdint>
 #include <functional>
+#include <string>
+#include <csetjmp>
+#include <cstdio>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <cctype>
+#include <climits>
+#include <memory>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+#include <unordered_map>
+#include <cstring>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+extern "C" {
+#include "jpeglib.h"
+#include "jpegint.h"        // jpeg_color_deconverter - przechwytywanie Y w konwersji barw
+#include "transupp.h"
+#include "jmemarena.h"      // pula bloków libjpeg współdzielona między kolejnymi plikami
+}
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
 #include "GLFW/stb_image.h"
@@ -26,7 +58,9 @@ static float g_panX = 0.0f, g_panY = 0.0f;
 static bool  g_dragging = false;
 static double g_dragStartX = 0.0, g_dragStartY = 0.0;
 static float g_panStartX = 0.0f, g_panStartY = 0.0f;
+static int   g_viewW = 0, g_viewH = 0;          // okno przy ostatnim rysowaniu obrazu (widoczna część dla podglądu)
 static bool g_isBinary = false;
+static bool  g_windowEvent = false;             // wejście albo zmiana okna od ostatniego obiegu pętli - trzeba narysować klatkę
 
 bool showTAutoMin = false, showTDouble = false, showTHyst = false;
 bool showTNiblack = false, showTSauvola = false, showTWolf = false;
@@ -41,17 +75,239 @@ float Rparam = 128.0f;              // dodatkowy parametr Sauvola
 const int TOP_BAR_HEIGHT = 50;
 const int RIGHT_BAR_WIDTH = 524;
 
+// --- texture upload --------------------------------------------------------
+const long long PARALLEL_UPLOAD_MIN_PIXELS = 1000000;   // mniejsze obrazy pakowane do BGRA w jednym wątku
+const int    TEXTURE_TILE_SIZE = 512;                   // bok kafelka tekstury (bez 1 px obramowania)
+const size_t TEXTURE_TILE_BUDGET = size_t(256) << 20;  // pamięć GPU kafelków; ponad nią usuwane najdawniej rysowane
+
+// --- filter preview --------------------------------------------------------
+const double PREVIEW_FRAME_BUDGET_MS = 25.0;            // tyle może liczyć się podgląd w klatce, większe - z mniejszego poziomu
+const double PREVIEW_SETTLE_SECONDS = 0.15;             // suwak stoi tak długo: podgląd pośredni liczony w pełnej rozdzielczości
+const double PREVIEW_PROBE_PIXELS = 65536;              // pierwszy podgląd, póki koszt operacji nieznany
+const unsigned KMEANS_SEED = 0x5eed;                    // losowanie startowych centroidów k-means - powtarzalne
+
+// --- main loop -------------------------------------------------------------
+const int    REDRAW_FRAMES_AFTER_EVENT = 3;             // klatki po zdarzeniu (ImGui dopasowuje okna w 2 klatkach)
+const double BACKGROUND_POLL_SECONDS = 0.05;            // jak często sprawdzać wyniki zadań w tle, gdy nic się nie dzieje
+
+// --- proxy decode ----------------------------------------------------------
+// dłuższy bok podglądu nie schodzi poniżej tej wartości (skala DCT 1/2, 1/4, 1/8)
+const int PROXY_MIN_SIDE = 2048;
+const size_t STRIP_BUDGET = size_t(64) << 20;   // bajty na pas wierszy przy zapisie pasami
+const char* TEMP_SUFFIX = ".tmp";                // zapis obok pliku docelowego, podmiana po udanym zapisie
+const long long PARALLEL_DECODE_MIN_PIXELS = 4000000;   // mniejsze pliki dekodowane sekwencyjnie
+const long long PARALLEL_ENCODE_MIN_PIXELS = 4000000;   // mniejsze obrazy kodowane sekwencyjnie
+// limit tego, co zostaje w puli libjpeg między plikami; pamięć w użyciu bez limitu (jak jmemnobs) - wspólny limit
+// obcinałby równoległe obiekty (podgląd, miniatury, zapis) i bufory współczynników dużych plików progresywnych
+const size_t JPEG_ARENA_IDLE  = size_t(256) << 20;
+
+// --- folder / filmstrip ----------------------------------------------------
+const int   THUMB_SIZE = 160;                   // dłuższy bok miniatury w pamięci podręcznej
+const int   FILMSTRIP_HEIGHT = 180;
+const char* THUMB_CACHE_NAME = ".photoshoot-thumbs";
+const int    PREFETCH_RADIUS = 2;                       // ile sąsiednich plików z każdej strony dekodować zawczasu
+const size_t PREFETCH_BUDGET = size_t(768) << 20;       // limit pamięci gotowych obrazów w LRU
+
+// prostokąt pikseli obrazu zmieniony przez operację (tekstura i histogramy odświeżane tylko w nim)
+struct PixelRect {
+    int x = 0, y = 0, w = 0, h = 0;
+    bool empty() const { return w <= 0 || h <= 0; }
+};
+
+// kafelek piramidy na GPU: piksele poziomu [x, x+w) x [y, y+h) z ramką 1 px od sąsiadów (bez szwów przy GL_LINEAR)
+struct TextureTile {
+    GLuint      tex = 0;
+    int         level = 0;
+    int         x = 0, y = 0, w = 0, h = 0;
+    int         bx = 0, by = 0, texW = 0, texH = 0;     // położenie zawartości w teksturze i rozmiar tekstury
+    PixelRect   dirty;                                  // do ponownego wysłania (współrzędne poziomu)
+    uint64_t    lastUsed = 0;                           // klatka ostatniego rysowania - LRU
+};
+
+// obraz na ekranie: poziom 0 to img.pixels, poziomy 1, 2, ... to kolejne zmniejszenia 2x (BGRA), liczone dopiero
+// przy oddaleniu; tekstury mają tylko kafelki widoczne w oknie
+struct TexturePyramid {
+    int                                         width = 0, height = 0;     // poziom 0; 0 - nic do pokazania
+    std::vector<std::vector<uint32_t>>          levels;                    // levels[L-1] = poziom L
+    std::vector<PixelRect>                      stale;                     // stale[L-1] - część poziomu L do przeliczenia
+    std::unordered_map<uint64_t, TextureTile>   tiles;                     // klucz: poziom, wiersz i kolumna kafelka
+    size_t                                      residentBytes = 0;
+    uint64_t                                    frame = 0;
+    // podgląd popupu: wynik operacji dla widocznego prostokąta poziomu previewLevel, wklejany w jego kafelki
+    int                                         previewLevel = -1;        // -1 - brak
+    PixelRect                                   previewRect;              // współrzędne poziomu previewLevel
+    std::vector<uint32_t>                       preview;                  // BGRA, previewRect.w * previewRect.h
+};
+
 struct ImageData {
-    GLuint                       textureID = 0;
+    TexturePyramid               display;                   // kafelki tekstur na ekranie
     int                          width = 0, height = 0, channels = 0;
     std::vector<unsigned char>   pixels;
     std::vector<float>           histGray, histR, histG, histB;
+    std::string                  path;                      // plik źródłowy
+    int                          scaleDenom = 1;            // 1 = pełna rozdzielczość, 2/4/8 = podgląd z DCT
+    int                          fullWidth = 0, fullHeight = 0;
+    int                          mcuWidth = 8, mcuHeight = 8;   // iMCU pliku źródłowego (pełna rozdzielczość)
+    std::vector<unsigned char>   luma;                      // płaszczyzna Y z dekodera (width*height), póki piksele są nieedytowane
+};
+
+// plik zmapowany do pamięci tylko do odczytu - dekoder czyta wprost ze stron pliku, bez bufora stdio
+struct MappedFile {
+    const unsigned char* data = nullptr;
+    size_t               size = 0;
+#ifdef _WIN32
+    HANDLE               file = INVALID_HANDLE_VALUE;
+    HANDLE               mapping = nullptr;
+#else
+    int                  fd = -1;
+#endif
+
+    explicit MappedFile(const char* fn);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    bool valid() const { return data != nullptr; }
+};
+
+// jedno dekodowanie w tle; należy do wątku i do g_loadJob, porzucone kończy się samo
+struct LoadTask {
+    std::atomic<bool>  done{ false };
+    std::atomic<bool>  cancel{ false };     // inny plik otwarty: dekoder przerywa między paczkami wierszy
+    bool               ok = false;
+    ImageData          result;
+};
+
+// wczytywanie w tle: zgrubny podgląd jest już na ekranie, wątek dekoduje obraz roboczy
+struct LoadJob {
+    std::thread                 worker;
+    std::shared_ptr<LoadTask>   task;
+    bool                        pending = false;     // wątek uruchomiony, wynik jeszcze nie podmieniony
+    int                         targetWidth = 0;     // szerokość obrazu roboczego (do skali wyświetlania podglądu)
+    // przerwane wczytywania: wątki dołączane dopiero po zakończeniu, wątek główny na nie nie czeka
+    std::vector<std::pair<std::thread, std::shared_ptr<LoadTask>>>  retired;
+};
+static LoadJob g_loadJob;
+
+// pula wątków roboczych: kolejka FIFO zadań (miniatury, później dekodowanie/kodowanie pasami)
+struct ThreadPool {
+    std::vector<std::thread>           workers;
+    std::deque<std::function<void()>>  tasks;
+    std::mutex                         mutex;
+    std::condition_variable            cv;
+    bool                               stop = false;
+
+    void start(int n);
+    void submit(std::function<void()> task, bool urgent = false);
+    void shutdown();
+    void parallelFor(int n, const std::function<void(int)>& fn);
+};
+static ThreadPool g_pool;
+
+// metadane z samego nagłówka (jpeg_read_header + APP1/EXIF), bez dekodowania pikseli
+struct ImageInfo {
+    int          width = 0, height = 0, components = 0;
+    int          hSamp[3] = { 1, 1, 1 }, vSamp[3] = { 1, 1, 1 };
+    bool         progressive = false;
+    int          orientation = 1;           // EXIF 1..8; 5-8 zamieniają szerokość z wysokością
+    std::string  captureTime;               // EXIF DateTimeOriginal (lub DateTime), "RRRR:MM:DD GG:MM:SS"
+};
+
+// miniatura pliku z folderu; wypełniana przez pulę, tekstura tworzona w wątku głównym
+struct Thumbnail {
+    std::string                 path;
+    long long                   mtime = 0;          // klucz pamięci podręcznej razem z nazwą pliku
+    int                         width = 0, height = 0;
+    std::vector<unsigned char>  rgb;                // piksele do wysłania jako tekstura
+    std::vector<unsigned char>  jpeg;               // skompresowana miniatura = wpis pliku pamięci podręcznej
+    GLuint                      textureID = 0;
+    std::atomic<int>            state{ 0 };         // 0 - w kolejce, 1 - piksele gotowe, 2 - tekstura, -1 - błąd
+    ImageInfo                   info;
+    std::atomic<int>            infoState{ 0 };     // 0 - w kolejce, 1 - odczytane, -1 - nieczytelny nagłówek
+};
+
+// obraz roboczy sąsiedniego pliku dekodowany zawczasu przez pulę
+struct PrefetchEntry {
+    std::string        path;
+    ImageData          image;
+    std::atomic<int>   state{ 0 };          // 0 - dekodowanie, 1 - gotowy, -1 - błąd
+    bool               counted = false;     // rozmiar doliczony do FolderView::prefetchBytes
+};
+
+struct FolderView {
+    std::string                                   dir;
+    std::vector<std::shared_ptr<Thumbnail>>       thumbs;
+    int                                           current = -1;
+    bool                                          cacheDirty = false;     // są miniatury spoza pliku pamięci podręcznej
+    std::shared_ptr<std::atomic<bool>>            cancel;                 // zadania poprzedniego folderu kończą się od razu
+    std::list<std::shared_ptr<PrefetchEntry>>     prefetch;               // LRU, najświeższy na początku
+    size_t                                        prefetchBytes = 0;
+    bool                                          scrollToCurrent = false;
+    std::vector<int>                              order;                  // widoczne pliki w kolejności wyświetlania
+    int                                           sortMode = 0;           // 0 - nazwa, 1 - data wykonania, 2 - megapiksele
+    int                                           showMode = 0;           // 0 - wszystkie, 1 - poziome, 2 - pionowe
+    bool                                          infoScanned = false;    // kolejność zbudowana z kompletu metadanych
+};
+static FolderView g_folder;
+
+// operacja geometryczna zapisana w historii - pozwala zapisać plik bezstratnie przez transupp
+struct GeomOp {
+    enum Kind { None, Rot90, Rot180, Rot270, FlipH, FlipV, Crop } kind = None;
+    int x = 0, y = 0, w = 0, h = 0;                         // kadr we współrzędnych pełnej rozdzielczości
 };
 
 struct Snapshot {
-    std::vector<unsigned char> pixels;
-    int                        channels;
+    std::vector<unsigned char>       pixels;
+    int                              channels;
+    int                              width, height;
+    std::function<void(ImageData&)>  op;                    // operacja odtwarzana na pełnej rozdzielczości
+    int                              halo = -1;             // wiersze kontekstu (pełnej rozdzielczości) potrzebne op przy pracy pasami;
+                                                            // -1 = operacja globalna
+    GeomOp                           geom;
+    bool                             lumaOnly = false;      // op czyta tylko jasność i zostawia obraz szary (progowania)
+    int                              brightness = 0;        // op to brightnessImage(delta) - zapis przez przesunięcie DC
+    std::vector<unsigned char>       luma;                  // Y z dekodera, jeśli pixels to nieedytowany obraz; następna
+                                                            // operacja (na ekranie i przy zapisie) czyta jasność z niego
+};
+
+// okno filtra ustawione na obrazie 1/proxyDenom przeliczone na obraz 1/imageDenom (nieparzyste); operacje
+// z historii odtwarzane przy zapisie obejmują wtedy ten sam fragment zdjęcia co na podglądzie
+inline int scaleWindow(int win, int proxyDenom, int imageDenom) {
+    return std::max(1, win * proxyDenom / std::max(1, imageDenom)) | 1;
+}
+
+// parametry kodera libjpeg przy zapisie
+struct JpegExportOptions {
+    int   quality = 90;
+    bool  optimize = true;          // optymalne tablice Huffmana (dodatkowy przebieg)
+    bool  progressive = false;
+    int   subsampling = 420;        // 444, 422 lub 420
+};
+
+// zapis w tle: kopia pikseli i historii trafia do wątku, edycja trwa dalej
+struct ExportJob {
+    std::thread         worker;
+    std::atomic<bool>   done{ false };
+    std::atomic<float>  progress{ 0.0f };
+    bool                pending = false;
+    bool                ok = false;
+    std::string         path;
 };
+static ExportJob g_exportJob;
+
+// jasność pliku z samych współczynników DC luminancji: jeden punkt na blok 8x8 (jego średnia)
+struct DcStats {
+    std::vector<float>  hist = std::vector<float>(256, 0.0f);      // liczba bloków wg średniej jasności
+    double              mean = 0.0;
+    long long           blocks = 0;
+};
+
+// statystyki DC bieżącego pliku liczone na puli; zlecenie poprzedniego pliku jest porzucane
+struct DcStatsJob {
+    std::string        path;
+    DcStats            stats;
+    std::atomic<int>   state{ 0 };          // 0 - w toku, 1 - gotowe, -1 - nie JPEG YCbCr/szary albo błąd
+};
+static std::shared_ptr<DcStatsJob> g_dcStats;
 
 bool  initGLFW();
 GLFWwindow* createWindow(int w, int h, const char* t);
@@ -60,14 +316,69 @@ void  initImGui(GLFWwindow* win);
 void  cleanupImGui();
 
 bool  loadImageFromFile(ImageData& img);
+bool  decodeJpegScaled(const char* fn, ImageData& img, int scaleDenom, const std::atomic<bool>* cancel = nullptr);
+bool  decodeJpegMemory(const unsigned char* data, size_t size, ImageData& img, int scaleDenom,
+                       const std::atomic<bool>* cancel = nullptr);
+bool  decodeJpegCoarse(const char* fn, ImageData& img, bool& complete);
+bool  decodePnm(const char* fn, ImageData& img);
+bool  writePnm(const char* fn, const unsigned char* pixels, int w, int h, int C);
+bool  startImageLoad(const char* fn, ImageData& img);
+bool  beginImageLoad(const char* fn, ImageData& img);
+bool  pollImageLoad(ImageData& img);
+void  cancelImageLoad();
+void  waitImageLoad();
+bool  replaceWithTemp(const std::string& tmp, const char* dst, bool ok);
+bool  saveImageFullRes(const ImageData& img, const std::vector<Snapshot>& history, const char* fn,
+                       const JpegExportOptions& opt, std::atomic<float>* progress);
+bool  encodeJpeg(const char* fn, const unsigned char* pixels, int w, int h, int C,
+                 const JpegExportOptions& opt, std::atomic<float>* progress);
+void  startImageExport(const ImageData& img, const std::vector<Snapshot>& history, const char* fn,
+                       const JpegExportOptions& opt);
+bool  pollImageExport();
+void  waitImageExport();
+bool  processJpegStrips(const char* src, const char* dst, const std::vector<Snapshot>& history,
+                        const JpegExportOptions& opt, std::atomic<float>* progress);
+bool  encodeJpegPlanar(const char* src, const char* dst, const std::vector<Snapshot>& history,
+                       const JpegExportOptions& opt, std::atomic<float>* progress);
+bool  transformJpegLossless(const std::string& src, const char* dst, const std::vector<Snapshot>& history);
+bool  readJpegDcStats(const char* fn, DcStats& stats);
+bool  brightnessJpegDc(const std::string& src, const char* dst, int delta, const JpegExportOptions& opt);
 void  cleanupImage(ImageData& img);
+bool  openFolder(const char* dir);
+void  closeFolder();
+bool  pollFolderThumbnails();
+void  renderFilmstrip(int winW, int winH, int& clicked);
+bool  openFolderImage(int index, ImageData& img);
+int   folderNeighbour(int step);
+bool  readImageInfo(const char* fn, ImageInfo& info);
+bool  pollPrefetch();
 void  computeHistograms(ImageData& img);
 void  uploadTexture(ImageData& img);
+void  uploadTextureRect(ImageData& img, const PixelRect& r);
+PixelRect changedRect(const ImageData& img, const std::vector<unsigned char>& before);
+void  refreshImageRect(ImageData& img, const std::vector<unsigned char>& before, const PixelRect& r);
+void  refreshImage(ImageData& img, const std::vector<unsigned char>& before);
+void  previewOp(ImageData& img, const std::vector<unsigned char>& source, const std::function<void(ImageData&)>& op, int halo,
+                 const std::vector<double>& params, bool background = false);
+// parametry podglądu do porównania z poprzednią klatką
+template<class... Args> std::vector<double> previewParams(Args... a) { return { double(a)... }; }
+void  commitPreview(ImageData& img);
+void  endIdlePreview(ImageData& img);
+void  stopPreviewWorker();
+const ImageData& histogramSource(const ImageData& img);
+void  showPixels(ImageData& img, const std::vector<unsigned char>& pixels);
+void  initTextureUpload();
+void  releaseTiles(TexturePyramid& p);
+void  drawVisibleTiles(ImageData& img, float zoom, float ix0, float iy0, float ix1, float iy1);
+void  cleanupTextureUpload();
 
 void  setupProjection(int w, int h);
 void  resetViewForImage(const ImageData& img, int winW, int winH);
-void  renderImage(const ImageData& img, int winW, int winH);
+void  visibleImageArea(const ImageData& img, int winW, int winH, float& ix0, float& iy0, float& ix1, float& iy1);
+void  renderImage(ImageData& img, int winW, int winH);
 void  renderHistogram(const ImageData& img);
+void  renderDcStats(const ImageData& img);
+void  renderSelection(const ImageData& img, int x, int y, int w, int h);
 
 void  clampImage(ImageData& img, int lo, int hi);
 void  normalizeImagePerChannel(ImageData& img, int newLo, int newHi);
@@ -76,19 +387,49 @@ void  stretchHistogram(ImageData& img, float pLow, float pHigh);
 void  contrastImage(ImageData& img, float factor);
 void  thresholdManual(ImageData& img, int T);
 void  thresholdOtsu(ImageData& img);
+void  rotate90(ImageData& img);
+void  rotate180(ImageData& img);
+void  rotate270(ImageData& img);
+void  flipHorizontal(ImageData& img);
+void  flipVertical(ImageData& img);
+void  cropImage(ImageData& img, int x, int y, int w, int h);
 
 void mainLoop(GLFWwindow* window, ImageData& img);
 
 // =============================== ENTRY =====================================
-int main() {
-    if (!initGLFW()) return -1;
-    GLFWwindow* win = createWindow(1280, 720, "Photoshoot");
-    if (!win) return -1;
+int main(int argc, char** argv) {
+    jpeg_arena_limits(0, JPEG_ARENA_IDLE);
+    g_pool.start(std::max(1, int(std::thread::hardware_concurrency()) - 1));
+
+    // plik z wiersza poleceń: pierwszy podgląd dekoduje się, zanim powstanie okno, kontekst GL i ImGui
+    ImageData img;
+    bool      startupOk = false;
+    std::thread startup;
+    if (argc > 1)
+        startup = std::thread([&img, &startupOk, fn = std::string(argv[1])]() { startupOk = beginImageLoad(fn.c_str(), img); });
+
+    GLFWwindow* win = initGLFW() ? createWindow(1280, 720, "Photoshoot") : nullptr;
+    if (!win) {
+        if (startup.joinable()) startup.join();
+        waitImageLoad();
+        g_pool.shutdown();
+        return -1;
+    }
     setupGLFWCallbacks(win);
     initImGui(win);
+    initTextureUpload();
 
-    ImageData img;
-    if (!loadImageFromFile(img)) {
+    bool loaded;
+    if (startup.joinable()) {
+        startup.join();
+        if (startupOk) uploadTexture(img);
+        loaded = startupOk && img.display.width != 0;
+    }
+    else loaded = loadImageFromFile(img);
+    if (!loaded) {
+        waitImageLoad();
+        g_pool.shutdown();
+        cleanupTextureUpload();
         cleanupImGui(); glfwTerminate(); return -1;
     }
 
@@ -98,7 +439,14 @@ int main() {
 
     mainLoop(win, img);
 
+    waitImageLoad();
+    waitImageExport();
+    stopPreviewWorker();
+    closeFolder();
+    g_pool.shutdown();
+    jpeg_arena_trim();
     cleanupImage(img);
+    cleanupTextureUpload();
     cleanupImGui();
     glfwDestroyWindow(win);
     glfwTerminate();
@@ -107,138 +455,2990 @@ int main() {
 
 
 
-// ===================== GLFW + ImGui BOILERPLATE ============================
-bool initGLFW() { if (!glfwInit()) { std::cerr << "GLFW init failed\n"; return false; } return true; }
-GLFWwindow* createWindow(int w, int h, const char* t) {
-    GLFWwindow* win = glfwCreateWindow(w, h, t, nullptr, nullptr);
-    if (!win) { std::cerr << "Window create failed\n"; return nullptr; }
-    glfwMakeContextCurrent(win); return win;
+// ===================== GLFW + ImGui BOILERPLATE ============================
+bool initGLFW() { if (!glfwInit()) { std::cerr << "GLFW init failed\n"; return false; } return true; }
+GLFWwindow* createWindow(int w, int h, const char* t) {
+    GLFWwindow* win = glfwCreateWindow(w, h, t, nullptr, nullptr);
+    if (!win) { std::cerr << "Window create failed\n"; return nullptr; }
+    glfwMakeContextCurrent(win); return win;
+}
+
+void scroll_cb(GLFWwindow*, double, double y) { g_windowEvent = true; g_zoomFactor *= (y > 0 ? 1.1f : 1 / 1.1f); }
+void mouse_btn_cb(GLFWwindow* win, int btn, int act, int) { g_windowEvent = true; if (btn == GLFW_MOUSE_BUTTON_LEFT) { g_dragging = (act == GLFW_PRESS); if (g_dragging) { glfwGetCursorPos(win, &g_dragStartX, &g_dragStartY); g_panStartX = g_panX; g_panStartY = g_panY; } } }
+void cursor_cb(GLFWwindow*, double x, double y) { g_windowEvent = true; if (g_dragging) { g_panX = g_panStartX + float(x - g_dragStartX); g_panY = g_panStartY - float(y - g_dragStartY); } }
+// pozostałe zdarzenia tylko budzą rysowanie (klawiatura i fokus trafiają do ImGui, które woła te funkcje dalej)
+void key_cb(GLFWwindow*, int, int, int, int) { g_windowEvent = true; }
+void char_cb(GLFWwindow*, unsigned int) { g_windowEvent = true; }
+void focus_cb(GLFWwindow*, int) { g_windowEvent = true; }
+void refresh_cb(GLFWwindow*) { g_windowEvent = true; }
+void size_cb(GLFWwindow*, int, int) { g_windowEvent = true; }
+void setupGLFWCallbacks(GLFWwindow* w) {
+    glfwSetScrollCallback(w, scroll_cb); glfwSetMouseButtonCallback(w, mouse_btn_cb); glfwSetCursorPosCallback(w, cursor_cb);
+    glfwSetKeyCallback(w, key_cb); glfwSetCharCallback(w, char_cb); glfwSetWindowFocusCallback(w, focus_cb);
+    glfwSetCursorEnterCallback(w, focus_cb); glfwSetWindowRefreshCallback(w, refresh_cb); glfwSetFramebufferSizeCallback(w, size_cb);
+}
+
+void initImGui(GLFWwindow* w) { IMGUI_CHECKVERSION(); ImGui::CreateContext(); ImGui::StyleColorsDark(); ImGui_ImplGlfw_InitForOpenGL(w, true); ImGui_ImplOpenGL3_Init("#version 130"); }
+void cleanupImGui() { ImGui_ImplOpenGL3_Shutdown(); ImGui_ImplGlfw_Shutdown(); ImGui::DestroyContext(); }
+
+// ==================== image load =================================
+bool loadImageFromFile(ImageData& img) {
+    const char* filters[] = { "*.jpg", "*.ppm", "*.pgm" };
+    const char* fn = tinyfd_openFileDialog("Select image", "", 3, filters, "Images", 0);
+    if (!fn) { std::cerr << "No file selected\n"; return false; }
+    return startImageLoad(fn, img);
+}
+
+// --- mmap -----------------------------------------------------------------
+#ifdef _WIN32
+MappedFile::MappedFile(const char* fn) {
+    file = CreateFileA(fn, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return;
+    LARGE_INTEGER sz;
+    if (!GetFileSizeEx(file, &sz) || sz.QuadPart == 0) return;
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) return;
+    data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (data) size = size_t(sz.QuadPart);
+}
+
+MappedFile::~MappedFile() {
+    if (data) UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+}
+#else
+MappedFile::MappedFile(const char* fn) {
+    fd = open(fn, O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) return;
+    void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) return;
+    madvise(p, size_t(st.st_size), MADV_SEQUENTIAL);
+    data = static_cast<const unsigned char*>(p);
+    size = size_t(st.st_size);
+}
+
+MappedFile::~MappedFile() {
+    if (data) munmap(const_cast<unsigned char*>(data), size);
+    if (fd >= 0) close(fd);
+}
+#endif
+
+// --- libjpeg: obsługa błędów przez setjmp (jak w example.c) ---
+struct JpegErrorMgr {
+    jpeg_error_mgr pub;
+    jmp_buf        setjmpBuffer;
+};
+
+static void jpegErrorExit(j_common_ptr cinfo) {
+    JpegErrorMgr* err = reinterpret_cast<JpegErrorMgr*>(cinfo->err);
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(err->setjmpBuffer, 1);
+}
+
+// kopia płaszczyzny Y przy zwykłym dekodowaniu do RGB (bez raw_data_out): upsampling i konwersja barw
+// nadal idą w libjpeg, a Y trafia pod row dla kolejnych konwertowanych wierszy (row = nullptr - pomijane)
+struct LumaCapture {
+    void (*convert)(j_decompress_ptr, JSAMPIMAGE, JDIMENSION, JSAMPARRAY, int) = nullptr;
+    unsigned char* row = nullptr;
+};
+
+static void lumaCaptureConvert(j_decompress_ptr cinfo, JSAMPIMAGE input, JDIMENSION inputRow, JSAMPARRAY output, int rows) {
+    LumaCapture* cap = static_cast<LumaCapture*>(cinfo->client_data);
+    cap->convert(cinfo, input, inputRow, output, rows);
+    for (int r = 0; r < rows && cap->row; ++r, cap->row += cinfo->output_width)
+        memcpy(cap->row, input[0][inputRow + r], cinfo->output_width);
+}
+
+// po jpeg_start_decompress: podmienia konwersję barw na wersję z przechwytywaniem Y; false dla plików bez YCbCr
+static bool attachLumaCapture(j_decompress_ptr cinfo, LumaCapture& cap) {
+    if (cinfo->num_components != 3 || cinfo->out_color_space != JCS_RGB || cinfo->quantize_colors ||
+        (cinfo->jpeg_color_space != JCS_YCbCr && cinfo->jpeg_color_space != JCS_BG_YCC))
+        return false;
+    cap.convert = cinfo->cconvert->color_convert;
+    cinfo->client_data = &cap;
+    cinfo->cconvert->color_convert = lumaCaptureConvert;
+    return true;
+}
+
+// wybiera największy mianownik skali DCT (8, 4, 2), przy którym dłuższy bok nie spada poniżej PROXY_MIN_SIDE
+static int chooseProxyScale(int w, int h) {
+    int longSide = std::max(w, h);
+    for (int d = 8; d > 1; d /= 2)
+        if (longSide / d >= PROXY_MIN_SIDE) return d;
+    return 1;
+}
+
+// dekoduje JPEG przez libjpeg w skali 1/scaleDenom (skalowane IDCT); scaleDenom = 0 dobiera skalę podglądu.
+// cancel - ustawione w trakcie przerywa dekodowanie (false)
+bool decodeJpegScaled(const char* fn, ImageData& img, int scaleDenom, const std::atomic<bool>* cancel) {
+    MappedFile file(fn);
+    return file.valid() && decodeJpegMemory(file.data, file.size, img, scaleDenom, cancel);
+}
+
+// co tyle wierszy dekoder sprawdza, czy wczytywanie nie zostało przerwane
+const int DECODE_CANCEL_ROWS = 16;
+
+static bool decodeCancelled(const std::atomic<bool>* cancel) {
+    return cancel && cancel->load(std::memory_order_relaxed);
+}
+
+// --- równoległe dekodowanie przez interwały restartu ---------------------
+
+// układ jedynego skanu pliku sekwencyjnego: dane entropii pocięte markerami RSTn
+struct JpegScanLayout {
+    size_t                                  sofHeightPos = 0;   // offset pola wysokości w SOF
+    size_t                                  headerEnd = 0;      // koniec nagłówka SOS = początek danych skanu
+    std::vector<std::pair<size_t, size_t>>  segments;           // [początek, koniec) danych każdego interwału
+    int                                     restartInterval = 0;
+    int                                     mcusPerRow = 0, mcuRows = 0, mcuHeight = 0;
+};
+
+static unsigned jpegU16(const unsigned char* p) { return unsigned(p[0]) << 8 | p[1]; }
+
+// przegląda markery i dane skanu; false, jeśli plik nie nadaje się do cięcia (progresja, wiele skanów, brak DRI)
+static bool scanJpegRestarts(const unsigned char* d, size_t n, JpegScanLayout& L) {
+    if (n < 4 || d[0] != 0xFF || d[1] != 0xD8) return false;
+    int width = 0, height = 0, ncomp = 0, maxH = 1, maxV = 1;
+    size_t pos = 2;
+    for (;;) {
+        while (pos < n && d[pos] == 0xFF && pos + 1 < n && d[pos + 1] == 0xFF) ++pos;     // bajty wypełnienia
+        if (pos + 4 > n || d[pos] != 0xFF) return false;
+        unsigned m = d[pos + 1];
+        size_t len = jpegU16(d + pos + 2);
+        if (pos + 2 + len > n) return false;
+        if (m == 0xC0 || m == 0xC1 || m == 0xC9) {
+            if (len < 8) return false;
+            L.sofHeightPos = pos + 5;
+            height = int(jpegU16(d + pos + 5));
+            width = int(jpegU16(d + pos + 7));
+            ncomp = d[pos + 9];
+            if (len < 8 + size_t(ncomp) * 3) return false;
+            for (int c = 0; c < ncomp; ++c) {
+                int hv = d[pos + 10 + c * 3 + 1];
+                maxH = std::max(maxH, hv >> 4);
+                maxV = std::max(maxV, hv & 15);
+            }
+        }
+        else if ((m >= 0xC2 && m <= 0xCF && m != 0xC4 && m != 0xC8 && m != 0xCC) || m == 0xD9) {
+            return false;       // progresja/bezstratny/hierarchiczny albo brak skanu
+        }
+        else if (m == 0xDD) {
+            L.restartInterval = int(jpegU16(d + pos + 4));
+        }
+        else if (m == 0xDA) {
+            if (d[pos + 4] != ncomp) return false;          // skan nieprzeplatany - pliki wieloskanowe sekwencyjnie
+            L.headerEnd = pos + 2 + len;
+            break;
+        }
+        pos += 2 + len;
+    }
+    if (L.restartInterval <= 0 || width <= 0 || height <= 0 || (ncomp == 1 && (maxH != 1 || maxV != 1))) return false;
+
+    // dane skanu: FF00 to bajt danych, FFD0..FFD7 kończy interwał, inny marker kończy skan
+    size_t start = L.headerEnd, p = start;
+    for (;;) {
+        const void* ff = memchr(d + p, 0xFF, n - p);
+        if (!ff) return false;
+        p = size_t(static_cast<const unsigned char*>(ff) - d);
+        if (p + 1 >= n) return false;
+        unsigned m = d[p + 1];
+        if (m == 0x00 || m == 0xFF) { p += 1 + (m == 0x00); continue; }
+        L.segments.push_back({ start, p });
+        if (m >= 0xD0 && m <= 0xD7) { p += 2; start = p; continue; }
+        if (m != 0xD9) return false;                       // po skanie musi być EOI
+        break;
+    }
+
+    L.mcuHeight = maxV * 8;
+    L.mcusPerRow = (width + maxH * 8 - 1) / (maxH * 8);
+    L.mcuRows = (height + L.mcuHeight - 1) / L.mcuHeight;
+    long long total = (long long)L.mcusPerRow * L.mcuRows;
+    return (long long)L.segments.size() == (total + L.restartInterval - 1) / L.restartInterval;
+}
+
+// dekoduje samodzielny JPEG pasa, pomija skipRows wierszy zakładki i zapisuje keepRows wierszy do dst
+static bool decodeJpegBand(const std::vector<unsigned char>& jpeg, int scaleDenom, J_COLOR_SPACE cs,
+                           unsigned char* dst, size_t stride, unsigned char* lumaDst, int skipRows, int keepRows,
+                           const std::atomic<bool>* cancel) {
+    jpeg_decompress_struct cinfo;
+    JpegErrorMgr jerr;
+    LumaCapture cap;
+    std::vector<unsigned char> scratch(stride);
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpegErrorExit;
+    if (setjmp(jerr.setjmpBuffer)) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<unsigned char*>(jpeg.data()), (unsigned long)jpeg.size());
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = scaleDenom;
+    cinfo.out_color_space = cs;
+    jpeg_start_decompress(&cinfo);
+    bool withLuma = lumaDst && attachLumaCapture(&cinfo, cap);
+    int end = skipRows + keepRows;
+    while (int(cinfo.output_scanline) < end) {
+        int y = int(cinfo.output_scanline);
+        if (y % DECODE_CANCEL_ROWS == 0 && decodeCancelled(cancel)) {
+            jpeg_destroy_decompress(&cinfo);
+            return false;
+        }
+        JSAMPROW row = (y < skipRows ? scratch.data() : dst + size_t(y - skipRows) * stride);
+        if (withLuma) cap.row = (y < skipRows ? nullptr : lumaDst + size_t(y - skipRows) * cinfo.output_width);
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_destroy_decompress(&cinfo);    // dolna zakładka nie jest potrzebna
+    return true;
+}
+
+// tnie skan na pasy wierszy MCU zaczynające się na granicach interwałów restartu; każdy pas to osobny JPEG
+// (nagłówek z poprawioną wysokością + jego interwały z przenumerowanymi RSTn) dekodowany przez pulę do swojego
+// fragmentu img.pixels. Pas zachodzi o wiersz MCU na sąsiadów, więc wygładzane podpróbkowanie chrominancji daje
+// te same piksele co dekoder sekwencyjny. hdr: po jpeg_read_header, z ustawioną skalą i przestrzenią barw.
+static bool decodeJpegRestartParallel(const unsigned char* data, size_t size, j_decompress_ptr hdr, ImageData& img,
+                                      const std::atomic<bool>* cancel) {
+    int threads = int(g_pool.workers.size()) + 1;
+    if (threads < 2 || (long long)hdr->image_width * hdr->image_height < PARALLEL_DECODE_MIN_PIXELS) return false;
+    JpegScanLayout L;
+    if (!scanJpegRestarts(data, size, L)) return false;
+
+    jpeg_calc_output_dimensions(hdr);
+    int outW = int(hdr->output_width), outH = int(hdr->output_height), C = hdr->output_components;
+    int rowsPerMcuRow = hdr->max_v_samp_factor * hdr->min_DCT_v_scaled_size;
+    size_t stride = size_t(outW) * C;
+
+    // wiersze MCU, od których zaczyna się interwał restartu
+    std::vector<int> aligned;
+    for (int r = 0; r <= L.mcuRows; ++r)
+        if (r == L.mcuRows || (long long)r * L.mcusPerRow % L.restartInterval == 0) aligned.push_back(r);
+    auto segOf = [&](int r) {
+        return r == L.mcuRows ? L.segments.size() : size_t((long long)r * L.mcusPerRow / L.restartInterval);
+    };
+
+    // granice pasów: mniej więcej równe części, przesunięte do najbliższego wyrównanego wiersza
+    int nBands = std::min(threads * 2, int(aligned.size()) - 1);
+    std::vector<int> bounds = { 0 };
+    for (int k = 1; k < nBands; ++k) {
+        int r = *std::lower_bound(aligned.begin(), aligned.end(), int((long long)k * L.mcuRows / nBands));
+        if (r > bounds.back() && r < L.mcuRows) bounds.push_back(r);
+    }
+    bounds.push_back(L.mcuRows);
+    nBands = int(bounds.size()) - 1;
+    if (nBands < 2) return false;
+
+    img.pixels.resize(stride * outH);
+    img.luma.resize(C == 3 ? size_t(outW) * outH : 0);
+    J_COLOR_SPACE cs = hdr->out_color_space;
+    int scaleDenom = int(hdr->scale_denom);
+
+    std::atomic<bool> failed{ false };
+    g_pool.parallelFor(nBands, [&](int k) {
+        int r0 = bounds[k], r1 = bounds[k + 1];
+        // zakładka: poprzedni i następny wyrównany wiersz poza pasem
+        int a = (r0 == 0 ? 0 : *(std::upper_bound(aligned.begin(), aligned.end(), r0 - 1) - 1));
+        int z = (r1 == L.mcuRows ? r1 : *std::lower_bound(aligned.begin(), aligned.end(), r1 + 1));
+
+        std::vector<unsigned char> band(data, data + L.headerEnd);
+        int bandH = std::min(int(hdr->image_height), z * L.mcuHeight) - a * L.mcuHeight;
+        band[L.sofHeightPos] = (unsigned char)(bandH >> 8);
+        band[L.sofHeightPos + 1] = (unsigned char)(bandH & 255);
+        size_t s0 = segOf(a), s1 = segOf(z);
+        for (size_t s = s0; s < s1; ++s) {
+            band.insert(band.end(), data + L.segments[s].first, data + L.segments[s].second);
+            band.push_back(0xFF);
+            band.push_back((unsigned char)(s + 1 < s1 ? 0xD0 + (s - s0) % 8 : 0xD9));
+        }
+
+        int y0 = r0 * rowsPerMcuRow, y1 = std::min(outH, r1 * rowsPerMcuRow);
+        unsigned char* lumaDst = (img.luma.empty() ? nullptr : img.luma.data() + size_t(y0) * outW);
+        if (!decodeJpegBand(band, scaleDenom, cs, img.pixels.data() + size_t(y0) * stride, stride, lumaDst,
+                            (r0 - a) * rowsPerMcuRow, y1 - y0, cancel))
+            failed = true;
+    });
+
+    if (failed) { img.pixels.clear(); img.luma.clear(); return false; }
+    return true;
+}
+
+// dekoduje JPEG z bufora w pamięci (mapowanie pliku albo wpis pamięci podręcznej miniatur)
+bool decodeJpegMemory(const unsigned char* data, size_t size, ImageData& img, int scaleDenom, const std::atomic<bool>* cancel) {
+    jpeg_decompress_struct cinfo;
+    JpegErrorMgr jerr;
+    LumaCapture cap;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpegErrorExit;
+    if (setjmp(jerr.setjmpBuffer)) {
+        jpeg_destroy_decompress(&cinfo);
+        img.pixels.clear();
+        img.luma.clear();
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<unsigned char*>(data), (unsigned long)size);
+    jpeg_read_header(&cinfo, TRUE);
+    if (cinfo.num_components != 1 && cinfo.num_components != 3) {
+        // CMYK/YCCK zostawiamy dla stb_image
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    int fullW = int(cinfo.image_width), fullH = int(cinfo.image_height);
+    int mcuW = cinfo.max_h_samp_factor * cinfo.block_size, mcuH = cinfo.max_v_samp_factor * cinfo.block_size;
+    if (scaleDenom <= 0) scaleDenom = chooseProxyScale(fullW, fullH);
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = scaleDenom;
+    cinfo.out_color_space = (cinfo.num_components == 1 ? JCS_GRAYSCALE : JCS_RGB);
+
+    int w, h, C;
+    if (decodeJpegRestartParallel(data, size, &cinfo, img, cancel)) {
+        w = int(cinfo.output_width); h = int(cinfo.output_height); C = cinfo.output_components;
+        jpeg_destroy_decompress(&cinfo);
+    }
+    else if (decodeCancelled(cancel)) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    else {
+        jpeg_start_decompress(&cinfo);
+        w = int(cinfo.output_width); h = int(cinfo.output_height); C = cinfo.output_components;
+        size_t stride = size_t(w) * C;
+        img.pixels.resize(stride * h);
+        img.luma.resize(attachLumaCapture(&cinfo, cap) ? size_t(w) * h : 0);
+        while (cinfo.output_scanline < cinfo.output_height) {
+            if (cinfo.output_scanline % DECODE_CANCEL_ROWS == 0 && decodeCancelled(cancel)) {
+                jpeg_destroy_decompress(&cinfo);
+                img.pixels.clear();
+                img.luma.clear();
+                return false;
+            }
+            JSAMPROW row = img.pixels.data() + stride * cinfo.output_scanline;
+            if (!img.luma.empty()) cap.row = img.luma.data() + size_t(w) * cinfo.output_scanline;
+            jpeg_read_scanlines(&cinfo, &row, 1);
+        }
+        jpeg_finish_decompress(&cinfo);
+        jpeg_destroy_decompress(&cinfo);
+    }
+
+    img.width = w; img.height = h; img.channels = C;
+    img.scaleDenom = scaleDenom;
+    img.fullWidth = fullW; img.fullHeight = fullH;
+    img.mcuWidth = mcuW; img.mcuHeight = mcuH;
+    return true;
+}
+
+// --- surowy PNM (P5/P6, 8 bit) --------------------------------------------
+
+static bool isPnmPath(const char* fn) {
+    std::string ext = fn;
+    size_t dot = ext.find_last_of('.');
+    if (dot == std::string::npos) return false;
+    ext = ext.substr(dot + 1);
+    for (char& c : ext) c = char(tolower((unsigned char)c));
+    return ext == "ppm" || ext == "pgm" || ext == "pnm";
+}
+
+// czyta kolejną liczbę nagłówka PNM, pomijając białe znaki i komentarze '#'
+static bool readPnmNumber(const unsigned char* p, size_t n, size_t& pos, int& out) {
+    while (pos < n) {
+        if (p[pos] == '#') { while (pos < n && p[pos] != '\n') ++pos; }
+        else if (isspace(p[pos])) ++pos;
+        else break;
+    }
+    if (pos >= n || !isdigit(p[pos])) return false;
+    long long v = 0;
+    while (pos < n && isdigit(p[pos]) && v <= INT_MAX) v = v * 10 + (p[pos++] - '0');
+    if (v > INT_MAX) return false;
+    out = int(v);
+    return true;
+}
+
+// nagłówek P5/P6 z maxval 255; pos wskazuje pierwszy bajt pikseli
+static bool parsePnmHeader(const MappedFile& file, int& w, int& h, int& C, size_t& pos) {
+    if (!file.valid() || file.size < 2 || file.data[0] != 'P' || (file.data[1] != '5' && file.data[1] != '6'))
+        return false;
+
+    C = (file.data[1] == '6' ? 3 : 1);
+    int maxval;
+    pos = 2;
+    if (!readPnmNumber(file.data, file.size, pos, w) || !readPnmNumber(file.data, file.size, pos, h) ||
+        !readPnmNumber(file.data, file.size, pos, maxval) || w <= 0 || h <= 0 || maxval != 255)
+        return false;
+    ++pos;      // dokładnie jeden biały znak przed danymi
+    return true;
+}
+
+// wczytuje binarny PGM/PPM: po nagłówku piksele kopiowane jednym ciągiem z mapowania pliku
+bool decodePnm(const char* fn, ImageData& img) {
+    MappedFile file(fn);
+    int w, h, C;
+    size_t pos;
+    if (!parsePnmHeader(file, w, h, C, pos)) return false;
+
+    size_t bytes = size_t(w) * h * C;
+    if (pos > file.size || file.size - pos < bytes) { std::cerr << "Truncated PNM: " << fn << "\n"; return false; }
+    img.pixels.assign(file.data + pos, file.data + pos + bytes);
+    img.luma.clear();
+    img.width = w; img.height = h; img.channels = C;
+    img.scaleDenom = 1; img.fullWidth = w; img.fullHeight = h;
+    img.mcuWidth = img.mcuHeight = 1;
+    return true;
+}
+
+// zapisuje P6 (RGB) lub P5 (gray); kanał alfa jest pomijany
+bool writePnm(const char* fn, const unsigned char* pixels, int w, int h, int C) {
+    FILE* f = fopen(fn, "wb");
+    if (!f) return false;
+    int outC = (C < 3 ? 1 : 3);
+    bool ok = fprintf(f, "P%c\n%d %d\n255\n", outC == 3 ? '6' : '5', w, h) > 0;
+    if (C == outC) {
+        size_t bytes = size_t(w) * h * C;
+        ok = ok && fwrite(pixels, 1, bytes, f) == bytes;
+    }
+    else {
+        std::vector<unsigned char> row(size_t(w) * outC);
+        for (int y = 0; y < h && ok; ++y) {
+            const unsigned char* src = pixels + size_t(y) * w * C;
+            for (int x = 0; x < w; ++x)
+                for (int c = 0; c < outC; ++c)
+                    row[size_t(x) * outC + c] = src[size_t(x) * C + c];
+            ok = fwrite(row.data(), 1, row.size(), f) == row.size();
+        }
+    }
+    fclose(f);
+    return ok;
+}
+
+// zapisuje do pliku tymczasowego obok docelowego i dopiero po udanym zapisie podmienia docelowy -
+// zapis na miejsce źródła nie obcina pliku, który jest jeszcze zmapowany (SIGBUS / błąd fopen w Windows)
+bool replaceWithTemp(const std::string& tmp, const char* dst, bool ok) {
+    std::error_code ec;
+    if (ok) std::filesystem::rename(tmp, dst, ec);
+    if (ok && !ec) return true;
+    if (ok) std::cerr << "Cannot replace " << dst << ": " << ec.message() << "\n";
+    std::filesystem::remove(tmp, ec);
+    return false;
+}
+
+static bool writeImageFullRes(const ImageData& img, const std::vector<Snapshot>& history, const char* fn, bool pnm,
+                              const JpegExportOptions& opt, std::atomic<float>* progress);
+
+// zapisuje obraz w pełnej rozdzielczości: dekoduje oryginał i odtwarza na nim historię edycji
+bool saveImageFullRes(const ImageData& img, const std::vector<Snapshot>& history, const char* fn,
+                      const JpegExportOptions& opt, std::atomic<float>* progress) {
+    std::string tmp = std::string(fn) + TEMP_SUFFIX;
+    return replaceWithTemp(tmp, fn, writeImageFullRes(img, history, tmp.c_str(), isPnmPath(fn), opt, progress));
+}
+
+// fn to plik tymczasowy; pliki źródłowe są już zamknięte, gdy saveImageFullRes podmienia docelowy
+static bool writeImageFullRes(const ImageData& img, const std::vector<Snapshot>& history, const char* fn, bool pnm,
+                              const JpegExportOptions& opt, std::atomic<float>* progress) {
+
+    // w historii same obroty/odbicia/kadry - zapis bezstratny na współczynnikach DCT
+    bool geometryOnly = !pnm && history.size() > 1;
+    for (size_t i = 1; i < history.size(); ++i)
+        if (history[i].geom.kind == GeomOp::None) geometryOnly = false;
+    if (geometryOnly && transformJpegLossless(img.path, fn, history)) return true;
+
+    // same zmiany jasności - przesunięcie DC luminancji na współczynnikach, bez dekodowania i kodowania pikseli
+    bool brightnessOnly = !pnm && history.size() > 1;
+    int delta = 0;
+    for (size_t i = 1; i < history.size(); ++i) {
+        if (history[i].brightness == 0) brightnessOnly = false;
+        delta += history[i].brightness;
+    }
+    if (brightnessOnly && brightnessJpegDc(img.path, fn, delta, opt)) return true;
+
+    if (img.scaleDenom == 1)
+        return pnm ? writePnm(fn, img.pixels.data(), img.width, img.height, img.channels)
+                   : encodeJpeg(fn, img.pixels.data(), img.width, img.height, img.channels, opt, progress);
+
+    // bez edycji albo same progowania - surowe płaszczyzny YCbCr, bez konwersji barw i podpróbkowania
+    if (!pnm && encodeJpegPlanar(img.path.c_str(), fn, history, opt, progress)) return true;
+
+    // same operacje lokalne - pasami w stałej pamięci, bez dekodowania całego obrazu
+    if (!pnm && processJpegStrips(img.path.c_str(), fn, history, opt, progress)) return true;
+
+    ImageData full;
+    if (!decodeJpegScaled(img.path.c_str(), full, 1)) { std::cerr << "Full-resolution decode failed\n"; return false; }
+    if (history.empty() || history[0].luma.empty()) full.luma.clear();     // jak na ekranie: pierwsza operacja bez Y
+    for (size_t i = 1; i < history.size(); ++i)
+        if (history[i].op) { history[i].op(full); full.luma.clear(); }
+    if (pnm) return writePnm(fn, full.pixels.data(), full.width, full.height, full.channels);
+    return encodeJpeg(fn, full.pixels.data(), full.width, full.height, full.channels, opt, progress);
+}
+
+// postęp kodera: ukończone przebiegi + ułamek bieżącego
+struct JpegProgress {
+    jpeg_progress_mgr    pub;
+    std::atomic<float>*  out;
+};
+
+static void jpegProgressMonitor(j_common_ptr cinfo) {
+    JpegProgress* p = reinterpret_cast<JpegProgress*>(cinfo->progress);
+    if (!p->out || p->pub.total_passes <= 0) return;
+    float pass = (p->pub.pass_limit > 0 ? float(p->pub.pass_counter) / float(p->pub.pass_limit) : 0.0f);
+    p->out->store((p->pub.completed_passes + pass) / float(p->pub.total_passes), std::memory_order_relaxed);
+}
+
+// ustawia wymiary, przestrzeń barw i opcje eksportu (jakość, Huffman, progresja, podpróbkowanie)
+static void setJpegCompressParams(jpeg_compress_struct& cinfo, int w, int h, int outC, const JpegExportOptions& opt) {
+    cinfo.image_width = w;
+    cinfo.image_height = h;
+    cinfo.input_components = outC;
+    cinfo.in_color_space = (outC == 1 ? JCS_GRAYSCALE : JCS_RGB);
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, opt.quality, TRUE);
+    cinfo.optimize_coding = opt.optimize ? TRUE : FALSE;
+    if (outC == 3) {
+        cinfo.comp_info[0].h_samp_factor = (opt.subsampling == 444 ? 1 : 2);
+        cinfo.comp_info[0].v_samp_factor = (opt.subsampling == 420 ? 2 : 1);
+    }
+    if (opt.progressive) jpeg_simple_progression(&cinfo);
+}
+
+// podaje koderowi wszystkie wiersze bufora; kanał alfa odrzucany przez rowBuf
+static void writeJpegScanlines(jpeg_compress_struct& cinfo, const unsigned char* pixels, int w, int C,
+                               std::vector<unsigned char>& rowBuf) {
+    int outC = cinfo.input_components;
+    if (C != outC) rowBuf.resize(size_t(w) * outC);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        const unsigned char* src = pixels + size_t(cinfo.next_scanline) * w * C;
+        JSAMPROW row = const_cast<JSAMPROW>(src);
+        if (C != outC) {
+            for (int x = 0; x < w; ++x)
+                for (int c = 0; c < outC; ++c)
+                    rowBuf[size_t(x) * outC + c] = src[size_t(x) * C + c];
+            row = rowBuf.data();
+        }
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+}
+
+// koduje pas wierszy do pamięci: standardowe tablice Huffmana i restart co wiersz MCU, żeby pasy dało się skleić
+static bool encodeJpegStrip(const unsigned char* pixels, int w, int rows, int C, const JpegExportOptions& opt,
+                            std::vector<unsigned char>& out) {
+    jpeg_compress_struct cinfo = {};
+    JpegErrorMgr jerr;
+    unsigned char* buf = nullptr;
+    unsigned long  size = 0;
+    std::vector<unsigned char> rowBuf;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpegErrorExit;
+    if (setjmp(jerr.setjmpBuffer)) {
+        jpeg_destroy_compress(&cinfo);
+        free(buf);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buf, &size);
+    JpegExportOptions stripOpt = opt;
+    stripOpt.optimize = false;
+    stripOpt.progressive = false;
+    setJpegCompressParams(cinfo, w, rows, C < 3 ? 1 : 3, stripOpt);
+    cinfo.restart_in_rows = 1;
+    jpeg_start_compress(&cinfo, TRUE);
+    writeJpegScanlines(cinfo, pixels, w, C, rowBuf);
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    out.assign(buf, buf + size);
+    free(buf);
+    return true;
+}
+
+// przekodowuje sklejony plik na współczynnikach DCT (bez utraty): optymalne tablice Huffmana i/lub progresja
+static bool recompressJpegCoefficients(const std::vector<unsigned char>& in, FILE* f, const JpegExportOptions& opt) {
+    jpeg_decompress_struct srcinfo = {};
+    jpeg_compress_struct   dstinfo = {};
+    JpegErrorMgr jerr;
+    srcinfo.err = jpeg_std_error(&jerr.pub);
+    dstinfo.err = &jerr.pub;
+    jerr.pub.error_exit = jpegErrorExit;
+    if (setjmp(jerr.setjmpBuffer)) {
+        jpeg_destroy_compress(&dstinfo);
+        jpeg_destroy_decompress(&srcinfo);
+        return false;
+    }
+    jpeg_create_decompress(&srcinfo);
+    jpeg_create_compress(&dstinfo);
+
+    jpeg_mem_src(&srcinfo, const_cast<unsigned char*>(in.data()), (unsigned long)in.size());
+    jpeg_read_header(&srcinfo, TRUE);
+    jvirt_barray_ptr* coef = jpeg_read_coefficients(&srcinfo);
+    jpeg_copy_critical_parameters(&srcinfo, &dstinfo);
+    dstinfo.optimize_coding = opt.optimize ? TRUE : FALSE;
+    if (opt.progressive) jpeg_simple_progression(&dstinfo);
+    else dstinfo.restart_interval = srcinfo.restart_interval;     // markery zostają dla równoległego dekodowania
+
+    jpeg_stdio_dest(&dstinfo, f);
+    jpeg_write_coefficients(&dstinfo, coef);
+    jpeg_finish_compress(&dstinfo);
+    jpeg_destroy_compress(&dstinfo);
+    jpeg_finish_decompress(&srcinfo);
+    jpeg_destroy_decompress(&srcinfo);
+    return true;
+}
+
+// koduje duży obraz pasami na puli. Pasy mają wysokość z całych wierszy MCU, te same tablice i restart co wiersz
+// MCU, więc ich interwały skleja się w jeden skan zgodny ze standardem: nagłówek pierwszego pasa z pełną
+// wysokością, RSTn przenumerowane, RSTn także między pasami. Optymalizacja Huffmana i progresja to potem
+// bezstratne przekodowanie na współczynnikach. false -> wołający koduje sekwencyjnie.
+static bool encodeJpegParallel(const char* fn, const unsigned char* pixels, int w, int h, int C,
+                               const JpegExportOptions& opt, std::atomic<float>* progress) {
+    int threads = int(g_pool.workers.size()) + 1;
+    if (threads < 2 || (long long)w * h < PARALLEL_ENCODE_MIN_PIXELS) return false;
+    if (w > JPEG_MAX_DIMENSION || h > JPEG_MAX_DIMENSION) return false;    // SOF nie zmieści rozmiaru; koder sekwencyjny zgłosi błąd
+    int mcuHeight = (C >= 3 && opt.subsampling == 420 ? 16 : 8);
+    int mcuRows = (h + mcuHeight - 1) / mcuHeight;
+    int nStrips = std::min(threads * 2, mcuRows);
+    if (nStrips < 2) return false;
+
+    std::vector<std::vector<unsigned char>> strips(nStrips);
+    std::vector<JpegScanLayout> layouts(nStrips);
+    std::atomic<int> done{ 0 };
+    std::atomic<bool> failed{ false };
+    float encodeShare = (opt.optimize || opt.progressive ? 0.6f : 1.0f);
+    g_pool.parallelFor(nStrips, [&](int k) {
+        int y0 = int((long long)k * mcuRows / nStrips) * mcuHeight;
+        int y1 = std::min(h, int((long long)(k + 1) * mcuRows / nStrips) * mcuHeight);
+        if (!encodeJpegStrip(pixels + size_t(y0) * w * C, w, y1 - y0, C, opt, strips[k]) ||
+            !scanJpegRestarts(strips[k].data(), strips[k].size(), layouts[k]))
+            failed = true;
+        if (progress) progress->store(encodeShare * float(++done) / float(nStrips), std::memory_order_relaxed);
+    });
+    if (failed) return false;
+
+    size_t total = 2;
+    for (const std::vector<unsigned char>& st : strips) total += st.size();
+    std::vector<unsigned char> out;
+    out.reserve(total);
+    out.assign(strips[0].begin(), strips[0].begin() + layouts[0].headerEnd);
+    out[layouts[0].sofHeightPos] = (unsigned char)(h >> 8);
+    out[layouts[0].sofHeightPos + 1] = (unsigned char)(h & 255);
+    unsigned interval = 0;
+    for (int k = 0; k < nStrips; ++k)
+        for (const std::pair<size_t, size_t>& seg : layouts[k].segments) {
+            if (interval > 0) {
+                out.push_back(0xFF);
+                out.push_back((unsigned char)(0xD0 + (interval - 1) % 8));
+            }
+            out.insert(out.end(), strips[k].begin() + seg.first, strips[k].begin() + seg.second);
+            ++interval;
+        }
+    out.push_back(0xFF);
+    out.push_back(0xD9);
+    strips.clear();
+
+    FILE* f = fopen(fn, "wb");
+    if (!f) return false;
+    bool ok = (opt.optimize || opt.progressive) ? recompressJpegCoefficients(out, f, opt)
+                                                 : fwrite(out.data(), 1, out.size(), f) == out.size();
+    fclose(f);
+    if (ok && progress) progress->store(1.0f);
+    return ok;
+}
+
+// koduje bufor RGB/gray koderem libjpeg z podanymi ustawieniami (jakość, Huffman, progresja, podpróbkowanie)
+bool encodeJpeg(const char* fn, const unsigned char* pixels, int w, int h, int C,
+                const JpegExportOptions& opt, std::atomic<float>* progress) {
+    if (encodeJpegParallel(fn, pixels, w, h, C, opt, progress)) return true;
+
+    FILE* f = fopen(fn, "wb");
+    if (!f) return false;
+
+    jpeg_compress_struct cinfo = {};
+    JpegErrorMgr jerr;
+    JpegProgress prog;
+    std::vector<unsigned char> rowBuf;      // tylko gdy trzeba odrzucić kanał alfa
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpegErrorExit;
+    if (setjmp(jerr.setjmpBuffer)) {
+        jpeg_destroy_compress(&cinfo);
+        fclose(f);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, f);
+    int outC = (C < 3 ? 1 : 3);
+    setJpegCompressParams(cinfo, w, h, outC, opt);
+
+    prog.pub.progress_monitor = jpegProgressMonitor;
+    prog.out = progress;
+    cinfo.progress = &prog.pub;
+
+    jpeg_start_compress(&cinfo, TRUE);
+    writeJpegScanlines(cinfo, pixels, w, C, rowBuf);
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    fclose(f);
+    if (progress) progress->store(1.0f);
+    return true;
+}
+
+// przetwarza JPEG pasami wierszy: jpeg_read_scanlines -> operacje z historii na pasie z zakładką halo -> jpeg_write_scanlines;
+// w pamięci jest tylko okno wierszy (pełne bufory współczynników trzyma libjpeg jedynie dla plików progresywnych/optymalizowanych)
+bool processJpegStrips(const char* src, const char* dst, const std::vector<Snapshot>& history,
+                       const JpegExportOptions& opt, std::atomic<float>* progress) {
+    int halo = 0;
+    for (size_t i = 1; i < history.size(); ++i) {
+        if (history[i].halo < 0) return false;      // operacja potrzebuje całego obrazu
+        halo += history[i].halo;
+    }
+
+    MappedFile file(src);
+    if (!file.valid()) return false;
+    FILE* f = fopen(dst, "wb");
+    if (!f) return false;
+
+    jpeg_decompress_struct dinfo = {};
+    jpeg_compress_struct cinfo = {};
+    JpegErrorMgr jerr;
+    std::vector<unsigned char> window;      // wiersze [winFirst .. winFirst + winRows) źródła
+    std::vector<unsigned char> lumaWindow;  // ich Y z dekodera (pliki YCbCr)
+    LumaCapture cap;
+    ImageData strip;
+    dinfo.err = cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpegErrorExit;
+    if (setjmp(jerr.setjmpBuffer)) {
+        jpeg_destroy_compress(&cinfo);
+        jpeg_destroy_decompress(&dinfo);
+        fclose(f);
+        return false;
+    }
+
+    jpeg_create_decompress(&dinfo);
+    jpeg_mem_src(&dinfo, const_cast<unsigned char*>(file.data), (unsigned long)file.size);
+    jpeg_read_header(&dinfo, TRUE);
+    if (dinfo.num_components != 1 && dinfo.num_components != 3) {
+        jpeg_destroy_decompress(&dinfo);
+        fclose(f);
+        return false;
+    }
+    dinfo.out_color_space = (dinfo.num_components == 1 ? JCS_GRAYSCALE : JCS_RGB);
+    jpeg_start_decompress(&dinfo);
+    // Y dekodera tylko wtedy, gdy pierwsza operacja czytała go też na ekranie
+    bool withLuma = !history.empty() && !history[0].luma.empty() && attachLumaCapture(&dinfo, cap);
+
+    int W = dinfo.output_width, H = dinfo.output_height, C = dinfo.output_components;
+    size_t stride = size_t(W) * C;
+    int stripRows = int(std::min<size_t>(std::max({ STRIP_BUDGET / stride, size_t(16), size_t(4) * halo }), size_t(H)));
+
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, f);
+    setJpegCompressParams(cinfo, W, H, C, opt);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    int winFirst = 0, winRows = 0;
+    for (int y0 = 0; y0 < H; y0 += stripRows) {
+        int y1 = std::min(H, y0 + stripRows);
+        int lo = std::max(0, y0 - halo), hi = std::min(H, y1 + halo);
+
+        // zakładka z poprzedniego pasa zostaje, reszta okna jest dekodowana
+        window.erase(window.begin(), window.begin() + size_t(lo - winFirst) * stride);
+        if (withLuma) lumaWindow.erase(lumaWindow.begin(), lumaWindow.begin() + size_t(lo - winFirst) * W);
+        winRows -= lo - winFirst;
+        winFirst = lo;
+        window.resize(size_t(hi - lo) * stride);
+        if (withLuma) lumaWindow.resize(size_t(hi - lo) * W);
+        while (winFirst + winRows < hi) {
+            JSAMPROW row = window.data() + size_t(winRows) * stride;
+            if (withLuma) cap.row = lumaWindow.data() + size_t(winRows) * W;
+            winRows += jpeg_read_scanlines(&dinfo, &row, 1);
+        }
+
+        // operacje widzą pas jak cały obraz; wiersze halo chronią wynik przed efektem brzegu
+        strip.width = W; strip.height = winRows; strip.channels = C;
+        strip.pixels.assign(window.begin(), window.end());
+        strip.luma.assign(lumaWindow.begin(), lumaWindow.end());
+        for (size_t i = 1; i < history.size(); ++i)
+            if (history[i].op) { history[i].op(strip); strip.luma.clear(); }
+
+        for (int y = y0; y < y1; ++y) {
+            JSAMPROW row = strip.pixels.data() + size_t(y - lo) * stride;
+            jpeg_write_scanlines(&cinfo, &row, 1);
+        }
+        if (progress) progress->store(float(y1) / float(H), std::memory_order_relaxed);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_finish_decompress(&dinfo);
+    jpeg_destroy_compress(&cinfo);
+    jpeg_destroy_decompress(&dinfo);
+    fclose(f);
+    if (progress) progress->store(1.0f);
+    return true;
+}
+
+// przekodowuje JPEG YCbCr na surowych płaszczyznach: raw_data_out -> operacje jasności na pasach Y -> raw_data_in.
+// Bez operacji chrominancja oryginału przechodzi bez zmian (wymaga tego samego podpróbkowania w eksporcie);
+// po progowaniu obraz jest szary, więc Cb/Cr to stałe 128. Pomija konwersję YCbCr<->RGB i (de)podpróbkowanie.
+bool encodeJpegPlanar(const char* src, const char* dst, const std::vector<Snapshot>& history,
+                      const JpegExportOptions& opt, std::atomic<float>* progress) {
+    int halo = 0;
+    // progowanie płaszczyzny Y pliku - tylko jeśli na ekranie też czytało Y dekodera
+    if (history.size() > 1 && history[0].luma.empty()) return false;
+    for (size_t i = 1; i < history.size(); ++i) {
+        if (!history[i].lumaOnly) return false;
+        halo = (halo < 0 || history[i].halo < 0 ? -1 : halo + history[i].halo);
+    }
+    bool neutralChroma = history.size() > 1;
+
+    MappedFile file(src);
+    if (!file.valid()) return false;
+
+    jpeg_decompress_struct dinfo = {};
+    jpeg_compress_struct cinfo = {};
+    JpegErrorMgr jerr;
+    FILE* volatile f = nullptr;      // otwierany po setjmp
+    dinfo.err = cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpegErrorExit;
+    if (setjmp(jerr.setjmpBuffer)) {
+        jpeg_destroy_compress(&cinfo);
+        jpeg_destroy_decompress(&dinfo);
+        if (f) fclose(f);
+        return false;
+    }
+
+    jpeg_create_decompress(&dinfo);
+    jpeg_mem_src(&dinfo, const_cast<unsigned char*>(file.data), (unsigned long)file.size);
+    jpeg_read_header(&dinfo, TRUE);
+    if (dinfo.num_components != 3 || dinfo.jpeg_color_space != JCS_YCbCr || dinfo.block_size != DCTSIZE ||
+        dinfo.comp_info[0].h_samp_factor != dinfo.max_h_samp_factor ||
+        dinfo.comp_info[0].v_samp_factor != dinfo.max_v_samp_factor) {      // Y musi mieć pełną rozdzielczość
+        jpeg_destroy_decompress(&dinfo);
+        return false;
+    }
+    int W = int(dinfo.image_width), H = int(dinfo.image_height);
+
+    // parametry eksportu; próbkowanie sprawdzane przed otwarciem pliku wyjściowego
+    jpeg_create_compress(&cinfo);
+    setJpegCompressParams(cinfo, W, H, 3, opt);
+    cinfo.raw_data_in = TRUE;
+    cinfo.do_fancy_downsampling = FALSE;        // chrominancja podawana w natywnej rozdzielczości, DCT 8x8
+    bool sameSampling = true;
+    for (int c = 0; c < 3; ++c)
+        sameSampling = sameSampling && cinfo.comp_info[c].h_samp_factor == dinfo.comp_info[c].h_samp_factor &&
+                       cinfo.comp_info[c].v_samp_factor == dinfo.comp_info[c].v_samp_factor;
+    if (!neutralChroma && !sameSampling) {
+        jpeg_destroy_compress(&cinfo);
+        jpeg_destroy_decompress(&dinfo);
+        return false;
+    }
+
+    dinfo.raw_data_out = TRUE;
+    dinfo.do_fancy_upsampling = FALSE;          // bez skalowania IDCT chrominancji: płaszczyzny jak w pliku
+    jpeg_start_decompress(&dinfo);
+    f = fopen(dst, "wb");
+    if (!f) {
+        jpeg_destroy_compress(&cinfo);
+        jpeg_destroy_decompress(&dinfo);
+        return false;
+    }
+    jpeg_stdio_dest(&cinfo, f);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    // bufory wiersza iMCU dekodera i kodera (szerokość dopełniona do całych bloków)
+    auto planeRows = [](jpeg_component_info* comp, int n, std::vector<unsigned char>& buf, std::vector<JSAMPROW>& rows) {
+        size_t width = size_t(comp->width_in_blocks) * DCTSIZE;
+        buf.resize(width * n);
+        rows.resize(n);
+        for (int r = 0; r < n; ++r) rows[r] = buf.data() + width * r;
+    };
+    int decRows = dinfo.max_v_samp_factor * DCTSIZE, encRows = cinfo.max_v_samp_factor * DCTSIZE;
+    std::vector<unsigned char> decBuf[3], encBuf[3];
+    std::vector<JSAMPROW> decPtr[3], encPtr[3];
+    for (int c = 0; c < 3; ++c) {
+        planeRows(&dinfo.comp_info[c], dinfo.comp_info[c].v_samp_factor * DCTSIZE, decBuf[c], decPtr[c]);
+        planeRows(&cinfo.comp_info[c], cinfo.comp_info[c].v_samp_factor * DCTSIZE, encBuf[c], encPtr[c]);
+    }
+    JSAMPARRAY decPlanes[3] = { decPtr[0].data(), decPtr[1].data(), decPtr[2].data() };
+    JSAMPARRAY encPlanes[3] = { encPtr[0].data(), encPtr[1].data(), encPtr[2].data() };
+    if (neutralChroma) {
+        std::fill(encBuf[1].begin(), encBuf[1].end(), (unsigned char)CENTERJSAMPLE);
+        std::fill(encBuf[2].begin(), encBuf[2].end(), (unsigned char)CENTERJSAMPLE);
+    }
+
+    // okno Y jak w processJpegStrips; wiersze Cb/Cr czekają w kolejce, aż koder dojdzie do ich wiersza iMCU
+    int stripRows = (halo < 0 ? H : int(std::min<size_t>(std::max({ STRIP_BUDGET / size_t(W), size_t(4) * halo, size_t(encRows) }), size_t(H))));
+    stripRows = std::min(H, (stripRows + encRows - 1) / encRows * encRows);
+    std::vector<unsigned char> window, chroma[3];
+    int winFirst = 0, winRows = 0;
+    ImageData strip;
+    for (int y0 = 0; y0 < H; y0 += stripRows) {
+        int y1 = std::min(H, y0 + stripRows);
+        int lo = (halo < 0 ? 0 : std::max(0, y0 - halo)), hi = (halo < 0 ? H : std::min(H, y1 + halo));
+
+        window.erase(window.begin(), window.begin() + size_t(lo - winFirst) * W);
+        winRows -= lo - winFirst;
+        winFirst = lo;
+        while (winFirst + winRows < hi) {
+            jpeg_read_raw_data(&dinfo, decPlanes, decRows);
+            int n = std::min(decRows, H - (winFirst + winRows));
+            for (int r = 0; r < n; ++r)
+                window.insert(window.end(), decPtr[0][r], decPtr[0][r] + W);
+            winRows += n;
+            if (!neutralChroma)
+                for (int c = 1; c < 3; ++c) chroma[c].insert(chroma[c].end(), decBuf[c].begin(), decBuf[c].end());
+        }
+
+        strip.width = W; strip.height = winRows; strip.channels = 1;
+        strip.pixels.assign(window.begin(), window.begin() + size_t(winRows) * W);
+        for (size_t i = 1; i < history.size(); ++i)
+            history[i].op(strip);
+
+        // wiersze iMCU kodera: Y dopełnione powieleniem krawędzi, Cb/Cr z kolejki albo stałe
+        for (int yb = y0; yb < y1; yb += encRows) {
+            for (int r = 0; r < encRows; ++r) {
+                int y = std::min(yb + r, H - 1);
+                unsigned char* row = encPtr[0][r];
+                size_t padded = encBuf[0].size() / encRows;
+                memcpy(row, strip.pixels.data() + size_t(y - lo) * W, W);
+                memset(row + W, row[W - 1], padded - W);
+            }
+            if (!neutralChroma)
+                for (int c = 1; c < 3; ++c) {
+                    memcpy(encBuf[c].data(), chroma[c].data(), encBuf[c].size());
+                    chroma[c].erase(chroma[c].begin(), chroma[c].begin() + encBuf[c].size());
+                }
+            jpeg_write_raw_data(&cinfo, encPlanes, encRows);
+        }
+        if (progress) progress->store(float(y1) / float(H), std::memory_order_relaxed);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    jpeg_destroy_decompress(&dinfo);
+    fclose(f);
+    if (progress) progress->store(1.0f);
+    return true;
+}
+
+// uruchamia zapis w osobnym wątku na kopii pikseli; historia bez buforów pikseli (wystarczą operacje)
+void startImageExport(const ImageData& img, const std::vector<Snapshot>& history, const char* fn,
+                      const JpegExportOptions& opt) {
+    waitImageExport();
+
+    ImageData copy;
+    copy.width = img.width; copy.height = img.height; copy.channels = img.channels;
+    copy.pixels = img.pixels;
+    copy.path = img.path;
+    copy.scaleDenom = img.scaleDenom;
+    copy.fullWidth = img.fullWidth; copy.fullHeight = img.fullHeight;
+    std::vector<Snapshot> ops;
+    ops.reserve(history.size());
+    // Y dekodera czytany jest tylko z obrazu bazowego (history[0]) - dalszych płaszczyzn nie kopiujemy
+    for (const Snapshot& s : history)
+        ops.push_back({ {}, s.channels, s.width, s.height, s.op, s.halo, s.geom, s.lumaOnly, s.brightness,
+                        ops.empty() ? s.luma : std::vector<unsigned char>() });
+
+    g_exportJob.done = false;
+    g_exportJob.progress = 0.0f;
+    g_exportJob.pending = true;
+    g_exportJob.path = fn;
+    g_exportJob.worker = std::thread([copy = std::move(copy), ops = std::move(ops), opt]() {
+        g_exportJob.ok = saveImageFullRes(copy, ops, g_exportJob.path.c_str(), opt, &g_exportJob.progress);
+        g_exportJob.done.store(true, std::memory_order_release);
+    });
+}
+
+// zwraca true w klatce, w której zapis się zakończył
+bool pollImageExport() {
+    if (!g_exportJob.pending || !g_exportJob.done.load(std::memory_order_acquire)) return false;
+    g_exportJob.worker.join();
+    g_exportJob.pending = false;
+    if (!g_exportJob.ok) std::cerr << "Save failed: " << g_exportJob.path << "\n";
+    return true;
+}
+
+void waitImageExport() {
+    if (g_exportJob.worker.joinable()) g_exportJob.worker.join();
+    g_exportJob.pending = false;
+}
+
+// jeden krok transupp: in (plik JPEG w pamięci) -> out; false, gdy transformacja nie jest idealna
+static bool transformPass(const unsigned char* in, size_t inSize, const GeomOp& g, std::vector<unsigned char>& out) {
+    jpeg_transform_info info = {};
+    switch (g.kind) {
+    case GeomOp::Rot90:  info.transform = JXFORM_ROT_90;  break;
+    case GeomOp::Rot180: info.transform = JXFORM_ROT_180; break;
+    case GeomOp::Rot270: info.transform = JXFORM_ROT_270; break;
+    case GeomOp::FlipH:  info.transform = JXFORM_FLIP_H;  break;
+    case GeomOp::FlipV:  info.transform = JXFORM_FLIP_V;  break;
+    case GeomOp::Crop:
+        info.transform = JXFORM_NONE;
+        info.crop = TRUE;
+        info.crop_xoffset = g.x; info.crop_xoffset_set = JCROP_POS;
+        info.crop_yoffset = g.y; info.crop_yoffset_set = JCROP_POS;
+        info.crop_width = g.w;   info.crop_width_set = JCROP_POS;
+        info.crop_height = g.h;  info.crop_height_set = JCROP_POS;
+        break;
+    default: return false;
+    }
+    info.perfect = TRUE;    // częściowe MCU na krawędzi -> ścieżka pikselowa
+
+    jpeg_decompress_struct srcinfo = {};
+    jpeg_compress_struct   dstinfo = {};
+    JpegErrorMgr jerr;
+    unsigned char* outBuf = nullptr;
+    unsigned long  outSize = 0;
+    srcinfo.err = jpeg_std_error(&jerr.pub);
+    dstinfo.err = &jerr.pub;
+    jerr.pub.error_exit = jpegErrorExit;
+    if (setjmp(jerr.setjmpBuffer)) {
+        jpeg_destroy_compress(&dstinfo);
+        jpeg_destroy_decompress(&srcinfo);
+        free(outBuf);
+        return false;
+    }
+    jpeg_create_decompress(&srcinfo);
+    jpeg_create_compress(&dstinfo);
+
+    jpeg_mem_src(&srcinfo, const_cast<unsigned char*>(in), (unsigned long)inSize);
+    jcopy_markers_setup(&srcinfo, JCOPYOPT_ALL);
+    jpeg_read_header(&srcinfo, TRUE);
+
+    // przycinanie kadru do bieżących wymiarów (kadr z podglądu mógł wyjść poza krawędź)
+    if (info.crop) {
+        info.crop_xoffset = std::min<JDIMENSION>(info.crop_xoffset, srcinfo.image_width - 1);
+        info.crop_yoffset = std::min<JDIMENSION>(info.crop_yoffset, srcinfo.image_height - 1);
+        info.crop_width = std::min<JDIMENSION>(info.crop_width, srcinfo.image_width - info.crop_xoffset);
+        info.crop_height = std::min<JDIMENSION>(info.crop_height, srcinfo.image_height - info.crop_yoffset);
+    }
+    if (!jtransform_request_workspace(&srcinfo, &info)) {
+        jpeg_destroy_compress(&dstinfo);
+        jpeg_destroy_decompress(&srcinfo);
+        return false;
+    }
+
+    jvirt_barray_ptr* srcCoef = jpeg_read_coefficients(&srcinfo);
+    jpeg_copy_critical_parameters(&srcinfo, &dstinfo);
+    jvirt_barray_ptr* dstCoef = jtransform_adjust_parameters(&srcinfo, &dstinfo, srcCoef, &info);
+
+    jpeg_mem_dest(&dstinfo, &outBuf, &outSize);
+    jpeg_write_coefficients(&dstinfo, dstCoef);
+    jcopy_markers_execute(&srcinfo, &dstinfo, JCOPYOPT_ALL);
+    jtransform_execute_transform(&srcinfo, &dstinfo, srcCoef, &info);
+
+    jpeg_finish_compress(&dstinfo);
+    jpeg_destroy_compress(&dstinfo);
+    jpeg_finish_decompress(&srcinfo);
+    jpeg_destroy_decompress(&srcinfo);
+
+    out.assign(outBuf, outBuf + outSize);
+    free(outBuf);
+    return true;
+}
+
+// bezstratne obroty, odbicia i kadrowanie (transupp.c) - każda operacja z historii to jeden krok w pamięci
+bool transformJpegLossless(const std::string& src, const char* dst, const std::vector<Snapshot>& history) {
+    // pierwszy krok czyta wprost z mapowania pliku źródłowego
+    std::vector<unsigned char> data, next;
+    {
+        MappedFile file(src.c_str());
+        if (!file.valid() || !transformPass(file.data, file.size, history[1].geom, data)) return false;
+    }
+    for (size_t i = 2; i < history.size(); ++i) {
+        if (!transformPass(data.data(), data.size(), history[i].geom, next)) return false;
+        data.swap(next);
+    }
+
+    FILE* f = fopen(dst, "wb");
+    if (!f) return false;
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    fclose(f);
+    return ok;
+}
+
+// ==================== współczynniki DC ====================
+// pierwsza składowa to luminancja, a DC bloku 8x8 to 8 * (średnia - 128) - tylko wtedy działają funkcje poniżej
+static bool dcIsLuma(const jpeg_decompress_struct& cinfo) {
+    return cinfo.block_size == DCTSIZE &&
+           (cinfo.jpeg_color_space == JCS_YCbCr || cinfo.jpeg_color_space == JCS_GRAYSCALE);
+}
+
+// histogram i średnia jasności ze współczynników DC składowej Y (jpeg_read_coefficients): samo dekodowanie
+// entropijne, bez IDCT, upsamplingu i konwersji barw
+bool readJpegDcStats(const char* fn, DcStats& stats) {
+    MappedFile file(fn);
+    if (!file.valid()) return false;
+
+    jpeg_decompress_struct cinfo = {};
+    JpegErrorMgr jerr;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpegErrorExit;
+    if (setjmp(jerr.setjmpBuffer)) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<unsigned char*>(file.data), (unsigned long)file.size);
+    jpeg_read_header(&cinfo, TRUE);
+    if (!dcIsLuma(cinfo)) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jvirt_barray_ptr* coef = jpeg_read_coefficients(&cinfo);
+    jpeg_component_info* comp = &cinfo.comp_info[0];
+    double scale = comp->quant_table->quantval[0] / double(DCTSIZE);
+    double sum = 0.0;
+    stats = DcStats();
+    for (JDIMENSION by = 0; by < comp->height_in_blocks; ++by) {
+        JBLOCKARRAY row = (*cinfo.mem->access_virt_barray)((j_common_ptr)&cinfo, coef[0], by, 1, FALSE);
+        for (JDIMENSION bx = 0; bx < comp->width_in_blocks; ++bx) {
+            double v = std::clamp(CENTERJSAMPLE + row[0][bx][0] * scale, 0.0, 255.0);
+            stats.hist[int(v + 0.5)] += 1.0f;
+            sum += v;
+        }
+    }
+    stats.blocks = (long long)comp->width_in_blocks * comp->height_in_blocks;
+    stats.mean = (stats.blocks > 0 ? sum / double(stats.blocks) : 0.0);
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+// równomierna zmiana jasności na współczynnikach: DC luminancji przesunięte o delta*8/Q0, AC i chrominancja
+// bez zmian, znaczniki skopiowane. Dodanie delta do R, G i B to dodanie delta do Y, więc wynik odpowiada
+// brightnessImage poza obcięciem do [0..255], które robi dopiero dekoder, i krokiem Q0/8 poziomu.
+bool brightnessJpegDc(const std::string& src, const char* dst, int delta, const JpegExportOptions& opt) {
+    MappedFile file(src.c_str());
+    if (!file.valid()) return false;
+
+    jpeg_decompress_struct srcinfo = {};
+    jpeg_compress_struct   dstinfo = {};
+    JpegErrorMgr jerr;
+    FILE* volatile f = nullptr;      // otwierany po setjmp
+    srcinfo.err = jpeg_std_error(&jerr.pub);
+    dstinfo.err = &jerr.pub;
+    jerr.pub.error_exit = jpegErrorExit;
+    if (setjmp(jerr.setjmpBuffer)) {
+        jpeg_destroy_compress(&dstinfo);
+        jpeg_destroy_decompress(&srcinfo);
+        if (f) fclose(f);
+        return false;
+    }
+    jpeg_create_decompress(&srcinfo);
+    jpeg_create_compress(&dstinfo);
+
+    jpeg_mem_src(&srcinfo, const_cast<unsigned char*>(file.data), (unsigned long)file.size);
+    jcopy_markers_setup(&srcinfo, JCOPYOPT_ALL);
+    jpeg_read_header(&srcinfo, TRUE);
+    if (!dcIsLuma(srcinfo)) {
+        jpeg_destroy_compress(&dstinfo);
+        jpeg_destroy_decompress(&srcinfo);
+        return false;
+    }
+
+    jvirt_barray_ptr* coef = jpeg_read_coefficients(&srcinfo);
+    jpeg_component_info* comp = &srcinfo.comp_info[0];
+    int q = comp->quant_table->quantval[0];
+    int shift = int(std::lround(delta * double(DCTSIZE) / q));
+    // zakres DC próbek 8-bitowych: -1024..1016 po dekwantyzacji; wartości już poza nim nie są cofane
+    int lo = -(CENTERJSAMPLE * DCTSIZE) / q, hi = ((MAXJSAMPLE - CENTERJSAMPLE) * DCTSIZE) / q;
+    for (JDIMENSION by = 0; by < comp->height_in_blocks; ++by) {
+        JBLOCKARRAY row = (*srcinfo.mem->access_virt_barray)((j_common_ptr)&srcinfo, coef[0], by, 1, TRUE);
+        for (JDIMENSION bx = 0; bx < comp->width_in_blocks; ++bx) {
+            int dc = row[0][bx][0];
+            int v = (shift > 0 ? std::max(dc, std::min(dc + shift, hi)) : std::min(dc, std::max(dc + shift, lo)));
+            row[0][bx][0] = JCOEF(v);
+        }
+    }
+
+    jpeg_copy_critical_parameters(&srcinfo, &dstinfo);
+    dstinfo.optimize_coding = opt.optimize ? TRUE : FALSE;
+    if (opt.progressive) jpeg_simple_progression(&dstinfo);
+    else dstinfo.restart_interval = srcinfo.restart_interval;     // markery zostają dla równoległego dekodowania
+
+    f = fopen(dst, "wb");
+    if (!f) {
+        jpeg_destroy_compress(&dstinfo);
+        jpeg_destroy_decompress(&srcinfo);
+        return false;
+    }
+    jpeg_stdio_dest(&dstinfo, f);
+    jpeg_write_coefficients(&dstinfo, coef);
+    jcopy_markers_execute(&srcinfo, &dstinfo, JCOPYOPT_ALL);
+    jpeg_finish_compress(&dstinfo);
+    jpeg_destroy_compress(&dstinfo);
+    jpeg_finish_decompress(&srcinfo);
+    jpeg_destroy_decompress(&srcinfo);
+    fclose(f);
+    return true;
+}
+
+// pokazuje zgrubny podgląd od razu, a obraz roboczy dekoduje w osobnym wątku
+bool startImageLoad(const char* fn, ImageData& img) {
+    cancelImageLoad();
+    if (!beginImageLoad(fn, img)) return false;
+    uploadTexture(img);
+    return img.display.width != 0;
+}
+
+// część wczytywania bez GL (może działać poza wątkiem głównym): pierwszy podgląd z histogramami
+// i ewentualny wątek obrazu roboczego; teksturę tworzy wołający
+bool beginImageLoad(const char* fn, ImageData& img) {
+    img.path = fn;
+
+    if (decodePnm(fn, img)) {
+        // surowy PNM: piksele skopiowane wprost z mapowania, nic do dekodowania w tle
+        computeHistograms(img);
+        return true;
+    }
+    bool complete = false;
+    if (decodeJpegCoarse(fn, img, complete)) {
+        int d = chooseProxyScale(img.fullWidth, img.fullHeight);
+        if (d == img.scaleDenom && complete) {
+            // obraz roboczy ma już skalę 1/8 i wszystkie skany - nie ma czego doczytywać
+            computeHistograms(img);
+            return true;
+        }
+        auto task = std::make_shared<LoadTask>();
+        g_loadJob.task = task;
+        g_loadJob.pending = true;
+        g_loadJob.targetWidth = (img.fullWidth + d - 1) / d;
+        std::string path = fn;
+        g_loadJob.worker = std::thread([task, path, d]() {
+            task->ok = decodeJpegScaled(path.c_str(), task->result, d, &task->cancel);
+            task->done.store(true, std::memory_order_release);
+        });
+    }
+    else {
+        // podgląd dekodowany wprost z DCT; pełna rozdzielczość dopiero przy zapisie
+        if (!decodeJpegScaled(fn, img, 0)) {
+            int w, h, ch;
+            MappedFile file(fn);
+            unsigned char* data = file.valid() ? stbi_load_from_memory(file.data, int(file.size), &w, &h, &ch, 0) : nullptr;
+            if (!data) { std::cerr << "Load failed\n"; return false; }
+            img.width = w; img.height = h; img.channels = ch;
+            img.pixels.assign(data, data + size_t(w) * h * ch);
+            img.luma.clear();
+            img.scaleDenom = 1; img.fullWidth = w; img.fullHeight = h;
+            img.mcuWidth = img.mcuHeight = 8;
+            stbi_image_free(data);
+        }
+    }
+    computeHistograms(img);
+    return true;
+}
+
+// podmienia zgrubny podgląd na obraz roboczy, gdy wątek skończył; zwraca true w klatce podmiany
+bool pollImageLoad(ImageData& img) {
+    auto& retired = g_loadJob.retired;
+    for (size_t i = 0; i < retired.size();) {
+        if (!retired[i].second->done.load(std::memory_order_acquire)) { ++i; continue; }
+        retired[i].first.join();
+        retired.erase(retired.begin() + i);
+    }
+    if (!g_loadJob.pending || !g_loadJob.task->done.load(std::memory_order_acquire)) return false;
+    g_loadJob.worker.join();
+    g_loadJob.pending = false;
+    std::shared_ptr<LoadTask> task = std::move(g_loadJob.task);
+    if (!task->ok) { std::cerr << "Load failed\n"; return false; }
+
+    // zachowanie rozmiaru na ekranie: obraz roboczy jest większy od podglądu
+    g_zoomFactor *= float(img.width) / float(task->result.width);
+
+    ImageData& r = task->result;
+    img.width = r.width; img.height = r.height; img.channels = r.channels;
+    img.pixels.swap(r.pixels);
+    img.luma.swap(r.luma);
+    img.scaleDenom = r.scaleDenom;
+    img.fullWidth = r.fullWidth; img.fullHeight = r.fullHeight;
+    img.mcuWidth = r.mcuWidth; img.mcuHeight = r.mcuHeight;
+    uploadTexture(img);
+    computeHistograms(img);
+    return true;
+}
+
+// porzuca wczytywanie w toku bez czekania: dekoder przerywa się sam, wątek dołącza pollImageLoad
+void cancelImageLoad() {
+    if (g_loadJob.worker.joinable()) {
+        g_loadJob.task->cancel.store(true);
+        g_loadJob.retired.emplace_back(std::move(g_loadJob.worker), std::move(g_loadJob.task));
+    }
+    g_loadJob.task.reset();
+    g_loadJob.pending = false;
+}
+
+// koniec programu: przerywa wczytywanie i czeka na wszystkie wątki dekodujące
+void waitImageLoad() {
+    cancelImageLoad();
+    for (auto& r : g_loadJob.retired) r.first.join();
+    g_loadJob.retired.clear();
+}
+
+// szybki pierwszy podgląd: skala 1/8, a dla progresywnego JPEG tylko pierwszy skan (tryb buffered_image).
+// complete - zdekodowane wszystkie skany (plik sekwencyjny), razem z Y dekodera: podgląd może być obrazem roboczym
+bool decodeJpegCoarse(const char* fn, ImageData& img, bool& complete) {
+    complete = false;
+    MappedFile file(fn);
+    if (!file.valid()) return false;
+
+    jpeg_decompress_struct cinfo;
+    JpegErrorMgr jerr;
+    LumaCapture cap;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpegErrorExit;
+    if (setjmp(jerr.setjmpBuffer)) {
+        jpeg_destroy_decompress(&cinfo);
+        img.pixels.clear();
+        img.luma.clear();
+        complete = false;
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<unsigned char*>(file.data), (unsigned long)file.size);
+    jpeg_read_header(&cinfo, TRUE);
+    if (cinfo.num_components != 1 && cinfo.num_components != 3) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    int fullW = int(cinfo.image_width), fullH = int(cinfo.image_height);
+    int mcuW = cinfo.max_h_samp_factor * cinfo.block_size, mcuH = cinfo.max_v_samp_factor * cinfo.block_size;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = 8;
+    cinfo.out_color_space = (cinfo.num_components == 1 ? JCS_GRAYSCALE : JCS_RGB);
+    cinfo.buffered_image = jpeg_has_multiple_scans(&cinfo);
+    jpeg_start_decompress(&cinfo);
+
+    if (cinfo.buffered_image) {
+        // czytamy wejście tylko do końca pierwszego skanu
+        int ret;
+        do {
+            ret = jpeg_consume_input(&cinfo);
+        } while (ret != JPEG_SCAN_COMPLETED && ret != JPEG_REACHED_EOI && ret != JPEG_SUSPENDED);
+        jpeg_start_output(&cinfo, cinfo.input_scan_number);
+    }
+
+    int w = int(cinfo.output_width), h = int(cinfo.output_height), C = cinfo.output_components;
+    size_t stride = size_t(w) * C;
+    img.pixels.resize(stride * h);
+    // pierwszy skan progresji to przybliżenie (często sam Y) - bez płaszczyzny Y dekodera
+    img.luma.resize(!cinfo.buffered_image && attachLumaCapture(&cinfo, cap) ? size_t(w) * h : 0);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = img.pixels.data() + stride * cinfo.output_scanline;
+        if (!img.luma.empty()) cap.row = img.luma.data() + size_t(w) * cinfo.output_scanline;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    complete = !cinfo.buffered_image;
+    if (cinfo.buffered_image) jpeg_finish_output(&cinfo);
+    else                      jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);    // pozostałe skany pomijamy
+
+    img.width = w; img.height = h; img.channels = C;
+    img.scaleDenom = 8;
+    img.fullWidth = fullW; img.fullHeight = fullH;
+    img.mcuWidth = mcuW; img.mcuHeight = mcuH;
+    return true;
+}
+
+void cleanupImage(ImageData& img) { releaseTiles(img.display); img.display = TexturePyramid(); img.pixels.clear(); img.luma.clear(); }
+
+// ==================== texture upload ====================
+// funkcje GL ponad 1.1 (opengl32.dll ich nie eksportuje) - pobierane przez glfwGetProcAddress
+#ifdef _WIN32
+#define GLFN_CALL __stdcall
+#else
+#define GLFN_CALL
+#endif
+#ifndef GL_BGRA
+#define GL_BGRA 0x80E1
+#endif
+#ifndef GL_UNSIGNED_INT_8_8_8_8_REV
+#define GL_UNSIGNED_INT_8_8_8_8_REV 0x8367
+#endif
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT 0x0002
+#endif
+#ifndef GL_MAP_INVALIDATE_BUFFER_BIT
+#define GL_MAP_INVALIDATE_BUFFER_BIT 0x0008
+#endif
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+typedef void      (GLFN_CALL* PFN_TexStorage2D)(GLenum target, GLsizei levels, GLenum internalFormat, GLsizei w, GLsizei h);
+typedef void      (GLFN_CALL* PFN_GenBuffers)(GLsizei n, GLuint* buffers);
+typedef void      (GLFN_CALL* PFN_DeleteBuffers)(GLsizei n, const GLuint* buffers);
+typedef void      (GLFN_CALL* PFN_BindBuffer)(GLenum target, GLuint buffer);
+typedef void      (GLFN_CALL* PFN_BufferData)(GLenum target, ptrdiff_t size, const void* data, GLenum usage);
+typedef void*     (GLFN_CALL* PFN_MapBufferRange)(GLenum target, ptrdiff_t offset, ptrdiff_t length, GLbitfield access);
+typedef GLboolean (GLFN_CALL* PFN_UnmapBuffer)(GLenum target);
+
+// dwa bufory PBO na zmianę: pakowanie następnego wysłania nie czeka na DMA poprzedniego
+struct TextureUpload {
+    PFN_TexStorage2D    texStorage2D = nullptr;     // brak (GL < 4.2) -> glTexImage2D z nullptr, też raz na kafelek
+    PFN_GenBuffers      genBuffers = nullptr;
+    PFN_DeleteBuffers   deleteBuffers = nullptr;
+    PFN_BindBuffer      bindBuffer = nullptr;
+    PFN_BufferData      bufferData = nullptr;
+    PFN_MapBufferRange  mapBufferRange = nullptr;
+    PFN_UnmapBuffer     unmapBuffer = nullptr;
+    GLuint                      pbo[2] = { 0, 0 };  // 0 -> wysyłanie z pamięci procesu (staging)
+    size_t                      pboSize[2] = { 0, 0 };
+    int                         next = 0;
+    std::vector<unsigned char>  staging;
+    int                         tileSize = TEXTURE_TILE_SIZE;   // mniejszy, gdy GL_MAX_TEXTURE_SIZE nie mieści ramki
+};
+static TextureUpload g_texUpload;
+static uint64_t      g_pixelsVersion = 0;       // rośnie przy każdej zmianie pikseli obrazu na ekranie
+
+// wymaga bieżącego kontekstu GL
+void initTextureUpload() {
+    TextureUpload& u = g_texUpload;
+    u.texStorage2D = (PFN_TexStorage2D)glfwGetProcAddress("glTexStorage2D");
+    u.genBuffers = (PFN_GenBuffers)glfwGetProcAddress("glGenBuffers");
+    u.deleteBuffers = (PFN_DeleteBuffers)glfwGetProcAddress("glDeleteBuffers");
+    u.bindBuffer = (PFN_BindBuffer)glfwGetProcAddress("glBindBuffer");
+    u.bufferData = (PFN_BufferData)glfwGetProcAddress("glBufferData");
+    u.mapBufferRange = (PFN_MapBufferRange)glfwGetProcAddress("glMapBufferRange");
+    u.unmapBuffer = (PFN_UnmapBuffer)glfwGetProcAddress("glUnmapBuffer");
+    if (u.genBuffers && u.deleteBuffers && u.bindBuffer && u.bufferData && u.mapBufferRange && u.unmapBuffer)
+        u.genBuffers(2, u.pbo);
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    if (maxSize > 2) u.tileSize = std::min(TEXTURE_TILE_SIZE, int(maxSize) - 2);
+}
+
+void cleanupTextureUpload() {
+    TextureUpload& u = g_texUpload;
+    if (u.pbo[0]) u.deleteBuffers(2, u.pbo);
+    g_texUpload = TextureUpload();
+}
+
+// przepisuje prostokąt obrazu do BGRA (jedno słowo 32-bit na piksel); szary powielany na B, G i R
+static void packBgra(const ImageData& img, int x, int y, int w, int h, unsigned char* dst) {
+    int C = img.channels;
+    auto rows = [&](int r0, int r1) {
+        for (int r = r0; r < r1; ++r) {
+            const unsigned char* p = img.pixels.data() + (size_t(y + r) * img.width + x) * C;
+            uint32_t* d = reinterpret_cast<uint32_t*>(dst + size_t(r) * w * 4);
+            if (C >= 3)
+                for (int i = 0; i < w; ++i, p += C)
+                    d[i] = uint32_t(C == 4 ? p[3] : 255) << 24 | uint32_t(p[0]) << 16 | uint32_t(p[1]) << 8 | p[2];
+            else
+                for (int i = 0; i < w; ++i, p += C)
+                    d[i] = uint32_t(C == 2 ? p[1] : 255) << 24 | uint32_t(p[0]) * 0x010101u;
+        }
+    };
+    int parts = std::min(h, int(g_pool.workers.size()) + 1);
+    if ((long long)w * h < PARALLEL_UPLOAD_MIN_PIXELS || parts < 2) { rows(0, h); return; }
+    g_pool.parallelFor(parts, [&](int k) { rows(int((long long)h * k / parts), int((long long)h * (k + 1) / parts)); });
+}
+
+// wysyła prostokąt do istniejącej tekstury na pozycję (dx, dy): pack zapisuje BGRA do PBO i glTexSubImage2D
+// czyta z offsetu bufora, więc wraca od razu (kopiowanie robi sterownik); bez PBO - z bufora pośredniego
+static void streamTexture(GLuint tex, int dx, int dy, int w, int h, const std::function<void(unsigned char*)>& pack) {
+    TextureUpload& u = g_texUpload;
+    size_t bytes = size_t(w) * h * 4;
+    unsigned char* dst = nullptr;
+    if (u.pbo[0]) {
+        int i = u.next;
+        u.next ^= 1;
+        u.bindBuffer(GL_PIXEL_UNPACK_BUFFER, u.pbo[i]);
+        if (u.pboSize[i] < bytes) {
+            u.bufferData(GL_PIXEL_UNPACK_BUFFER, ptrdiff_t(bytes), nullptr, GL_STREAM_DRAW);
+            u.pboSize[i] = bytes;
+        }
+        dst = static_cast<unsigned char*>(u.mapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, ptrdiff_t(bytes),
+                                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+        if (!dst) u.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    bool mapped = dst != nullptr;
+    if (!mapped) {
+        u.staging.resize(bytes);
+        dst = u.staging.data();
+    }
+    pack(dst);
+    if (mapped) u.unmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, dx, dy, w, h, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, mapped ? nullptr : dst);
+    if (mapped) u.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);      // ImGui wysyła swoje tekstury z pamięci procesu
+}
+
+static int levelWidth(const TexturePyramid& p, int L)  { return (p.width + (1 << L) - 1) >> L; }
+static int levelHeight(const TexturePyramid& p, int L) { return (p.height + (1 << L) - 1) >> L; }
+
+// najwyższy poziom: cały obraz mieści się w jednym kafelku
+static int topLevel(const TexturePyramid& p) {
+    int L = 0;
+    while (std::max(levelWidth(p, L), levelHeight(p, L)) > g_texUpload.tileSize) ++L;
+    return L;
+}
+
+// poziom dla powiększenia zoom: jeden teksel na co najmniej jeden piksel ekranu
+static int displayLevel(const TexturePyramid& p, float zoom) {
+    int L = 0, top = topLevel(p);
+    while (L < top && zoom * float(2 << L) <= 1.0f) ++L;
+    return L;
+}
+
+static PixelRect unionRect(const PixelRect& a, const PixelRect& b) {
+    if (a.empty()) return b;
+    if (b.empty()) return a;
+    int x0 = std::min(a.x, b.x), y0 = std::min(a.y, b.y);
+    int x1 = std::max(a.x + a.w, b.x + b.w), y1 = std::max(a.y + a.h, b.y + b.h);
+    return { x0, y0, x1 - x0, y1 - y0 };
+}
+
+static PixelRect intersectRect(const PixelRect& a, const PixelRect& b) {
+    int x0 = std::max(a.x, b.x), y0 = std::max(a.y, b.y);
+    int x1 = std::min(a.x + a.w, b.x + b.w), y1 = std::min(a.y + a.h, b.y + b.h);
+    if (x1 <= x0 || y1 <= y0) return {};
+    return { x0, y0, x1 - x0, y1 - y0 };
+}
+
+// piksele poziomu L+1, które zależą od prostokąta r poziomu L (każdy uśrednia blok 2x2)
+static PixelRect halveRect(const PixelRect& r) {
+    if (r.empty()) return {};
+    int x0 = r.x >> 1, y0 = r.y >> 1;
+    return { x0, y0, ((r.x + r.w + 1) >> 1) - x0, ((r.y + r.h + 1) >> 1) - y0 };
+}
+
+// piksel obrazu jako słowo BGRA (jak w packBgra)
+static inline uint32_t bgraAt(const ImageData& img, int x, int y) {
+    int C = img.channels;
+    const unsigned char* p = img.pixels.data() + (size_t(y) * img.width + x) * C;
+    if (C >= 3) return uint32_t(C == 4 ? p[3] : 255) << 24 | uint32_t(p[0]) << 16 | uint32_t(p[1]) << 8 | p[2];
+    return uint32_t(C == 2 ? p[1] : 255) << 24 | uint32_t(p[0]) * 0x010101u;
+}
+
+// średnia czterech słów BGRA, każdy bajt osobno (z zaokrągleniem)
+static inline uint32_t averageBgra(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    uint32_t out = 0;
+    for (int s = 0; s < 32; s += 8)
+        out |= ((((a >> s) & 255) + ((b >> s) & 255) + ((c >> s) & 255) + ((d >> s) & 255) + 2) >> 2) << s;
+    return out;
+}
+
+// przelicza prostokąt r poziomu L >= 1 z poziomu L-1 (dla L = 1 wprost z pikseli obrazu)
+static void downsampleLevel(const ImageData& img, TexturePyramid& p, int L, const PixelRect& r) {
+    int srcW = levelWidth(p, L - 1), srcH = levelHeight(p, L - 1), lw = levelWidth(p, L);
+    const uint32_t* src = L >= 2 ? p.levels[L - 2].data() : nullptr;
+    uint32_t* dst = p.levels[L - 1].data();
+    auto rows = [&](int r0, int r1) {
+        for (int y = r.y + r0; y < r.y + r1; ++y) {
+            int sy0 = 2 * y, sy1 = std::min(2 * y + 1, srcH - 1);
+            for (int x = r.x; x < r.x + r.w; ++x) {
+                int sx0 = 2 * x, sx1 = std::min(2 * x + 1, srcW - 1);
+                dst[size_t(y) * lw + x] = src
+                    ? averageBgra(src[size_t(sy0) * srcW + sx0], src[size_t(sy0) * srcW + sx1],
+                                  src[size_t(sy1) * srcW + sx0], src[size_t(sy1) * srcW + sx1])
+                    : averageBgra(bgraAt(img, sx0, sy0), bgraAt(img, sx1, sy0), bgraAt(img, sx0, sy1), bgraAt(img, sx1, sy1));
+            }
+        }
+    };
+    int parts = std::min(r.h, int(g_pool.workers.size()) + 1);
+    if ((long long)r.w * r.h * 4 < PARALLEL_UPLOAD_MIN_PIXELS || parts < 2) { rows(0, r.h); return; }
+    g_pool.parallelFor(parts, [&](int k) { rows(int((long long)r.h * k / parts), int((long long)r.h * (k + 1) / parts)); });
+}
+
+// doprowadza poziomy 1..L do zgodności z pikselami: nowe poziomy liczone w całości, istniejące tylko w zmienionej części
+static void ensureLevels(const ImageData& img, TexturePyramid& p, int L) {
+    while (int(p.levels.size()) < L) {
+        int k = int(p.levels.size()) + 1;
+        p.levels.emplace_back(size_t(levelWidth(p, k)) * levelHeight(p, k));
+        p.stale.push_back({ 0, 0, levelWidth(p, k), levelHeight(p, k) });
+    }
+    for (int k = 1; k <= L; ++k) {
+        PixelRect& r = p.stale[k - 1];
+        if (r.empty()) continue;
+        downsampleLevel(img, p, k, r);
+        if (k < int(p.levels.size())) p.stale[k] = unionRect(p.stale[k], halveRect(r));
+        r = {};
+    }
+}
+
+// oznacza prostokąt r (piksele obrazu) jako zmieniony: kafelki na GPU i policzone poziomy odświeżą się przy rysowaniu
+static void markPyramidDirty(TexturePyramid& p, const PixelRect& r) {
+    ++g_pixelsVersion;
+    PixelRect lr[32];
+    lr[0] = intersectRect(r, { 0, 0, p.width, p.height });
+    if (lr[0].empty()) return;
+    for (int L = 1; L < 32; ++L) lr[L] = halveRect(lr[L - 1]);
+    for (int L = 1; L <= int(p.levels.size()); ++L)
+        p.stale[L - 1] = unionRect(p.stale[L - 1], lr[L]);
+    for (auto& kv : p.tiles) {
+        TextureTile& t = kv.second;
+        PixelRect c = intersectRect(lr[t.level], { t.x - t.bx, t.y - t.by, t.texW, t.texH });
+        t.dirty = unionRect(t.dirty, c);
+    }
+}
+
+// oznacza do ponownego wysłania część kafelków poziomu L w prostokącie r (współrzędne poziomu)
+static void markLevelDirty(TexturePyramid& p, int L, const PixelRect& r) {
+    if (r.empty()) return;
+    for (auto& kv : p.tiles) {
+        TextureTile& t = kv.second;
+        if (t.level != L) continue;
+        t.dirty = unionRect(t.dirty, intersectRect(r, { t.x - t.bx, t.y - t.by, t.texW, t.texH }));
+    }
+}
+
+void releaseTiles(TexturePyramid& p) {
+    for (auto& kv : p.tiles) glDeleteTextures(1, &kv.second.tex);
+    p.tiles.clear();
+    p.residentBytes = 0;
+}
+
+// tworzy teksturę kafelka (tx, ty) poziomu L; zawartość wysyłana przy pierwszym rysowaniu
+static TextureTile& acquireTile(TexturePyramid& p, int L, int tx, int ty) {
+    uint64_t key = uint64_t(L) << 48 | uint64_t(ty) << 24 | uint64_t(tx);
+    auto it = p.tiles.find(key);
+    if (it != p.tiles.end()) return it->second;
+
+    int T = g_texUpload.tileSize, lw = levelWidth(p, L), lh = levelHeight(p, L);
+    TextureTile t;
+    t.level = L;
+    t.x = tx * T; t.y = ty * T;
+    t.w = std::min(T, lw - t.x); t.h = std::min(T, lh - t.y);
+    t.bx = t.x > 0 ? 1 : 0; t.by = t.y > 0 ? 1 : 0;
+    t.texW = t.bx + t.w + (t.x + t.w < lw ? 1 : 0);
+    t.texH = t.by + t.h + (t.y + t.h < lh ? 1 : 0);
+    t.dirty = { t.x - t.bx, t.y - t.by, t.texW, t.texH };
+    glGenTextures(1, &t.tex);
+    glBindTexture(GL_TEXTURE_2D, t.tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    if (g_texUpload.texStorage2D)
+        g_texUpload.texStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, t.texW, t.texH);
+    else
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, t.texW, t.texH, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, nullptr);
+    p.residentBytes += size_t(t.texW) * t.texH * 4;
+    return p.tiles.emplace(key, t).first->second;
+}
+
+// wysyła zmienioną część kafelka: poziom 0 pakowany z pikseli obrazu, wyższe kopiowane z policzonych poziomów
+static void refreshTile(const ImageData& img, TexturePyramid& p, TextureTile& t) {
+    PixelRect r = t.dirty;
+    t.dirty = {};
+    if (r.empty()) return;
+    int dx = r.x - (t.x - t.bx), dy = r.y - (t.y - t.by);
+    PixelRect o = t.level == p.previewLevel ? intersectRect(r, p.previewRect) : PixelRect{};
+    streamTexture(t.tex, dx, dy, r.w, r.h, [&](unsigned char* dst) {
+        if (t.level == 0) packBgra(img, r.x, r.y, r.w, r.h, dst);
+        else {
+            const std::vector<uint32_t>& src = p.levels[t.level - 1];
+            int lw = levelWidth(p, t.level);
+            for (int y = 0; y < r.h; ++y)
+                memcpy(dst + size_t(y) * r.w * 4, src.data() + size_t(r.y + y) * lw + r.x, size_t(r.w) * 4);
+        }
+        // podgląd popupu przykrywa piksele obrazu
+        for (int y = o.y; y < o.y + o.h; ++y)
+            memcpy(dst + (size_t(y - r.y) * r.w + (o.x - r.x)) * 4,
+                   p.preview.data() + size_t(y - p.previewRect.y) * p.previewRect.w + (o.x - p.previewRect.x), size_t(o.w) * 4);
+    });
+}
+
+// usuwa najdawniej rysowane kafelki, dopóki pamięć kafelków przekracza TEXTURE_TILE_BUDGET (bieżąca klatka zostaje)
+static void evictTiles(TexturePyramid& p) {
+    if (p.residentBytes <= TEXTURE_TILE_BUDGET) return;
+    std::vector<std::pair<uint64_t, uint64_t>> order;       // (lastUsed, klucz)
+    for (auto& kv : p.tiles)
+        if (kv.second.lastUsed != p.frame) order.push_back({ kv.second.lastUsed, kv.first });
+    std::sort(order.begin(), order.end());
+    for (auto& o : order) {
+        if (p.residentBytes <= TEXTURE_TILE_BUDGET) break;
+        TextureTile& t = p.tiles[o.second];
+        glDeleteTextures(1, &t.tex);
+        p.residentBytes -= size_t(t.texW) * t.texH * 4;
+        p.tiles.erase(o.second);
+    }
+}
+
+// rysuje widoczne kafelki poziomu dobranego do powiększenia: (ix0, iy0)-(ix1, iy1) to widoczna część obrazu
+// w pikselach obrazu (y od góry); macierz modelu ma już przesunięcie i skalę
+void drawVisibleTiles(ImageData& img, float zoom, float ix0, float iy0, float ix1, float iy1) {
+    TexturePyramid& p = img.display;
+    if (!p.width) return;
+    ++p.frame;
+
+    int L = displayLevel(p, zoom);
+    if (L > 0) ensureLevels(img, p, L);
+
+    int T = g_texUpload.tileSize, lw = levelWidth(p, L), lh = levelHeight(p, L);
+    float sx = float(p.width) / lw, sy = float(p.height) / lh;     // piksele obrazu na piksel poziomu
+    auto tileCol = [&](float ix) { return int(std::clamp(ix / sx, 0.0f, float(lw - 1))) / T; };
+    auto tileRow = [&](float iy) { return int(std::clamp(iy / sy, 0.0f, float(lh - 1))) / T; };
+    int tx0 = tileCol(ix0), tx1 = tileCol(ix1), ty0 = tileRow(iy0), ty1 = tileRow(iy1);
+
+    glEnable(GL_TEXTURE_2D);
+    for (int ty = ty0; ty <= ty1; ++ty)
+        for (int tx = tx0; tx <= tx1; ++tx) {
+            TextureTile& t = acquireTile(p, L, tx, ty);
+            t.lastUsed = p.frame;
+            refreshTile(img, p, t);
+
+            float x0 = t.x * sx, x1 = (t.x + t.w) * sx;
+            float y0 = p.height - t.y * sy, y1 = p.height - (t.y + t.h) * sy;     // GL: y w górę
+            float s0 = float(t.bx) / t.texW, s1 = float(t.bx + t.w) / t.texW;
+            float t0 = float(t.by) / t.texH, t1 = float(t.by + t.h) / t.texH;
+            glBindTexture(GL_TEXTURE_2D, t.tex);
+            glBegin(GL_QUADS);
+            glTexCoord2f(s0, t1); glVertex2f(x0, y1); glTexCoord2f(s1, t1); glVertex2f(x1, y1);
+            glTexCoord2f(s1, t0); glVertex2f(x1, y0); glTexCoord2f(s0, t0); glVertex2f(x0, y0);
+            glEnd();
+        }
+    glDisable(GL_TEXTURE_2D);
+    evictTiles(p);
+}
+
+// nowy rozmiar obrazu zaczyna piramidę od nowa; ten sam - wszystko do odświeżenia (wysyłane tylko widoczne kafelki)
+void uploadTexture(ImageData& img) {
+    TexturePyramid& p = img.display;
+    ++g_pixelsVersion;
+    if (img.pixels.empty() || img.width <= 0 || img.height <= 0) {
+        releaseTiles(p);
+        p = TexturePyramid();
+        return;
+    }
+    if (p.width != img.width || p.height != img.height) {
+        releaseTiles(p);
+        p = TexturePyramid();
+        p.width = img.width;
+        p.height = img.height;
+        return;
+    }
+    markPyramidDirty(p, { 0, 0, img.width, img.height });
+}
+
+// odświeża w piramidzie tylko prostokąt r
+void uploadTextureRect(ImageData& img, const PixelRect& r) {
+    if (!r.empty()) markPyramidDirty(img.display, r);
+}
+
+void computeHistograms(ImageData& img) {
+    const int bins = 256;
+    size_t nPixels = size_t(img.width) * img.height;
+    const unsigned char* p = img.pixels.data();
+
+    img.histGray.assign(bins, 0.0f);
+    img.histR   .assign(bins, 0.0f);
+    img.histG   .assign(bins, 0.0f);
+    img.histB   .assign(bins, 0.0f);
+
+    size_t idx = 0;
+    if (img.channels == 1) {
+        // grayscale
+        for (size_t i = 0; i < nPixels; ++i) {
+            unsigned char v = p[idx++];
+            img.histGray[v] += 1.0f;
+        }
+    }
+    else {
+        // RGB / RGBA
+        for (size_t i = 0; i < nPixels; ++i) {
+            unsigned char r = p[idx++];
+            unsigned char g = p[idx++];
+            unsigned char b = p[idx++];
+            if (img.channels == 4) {
+                //skip alpha
+                idx++;
+            }
+            img.histR[r] += 1.0f;
+            img.histG[g] += 1.0f;
+            img.histB[b] += 1.0f;
+        }
+    }
+
+    float maxGray = 0.0f, maxR = 0.0f, maxG = 0.0f, maxB = 0.0f;
+    if (img.channels == 1) {
+        for (int i = 0; i < bins; ++i) {
+            if (img.histGray[i] > maxGray)
+                maxGray = img.histGray[i];
+        }
+    }
+    else {
+        for (int i = 0; i < bins; ++i) {
+            if (img.histR[i] > maxR) maxR = img.histR[i];
+            if (img.histG[i] > maxG) maxG = img.histG[i];
+            if (img.histB[i] > maxB) maxB = img.histB[i];
+        }
+    }
+}
+
+// ==================== dirty rectangles ====================
+// piksele pokazane w poprzedniej klatce podglądu - z nimi porównywany jest nowy wynik
+static std::vector<unsigned char> g_shownPixels;
+
+// najmniejszy prostokąt, w którym img.pixels różni się od before; pełny obraz, gdy rozmiary się nie zgadzają
+PixelRect changedRect(const ImageData& img, const std::vector<unsigned char>& before) {
+    int W = img.width, H = img.height, C = img.channels;
+    if (before.size() != img.pixels.size() || W <= 0 || H <= 0) return { 0, 0, W, H };
+    size_t stride = size_t(W) * C;
+    const unsigned char* a = img.pixels.data();
+    const unsigned char* b = before.data();
+
+    // pierwszy i ostatni zmieniony wiersz - porównanie całych wierszy
+    int y0 = 0, y1 = H;
+    while (y0 < H && memcmp(a + y0 * stride, b + y0 * stride, stride) == 0) ++y0;
+    if (y0 == H) return {};
+    while (y1 > y0 + 1 && memcmp(a + (y1 - 1) * stride, b + (y1 - 1) * stride, stride) == 0) --y1;
+
+    // kolumny: w każdym wierszu szukamy tylko poza znalezionym już zakresem [x0, x1)
+    size_t lo = stride, hi = 0;                 // w bajtach
+    for (int y = y0; y < y1 && (lo > 0 || hi < stride); ++y) {
+        const unsigned char* p = a + y * stride;
+        const unsigned char* q = b + y * stride;
+        size_t l = 0;
+        while (l < lo && p[l] == q[l]) ++l;
+        if (l < lo) lo = l;
+        size_t r = stride;
+        while (r > hi && p[r - 1] == q[r - 1]) --r;
+        if (r > hi) hi = r;
+    }
+    int x0 = int(lo / C), x1 = int((hi + C - 1) / C);
+    return { x0, y0, x1 - x0, y1 - y0 };
+}
+
+// histogramy po zmianie prostokąta r: liczniki starych wartości (before) w dół, nowych w górę
+static void updateHistogramsRect(ImageData& img, const std::vector<unsigned char>& before, const PixelRect& r) {
+    int C = img.channels;
+    size_t stride = size_t(img.width) * C;
+    int delta[3][256] = {};                     // całkowite różnice - float gubiłby jedynki przy dużych licznikach
+    for (int y = r.y; y < r.y + r.h; ++y) {
+        const unsigned char* p = img.pixels.data() + y * stride + size_t(r.x) * C;
+        const unsigned char* q = before.data() + y * stride + size_t(r.x) * C;
+        if (C == 1) {
+            for (int i = 0; i < r.w; ++i) { --delta[0][q[i]]; ++delta[0][p[i]]; }
+        }
+        else {
+            for (int i = 0; i < r.w; ++i, p += C, q += C) {
+                --delta[0][q[0]]; ++delta[0][p[0]];
+                --delta[1][q[1]]; ++delta[1][p[1]];
+                --delta[2][q[2]]; ++delta[2][p[2]];
+            }
+        }
+    }
+    for (int v = 0; v < 256; ++v) {
+        if (C == 1) img.histGray[v] += float(delta[0][v]);
+        else {
+            img.histR[v] += float(delta[0][v]);
+            img.histG[v] += float(delta[1][v]);
+            img.histB[v] += float(delta[2][v]);
+        }
+    }
+}
+
+// po zmianie pikseli w r (before - stan sprzed zmiany): wysyła do tekstury tylko r i poprawia histogramy
+// o różnicę w r; przy zmianie rozmiaru albo braku poprzedniego stanu - pełne odświeżenie
+void refreshImageRect(ImageData& img, const std::vector<unsigned char>& before, const PixelRect& r) {
+    bool sameSize = before.size() == img.pixels.size() &&
+                    img.display.width == img.width && img.display.height == img.height;
+    bool histOk = img.histGray.size() == 256 && (img.channels == 1 || img.channels >= 3);
+    if (!sameSize || !histOk) {
+        uploadTexture(img);
+        computeHistograms(img);
+        return;
+    }
+    int x0 = std::max(r.x, 0), y0 = std::max(r.y, 0);
+    int x1 = std::min(r.x + r.w, img.width), y1 = std::min(r.y + r.h, img.height);
+    PixelRect c{ x0, y0, x1 - x0, y1 - y0 };
+    if (c.empty()) return;
+    uploadTextureRect(img, c);
+    // różnica czyta dwa bufory - powyżej połowy obrazu taniej policzyć histogram od nowa
+    if ((long long)c.w * c.h * 2 > (long long)img.width * img.height) computeHistograms(img);
+    else updateHistogramsRect(img, before, c);
+}
+
+void refreshImage(ImageData& img, const std::vector<unsigned char>& before) {
+    refreshImageRect(img, before, changedRect(img, before));
+}
+
+// zlecenie wątku podglądu
+struct PreviewTask {
+    uint64_t                            id = 0;
+    std::function<void(ImageData&)>     op;
+    std::shared_ptr<const ImageData>    base;           // cały obraz: niezmienna kopia source, liczona na jej kopii
+    ImageData                           image;          // wycinek poziomu level z otoczeniem; po op - wynik
+    int                                 level = -1;     // -1 - cały obraz
+    int                                 stage = 0;      // wycinek z poziomu level + stage
+    PixelRect                           vis, ext;
+    double                              ms = 0;         // czas op w wątku podglądu
+};
+
+// podgląd drogich operacji (mediana, k-means, Wolf-Jolion, histereza) w osobnym wątku: liczy się tylko najnowsze
+// zlecenie, nowsze parametry przerywają liczone i zastępują czekające; na ekranie zostaje ostatni gotowy wynik
+struct PreviewWorker {
+    std::thread                         thread;
+    std::mutex                          mutex;
+    std::condition_variable             cv;
+    bool                                stop = false;
+    std::unique_ptr<PreviewTask>        next;           // czeka na wątek
+    std::unique_ptr<PreviewTask>        done;           // gotowy wynik dla wątku głównego
+    uint64_t                            running = 0;    // id liczonego zadania, 0 - brak
+    std::atomic<bool>                   cancel{ false };    // liczone zadanie jest już nieaktualne
+    // tylko wątek główny
+    uint64_t                            submitted = 0, shown = 0;   // ostatnie zlecone / ostatnie pokazane (lub porzucone)
+    bool                                active = false; // podgląd całego obrazu w tle
+    bool                                used = false;   // previewOp wołane w tej klatce
+    const std::vector<unsigned char>*   source = nullptr;
+    std::shared_ptr<const ImageData>    base;
+    std::function<void(ImageData&)>     op;             // ostatnio zlecona operacja (dla Apply)
+};
+static PreviewWorker g_previewWorker;
+
+// ustawione w wątku podglądu - operacje sprawdzają je między wierszami i przerywają nieaktualne zadanie
+static thread_local const std::atomic<bool>* t_previewCancel = nullptr;
+
+static bool previewCancelled() {
+    return t_previewCancel && t_previewCancel->load(std::memory_order_relaxed);
+}
+
+static void previewWorkerLoop() {
+    PreviewWorker& pw = g_previewWorker;
+    t_previewCancel = &pw.cancel;
+    for (;;) {
+        std::unique_ptr<PreviewTask> t;
+        {
+            std::unique_lock<std::mutex> lock(pw.mutex);
+            pw.cv.wait(lock, [&]() { return pw.stop || pw.next; });
+            if (pw.stop) return;
+            t = std::move(pw.next);
+            pw.running = t->id;
+            pw.cancel.store(false);
+        }
+        if (t->base) t->image = *t->base;
+        auto t0 = std::chrono::steady_clock::now();
+        t->op(t->image);
+        t->ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        {
+            std::lock_guard<std::mutex> lock(pw.mutex);
+            pw.running = 0;
+            if (pw.cancel.load()) continue;         // w trakcie przyszło nowsze zlecenie albo podgląd się skończył
+            pw.done = std::move(t);
+        }
+        glfwPostEmptyEvent();                       // obudź pętlę główną śpiącą w glfwWaitEvents
+    }
+}
+
+// zleca zadanie: czekające zastępuje, liczone przerywa
+static void submitPreviewTask(std::unique_ptr<PreviewTask> t) {
+    PreviewWorker& pw = g_previewWorker;
+    t->id = ++pw.submitted;
+    {
+        std::lock_guard<std::mutex> lock(pw.mutex);
+        if (!pw.thread.joinable()) pw.thread = std::thread(previewWorkerLoop);
+        pw.next = std::move(t);
+        if (pw.running) pw.cancel.store(true);
+    }
+    pw.cv.notify_one();
+}
+
+// porzuca zlecenia i przerywa liczone; nic z nich nie trafi już na ekran
+static void cancelPreviewTasks() {
+    PreviewWorker& pw = g_previewWorker;
+    if (pw.shown == pw.submitted && !pw.active) return;
+    {
+        std::lock_guard<std::mutex> lock(pw.mutex);
+        pw.next.reset();
+        pw.done.reset();
+        if (pw.running) pw.cancel.store(true);
+    }
+    pw.shown = pw.submitted;
+    pw.active = false;
+    pw.source = nullptr;
+    pw.base.reset();
+    pw.op = nullptr;
+}
+
+// koniec programu: przerywa liczone zadanie i czeka na wątek podglądu
+void stopPreviewWorker() {
+    PreviewWorker& pw = g_previewWorker;
+    {
+        std::lock_guard<std::mutex> lock(pw.mutex);
+        pw.stop = true;
+        pw.cancel.store(true);
+    }
+    pw.cv.notify_all();
+    if (pw.thread.joinable()) pw.thread.join();
+}
+
+// op na kopii source w całym obrazie; tekstura i histogramy tylko tam, gdzie wynik różni się od poprzedniej klatki,
+// więc nieruszony suwak nic nie wysyła
+static void showResult(ImageData& img, const std::vector<unsigned char>& source, const std::function<void(ImageData&)>& op) {
+    g_shownPixels.swap(img.pixels);
+    img.pixels = source;
+    if (op) op(img);
+    refreshImage(img, g_shownPixels);
+}
+
+// podgląd operacji lokalnej tylko w widocznej części obrazu: img.pixels zostaje oryginałem (source), wynik
+// trafia do kafelków jako nakładka; pełny obraz liczy commitPreview przy Apply
+struct RoiPreview {
+    bool                                 active = false;
+    bool                                 used = false;         // previewOp wołane w tej klatce
+    const std::vector<unsigned char>*    source = nullptr;     // kopia popupu sprzed podglądu (bpX)
+    std::function<void(ImageData&)>      op;
+    ImageData                            result;               // widoczny wynik z histogramami (panel Histogram)
+    // dwa etapy: najpierw podgląd pośredni z mniejszego poziomu piramidy w budżecie klatki, potem pełna rozdzielczość
+    int                                  stage = 0;            // na ekranie wynik z poziomu L + stage (0 - dokładny)
+    bool                                 pending = false;      // zlecenie w wątku podglądu, na ekranie poprzedni wynik
+    double                               msPerPixel = 0;       // zmierzony koszt operacji, 0 - jeszcze nieznany
+    std::chrono::steady_clock::time_point changed;             // ostatnia zmiana parametrów albo widoku
+};
+static RoiPreview g_roiPreview;
+
+// prostokąty podglądu na poziomie L + stage: vis - widoczna część (ten sam obszar co vis poziomu L), ext - z otoczeniem
+// halo pikseli tego poziomu
+static void stageRects(const TexturePyramid& p, int L, const PixelRect& vis, int halo, int stage, PixelRect& pvis, PixelRect& ext) {
+    int lw = levelWidth(p, L + stage), lh = levelHeight(p, L + stage), f = 1 << stage;
+    int x0 = vis.x >> stage, y0 = vis.y >> stage;
+    int x1 = std::min(lw, (vis.x + vis.w + f - 1) >> stage), y1 = std::min(lh, (vis.y + vis.h + f - 1) >> stage);
+    pvis = { x0, y0, x1 - x0, y1 - y0 };
+    ext = intersectRect({ pvis.x - halo, pvis.y - halo, pvis.w + 2 * halo, pvis.h + 2 * halo }, { 0, 0, lw, lh });
+}
+
+// najmniejsze zmniejszenie (2^stage względem poziomu L), przy którym operacja zmieści się w budżecie klatki;
+// koszt jeszcze nieznany - próba na małym wycinku
+static int proxyStage(const TexturePyramid& p, int L, const PixelRect& vis, int halo, double msPerPixel) {
+    int top = topLevel(p), stage = 0;
+    for (; L + stage < top; ++stage) {
+        PixelRect pv, pe;
+        stageRects(p, L, vis, halo, stage, pv, pe);
+        double pixels = double(pe.w) * pe.h;
+        if (msPerPixel > 0 ? pixels * msPerPixel <= PREVIEW_FRAME_BUDGET_MS : pixels <= PREVIEW_PROBE_PIXELS) break;
+    }
+    return stage;
+}
+
+// zmierzony czas operacji na wycinku o podanej liczbie pikseli; średnia krocząca, bo koszt zmienia się z parametrami
+static void notePreviewCost(RoiPreview& rp, double ms, double pixels) {
+    if (pixels <= 0) return;
+    double c = ms / pixels;
+    rp.msPerPixel = (rp.msPerPixel > 0 ? 0.5 * (rp.msPerPixel + c) : c);
+}
+
+// wynik z poziomu L + stage (wycinek ext) przeskalowany dwuliniowo do prostokąta vis poziomu L
+static void upsampleStage(const ImageData& src, const PixelRect& ext, int stage, const PixelRect& vis, ImageData& out) {
+    int C = src.channels, f = 1 << stage;
+    out.width = vis.w; out.height = vis.h; out.channels = C;
+    out.pixels.resize(size_t(vis.w) * vis.h * C);
+    // środek piksela X poziomu L w pikselach poziomu L + stage: (X + 0.5) / f - 0.5; wagi w 1/256
+    std::vector<int> xi(vis.w), xw(vis.w);
+    for (int x = 0; x < vis.w; ++x) {
+        float u = std::clamp((vis.x + x + 0.5f) / f - 0.5f - ext.x, 0.0f, float(src.width - 1));
+        xi[x] = std::min(int(u), src.width - 1);
+        xw[x] = int((u - xi[x]) * 256.0f + 0.5f);
+    }
+    auto rows = [&](int r0, int r1) {
+        for (int y = r0; y < r1; ++y) {
+            float v = std::clamp((vis.y + y + 0.5f) / f - 0.5f - ext.y, 0.0f, float(src.height - 1));
+            int yi = std::min(int(v), src.height - 1), yw = int((v - yi) * 256.0f + 0.5f);
+            const unsigned char* a = src.pixels.data() + size_t(yi) * src.width * C;
+            const unsigned char* b = src.pixels.data() + size_t(std::min(yi + 1, src.height - 1)) * src.width * C;
+            unsigned char* d = out.pixels.data() + size_t(y) * vis.w * C;
+            for (int x = 0; x < vis.w; ++x, d += C) {
+                size_t i0 = size_t(xi[x]) * C, i1 = size_t(std::min(xi[x] + 1, src.width - 1)) * C;
+                for (int c = 0; c < C; ++c) {
+                    int top = a[i0 + c] * (256 - xw[x]) + a[i1 + c] * xw[x];
+                    int bot = b[i0 + c] * (256 - xw[x]) + b[i1 + c] * xw[x];
+                    d[c] = static_cast<unsigned char>((top * (256 - yw) + bot * yw + 32768) >> 16);
+                }
+            }
+        }
+    };
+    int parts = std::min(vis.h, int(g_pool.workers.size()) + 1);
+    if (parts <= 1) { rows(0, vis.h); return; }
+    g_pool.parallelFor(parts, [&](int k) { rows(int((long long)vis.h * k / parts), int((long long)vis.h * (k + 1) / parts)); });
+}
+
+// parametry ostatniego podglądu: ta sama kopia, te same parametry, ten sam widok i niezmienione piksele - nic do liczenia
+struct PreviewKey {
+    bool                                 valid = false;
+    const std::vector<unsigned char>*    source = nullptr;
+    std::vector<double>                  params;
+    int                                  halo = 0;
+    int                                  level = 0;
+    PixelRect                            rect;                 // widoczny prostokąt (tylko podgląd lokalny)
+    uint64_t                             version = 0;          // g_pixelsVersion po ostatnim podglądzie
+};
+static PreviewKey g_previewKey;
+
+// zdejmuje nakładkę podglądu; img.pixels i histogramy nadal opisują oryginał
+static void endRoiPreview(ImageData& img) {
+    cancelPreviewTasks();
+    if (!g_roiPreview.active) return;
+    g_previewKey.valid = false;
+    TexturePyramid& p = img.display;
+    if (p.previewLevel >= 0) markLevelDirty(p, p.previewLevel, p.previewRect);
+    p.previewLevel = -1;
+    p.previewRect = {};
+    p.preview.clear();
+    g_roiPreview = RoiPreview();
+}
+
+// prostokąt poziomu L z pikseli obrazu (dla L >= 1 z policzonego poziomu BGRA) jako obraz o kanałach img
+static void levelCrop(ImageData& img, int L, const PixelRect& r, ImageData& out) {
+    int C = img.channels;
+    out.width = r.w; out.height = r.h; out.channels = C;
+    out.pixels.resize(size_t(r.w) * r.h * C);
+    if (L == 0) {
+        for (int y = 0; y < r.h; ++y)
+            memcpy(out.pixels.data() + size_t(y) * r.w * C, img.pixels.data() + (size_t(r.y + y) * img.width + r.x) * C, size_t(r.w) * C);
+        // Y z dekodera - progowania czytają go zamiast jasności z RGB, jak na pełnym obrazie
+        out.luma.resize(img.luma.empty() ? 0 : size_t(r.w) * r.h);
+        for (int y = 0; y < r.h && !img.luma.empty(); ++y)
+            memcpy(out.luma.data() + size_t(y) * r.w, img.luma.data() + size_t(r.y + y) * img.width + r.x, r.w);
+        return;
+    }
+    TexturePyramid& p = img.display;
+    ensureLevels(img, p, L);
+    int lw = levelWidth(p, L);
+    for (int y = 0; y < r.h; ++y) {
+        const uint32_t* s = p.levels[L - 1].data() + size_t(r.y + y) * lw + r.x;
+        unsigned char* d = out.pixels.data() + size_t(y) * r.w * C;
+        for (int x = 0; x < r.w; ++x, d += C) {
+            uint32_t v = s[x];
+            if (C >= 3) { d[0] = (v >> 16) & 255; d[1] = (v >> 8) & 255; d[2] = v & 255; if (C == 4) d[3] = v >> 24; }
+            else { d[0] = v & 255; if (C == 2) d[1] = v >> 24; }
+        }
+    }
+}
+
+// wynik operacji na wycinku ext poziomu L: do kafelków jako nakładka trafia jego część vis, tylko tam, gdzie różni
+// się od poprzedniej nakładki; histogramy widocznego wyniku do panelu
+static void showRoiResult(ImageData& img, int L, const PixelRect& vis, const PixelRect& ext, const ImageData& roi) {
+    TexturePyramid& p = img.display;
+    std::vector<uint32_t> out;
+    ImageData& res = g_roiPreview.result;
+    if (!vis.empty()) {
+        // wynik bez otoczenia; kanały mogą się zmienić (progowania zostawiają obraz szary)
+        int C = roi.channels;
+        res.width = vis.w; res.height = vis.h; res.channels = C;
+        res.pixels.resize(size_t(vis.w) * vis.h * C);
+        for (int y = 0; y < vis.h; ++y)
+            memcpy(res.pixels.data() + size_t(y) * vis.w * C,
+                   roi.pixels.data() + (size_t(vis.y - ext.y + y) * roi.width + (vis.x - ext.x)) * C, size_t(vis.w) * C);
+        out.resize(size_t(vis.w) * vis.h);
+        for (int y = 0; y < vis.h; ++y)
+            for (int x = 0; x < vis.w; ++x) out[size_t(y) * vis.w + x] = bgraAt(res, x, y);
+        computeHistograms(res);
+    }
+
+    if (p.previewLevel == L && p.previewRect.x == vis.x && p.previewRect.y == vis.y &&
+        p.previewRect.w == vis.w && p.previewRect.h == vis.h) {
+        int y0 = vis.h, y1 = 0, x0 = vis.w, x1 = 0;
+        for (int y = 0; y < vis.h; ++y) {
+            const uint32_t* a = out.data() + size_t(y) * vis.w;
+            const uint32_t* b = p.preview.data() + size_t(y) * vis.w;
+            int l = 0, r = vis.w;
+            while (l < r && a[l] == b[l]) ++l;
+            if (l == r) continue;
+            while (a[r - 1] == b[r - 1]) --r;
+            y0 = std::min(y0, y); y1 = y + 1; x0 = std::min(x0, l); x1 = std::max(x1, r);
+        }
+        if (y1 > y0) markLevelDirty(p, L, { vis.x + x0, vis.y + y0, x1 - x0, y1 - y0 });
+    }
+    else {
+        if (p.previewLevel >= 0) markLevelDirty(p, p.previewLevel, p.previewRect);
+        markLevelDirty(p, L, vis);
+    }
+    p.previewLevel = L;
+    p.previewRect = vis;
+    p.preview.swap(out);
+}
+
+// wynik etapu stage na ekran; podgląd pośredni najpierw powiększony do prostokąta vis poziomu L
+static void showStageResult(ImageData& img, int L, int stage, const PixelRect& vis, const PixelRect& ext, const ImageData& roi) {
+    if (stage == 0 || vis.empty()) {
+        showRoiResult(img, L, vis, ext, roi);
+        return;
+    }
+    ImageData up;
+    upsampleStage(roi, ext, stage, vis, up);
+    showRoiResult(img, L, vis, vis, up);
+}
+
+// gotowy wynik z wątku podglądu na ekran (także starszy od ostatniego zlecenia - lepszy niż wcześniejszy); true - coś pokazano
+static bool collectPreview(ImageData& img) {
+    PreviewWorker& pw = g_previewWorker;
+    std::unique_ptr<PreviewTask> t;
+    {
+        std::lock_guard<std::mutex> lock(pw.mutex);
+        t = std::move(pw.done);
+    }
+    if (!t || t->id <= pw.shown) return false;
+    pw.shown = t->id;
+    // własna zmiana pikseli nie unieważnia klucza podglądu
+    uint64_t version = g_pixelsVersion;
+    if (t->level < 0) {
+        g_shownPixels.swap(img.pixels);
+        img.pixels.swap(t->image.pixels);
+        img.channels = t->image.channels;
+        refreshImage(img, g_shownPixels);
+    }
+    else if (g_roiPreview.active) {
+        RoiPreview& rp = g_roiPreview;
+        showStageResult(img, t->level, t->stage, t->vis, t->ext, t->image);
+        notePreviewCost(rp, t->ms, double(t->ext.w) * t->ext.h);
+        rp.stage = t->stage;
+        if (t->id == pw.submitted) rp.pending = false;
+    }
+    if (g_previewKey.valid && g_previewKey.version == version) g_previewKey.version = g_pixelsVersion;
+    return true;
+}
+
+// podgląd w popupie. Operacja lokalna (halo >= 0 - tyle pikseli kontekstu potrzebuje) liczona jest tylko dla
+// widocznego prostokąta, na poziomie piramidy, który jest na ekranie - koszt zależy od okna, nie od zdjęcia.
+// Gdy nie mieści się w PREVIEW_FRAME_BUDGET_MS, najpierw pokazywany jest wynik z mniejszego poziomu (powiększony),
+// a po zatrzymaniu suwaka - pełna rozdzielczość poziomu.
+// Operacja globalna (halo < 0) liczona na całym obrazie.
+// params - wartości parametrów operacji; przy tych samych co w poprzedniej klatce podgląd nie jest liczony od nowa.
+// background - operacja liczy się w wątku podglądu (op musi kopiować parametry), klatka nie czeka na wynik.
+void previewOp(ImageData& img, const std::vector<unsigned char>& source, const std::function<void(ImageData&)>& op, int halo,
+               const std::vector<double>& params, bool background) {
+    TexturePyramid& p = img.display;
+    PreviewKey& key = g_previewKey;
+    PreviewWorker& pw = g_previewWorker;
+    if (background) pw.used = true;
+    collectPreview(img);
+    bool same = key.valid && key.source == &source && key.params == params && key.halo == halo && key.version == g_pixelsVersion;
+    float ix0, iy0, ix1, iy1;
+    if (halo < 0 || !op || !p.width || g_viewW <= 0 || source.size() != img.pixels.size()) {
+        if (same && !g_roiPreview.active && (pw.active || !background)) return;
+        endRoiPreview(img);
+        if (!background || !op) {
+            cancelPreviewTasks();
+            showResult(img, source, op);
+        }
+        else {
+            if (!pw.active || pw.source != &source) {
+                cancelPreviewTasks();
+                auto base = std::make_shared<ImageData>();
+                base->width = img.width; base->height = img.height; base->channels = img.channels;
+                base->pixels = source;
+                base->luma = img.luma;
+                pw.active = true;
+                pw.source = &source;
+                pw.base = base;
+            }
+            pw.op = op;
+            auto t = std::make_unique<PreviewTask>();
+            t->op = op;
+            t->base = pw.base;
+            submitPreviewTask(std::move(t));
+        }
+        key = { true, &source, params, halo, 0, {}, g_pixelsVersion };
+        return;
+    }
+    RoiPreview& rp = g_roiPreview;
+    if (!rp.active || rp.source != &source) {
+        endRoiPreview(img);
+        showResult(img, source, nullptr);           // pod nakładką oryginał
+        rp.active = true;
+        rp.source = &source;
+    }
+    rp.used = true;
+    rp.op = op;
+
+    // widoczny prostokąt poziomu L (parametry operacji zostają bez zmian)
+    int L = displayLevel(p, g_zoomFactor), lw = levelWidth(p, L), lh = levelHeight(p, L);
+    visibleImageArea(img, g_viewW, g_viewH, ix0, iy0, ix1, iy1);
+    float sx = float(lw) / p.width, sy = float(lh) / p.height;
+    int vx0 = std::clamp(int(std::floor(ix0 * sx)), 0, lw), vx1 = std::clamp(int(std::ceil(ix1 * sx)), 0, lw);
+    int vy0 = std::clamp(int(std::floor(iy0 * sy)), 0, lh), vy1 = std::clamp(int(std::ceil(iy1 * sy)), 0, lh);
+    PixelRect vis{ vx0, vy0, vx1 - vx0, vy1 - vy0 };
+    auto now = std::chrono::steady_clock::now();
+    int stage;
+    if (same && key.level == L && key.rect.x == vis.x && key.rect.y == vis.y && key.rect.w == vis.w && key.rect.h == vis.h) {
+        // nic nowego; podgląd pośredni dopracowywany, gdy suwak stoi (albo od razu, jeśli zmieści się w klatce)
+        if (rp.stage == 0 || rp.pending) return;
+        PixelRect pv, pe;
+        stageRects(p, L, vis, halo, 0, pv, pe);
+        bool fits = rp.msPerPixel > 0 && double(pe.w) * pe.h * rp.msPerPixel <= PREVIEW_FRAME_BUDGET_MS;
+        if (!fits && std::chrono::duration<double>(now - rp.changed).count() < PREVIEW_SETTLE_SECONDS) return;
+        stage = 0;
+    }
+    else {
+        rp.changed = now;
+        stage = proxyStage(p, L, vis, halo, rp.msPerPixel);
+    }
+    PixelRect pvis, ext;
+    stageRects(p, L, vis, halo, stage, pvis, ext);
+
+    // wycinek kopiowany w tej klatce - wątek nie czyta pikseli obrazu ani piramidy
+    auto t = std::make_unique<PreviewTask>();
+    if (!vis.empty()) levelCrop(img, L + stage, ext, t->image);
+    bool fits = rp.msPerPixel > 0 && double(ext.w) * ext.h * rp.msPerPixel <= PREVIEW_FRAME_BUDGET_MS;
+    if (background && !fits && !vis.empty()) {
+        // nie zmieści się w klatce (albo koszt jeszcze nieznany) - do wątku podglądu, na ekranie zostaje poprzedni wynik
+        t->op = op;
+        t->level = L; t->stage = stage; t->vis = vis; t->ext = ext;
+        submitPreviewTask(std::move(t));
+        rp.pending = true;
+    }
+    else {
+        cancelPreviewTasks();
+        rp.pending = false;
+        if (!vis.empty()) {
+            auto t0 = std::chrono::steady_clock::now();
+            op(t->image);
+            notePreviewCost(rp, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count(),
+                            double(ext.w) * ext.h);
+        }
+        showStageResult(img, L, stage, vis, ext, t->image);
+        rp.stage = stage;
+    }
+    key = { true, &source, params, halo, L, vis, g_pixelsVersion };
+}
+
+// Apply popupu: pełny wynik na całym obrazie. Podgląd lokalny obejmował tylko widoczną część, a podgląd w tle mógł
+// jeszcze nie dotrzeć - wtedy ta sama operacja liczona teraz
+void commitPreview(ImageData& img) {
+    PreviewWorker& pw = g_previewWorker;
+    if (pw.active) {
+        collectPreview(img);
+        const std::vector<unsigned char>* source = pw.source;
+        std::function<void(ImageData&)> op = pw.op;
+        bool ready = (pw.shown == pw.submitted);    // najnowsze zlecenie już w img.pixels
+        cancelPreviewTasks();
+        if (!ready) showResult(img, *source, op);
+        return;
+    }
+    if (!g_roiPreview.active) return;           // operacja globalna: pełny wynik już jest w img.pixels
+    const std::vector<unsigned char>* source = g_roiPreview.source;
+    std::function<void(ImageData&)> op = g_roiPreview.op;
+    endRoiPreview(img);
+    showResult(img, *source, op);
+}
+
+// popup zamknięty bez Apply/Cancel (krzyżyk okna): nakładka znika, obraz zostaje oryginałem
+void endIdlePreview(ImageData& img) {
+    if (g_roiPreview.active && !g_roiPreview.used) endRoiPreview(img);
+    g_roiPreview.used = false;
+    if (g_previewWorker.active && !g_previewWorker.used) cancelPreviewTasks();
+    g_previewWorker.used = false;
+}
+
+// histogramy do panelu: w trakcie podglądu lokalnego - widocznego wyniku
+const ImageData& histogramSource(const ImageData& img) {
+    return g_roiPreview.active && !g_roiPreview.result.histGray.empty() ? g_roiPreview.result : img;
+}
+
+// pokazuje podane piksele (Cancel, cofnięcie) - odświeżane tylko to, co się zmieniło
+void showPixels(ImageData& img, const std::vector<unsigned char>& pixels) {
+    endRoiPreview(img);
+    showResult(img, pixels, nullptr);
+}
+
+// ==================== thread pool ====================
+
+void ThreadPool::start(int n) {
+    stop = false;
+    for (int i = 0; i < n; ++i)
+        workers.emplace_back([this]() {
+            for (;;) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [this]() { return stop || !tasks.empty(); });
+                    if (stop) return;
+                    task = std::move(tasks.front());
+                    tasks.pop_front();
+                }
+                task();
+            }
+        });
+}
+
+// urgent: zadanie trafia na początek kolejki (np. sąsiedzi bieżącego zdjęcia przed resztą miniatur)
+void ThreadPool::submit(std::function<void()> task, bool urgent) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (urgent) tasks.push_front(std::move(task));
+        else        tasks.push_back(std::move(task));
+    }
+    cv.notify_one();
+}
+
+// porzuca zadania z kolejki i czeka na te w toku
+void ThreadPool::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+        tasks.clear();
+    }
+    cv.notify_all();
+    for (std::thread& t : workers) t.join();
+    workers.clear();
+}
+
+// wykonuje fn(0..n-1) na puli i w wątku wywołującym, wraca po ukończeniu wszystkich indeksów.
+// Licznik żyje na stercie: zadanie puli, które ruszy po powrocie, zastanie next >= n i nie dotknie fn.
+// Wątek wywołujący też wykonuje pracę, więc można to wołać z zadania puli bez ryzyka zakleszczenia.
+void ThreadPool::parallelFor(int n, const std::function<void(int)>& fn) {
+    struct Job {
+        std::atomic<int>                 next{ 0 }, finished{ 0 };
+        int                              n = 0;
+        const std::function<void(int)>*  fn = nullptr;
+    };
+    auto job = std::make_shared<Job>();
+    job->n = n;
+    job->fn = &fn;
+    auto work = [job]() {
+        for (int k; (k = job->next.fetch_add(1)) < job->n; job->finished.fetch_add(1))
+            (*job->fn)(k);
+    };
+    for (int i = 0; i < std::min(n, int(workers.size()) + 1) - 1; ++i)
+        submit(work, true);
+    work();
+    while (job->finished.load() < n) std::this_thread::yield();
+}
+
+// ==================== folder / filmstrip ====================
+
+// zmniejsza obraz uśrednianiem pól do dłuższego boku maxSide, wynik zawsze RGB
+static void makeThumbnail(const ImageData& src, int maxSide, Thumbnail& t) {
+    int W = src.width, H = src.height, C = src.channels;
+    float s = std::min(1.0f, float(maxSide) / float(std::max(W, H)));
+    int w = std::max(1, int(W * s + 0.5f)), h = std::max(1, int(H * s + 0.5f));
+    t.rgb.assign(size_t(w) * h * 3, 0);
+    for (int y = 0; y < h; ++y) {
+        int sy0 = int(int64_t(y) * H / h), sy1 = std::max(sy0 + 1, int(int64_t(y + 1) * H / h));
+        for (int x = 0; x < w; ++x) {
+            int sx0 = int(int64_t(x) * W / w), sx1 = std::max(sx0 + 1, int(int64_t(x + 1) * W / w));
+            unsigned sum[3] = { 0, 0, 0 };
+            for (int yy = sy0; yy < sy1; ++yy)
+                for (int xx = sx0; xx < sx1; ++xx) {
+                    const unsigned char* p = src.pixels.data() + (size_t(yy) * W + xx) * C;
+                    for (int c = 0; c < 3; ++c) sum[c] += p[C < 3 ? 0 : c];
+                }
+            unsigned n = unsigned((sy1 - sy0) * (sx1 - sx0));
+            for (int c = 0; c < 3; ++c)
+                t.rgb[(size_t(y) * w + x) * 3 + c] = (unsigned char)((sum[c] + n / 2) / n);
+        }
+    }
+    t.width = w; t.height = h;
+}
+
+// kompresuje miniaturę do wpisu pamięci podręcznej (jpeg_mem_dest)
+static bool encodeThumbnail(Thumbnail& t) {
+    jpeg_compress_struct cinfo = {};
+    JpegErrorMgr jerr;
+    unsigned char* buf = nullptr;
+    unsigned long size = 0;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpegErrorExit;
+    if (setjmp(jerr.setjmpBuffer)) {
+        jpeg_destroy_compress(&cinfo);
+        free(buf);
+        return false;
+    }
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buf, &size);
+    JpegExportOptions opt;
+    opt.quality = 80;
+    opt.optimize = false;
+    setJpegCompressParams(cinfo, t.width, t.height, 3, opt);
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = t.rgb.data() + size_t(cinfo.next_scanline) * t.width * 3;
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    t.jpeg.assign(buf, buf + size);
+    jpeg_destroy_compress(&cinfo);
+    free(buf);
+    return true;
+}
+
+// zadanie puli: wpis z pamięci podręcznej albo dekodowanie w skali 1/8 prosto z DCT
+static void buildThumbnail(const std::shared_ptr<Thumbnail>& t, const std::shared_ptr<std::atomic<bool>>& cancel) {
+    if (cancel->load(std::memory_order_relaxed)) return;
+    ImageData im;
+    if (!t->jpeg.empty()) {
+        if (decodeJpegMemory(t->jpeg.data(), t->jpeg.size(), im, 1) && im.channels == 3) {
+            t->rgb.swap(im.pixels);
+            t->width = im.width; t->height = im.height;
+            t->state.store(1, std::memory_order_release);
+            return;
+        }
+        t->jpeg.clear();        // uszkodzony wpis - budujemy od nowa
+    }
+    if (!decodePnm(t->path.c_str(), im) && !decodeJpegScaled(t->path.c_str(), im, 8)) {
+        t->state.store(-1, std::memory_order_release);
+        return;
+    }
+    makeThumbnail(im, THUMB_SIZE, *t);
+    encodeThumbnail(*t);
+    t->state.store(1, std::memory_order_release);
+}
+
+static long long fileMTime(const std::filesystem::path& p) {
+    std::error_code ec;
+    auto t = std::filesystem::last_write_time(p, ec);
+    return ec ? 0 : (long long)t.time_since_epoch().count();
+}
+
+// plik pamięci podręcznej: "PSTC", wersja, liczba wpisów, potem {nazwa, mtime, rozmiar, JPEG miniatury}
+static void loadThumbCache(const std::string& dir, std::vector<std::shared_ptr<Thumbnail>>& thumbs) {
+    MappedFile file((std::filesystem::path(dir) / THUMB_CACHE_NAME).string().c_str());
+    if (!file.valid() || file.size < 12 || memcmp(file.data, "PSTC", 4) != 0) return;
+    uint32_t version, count;
+    memcpy(&version, file.data + 4, 4);
+    memcpy(&count, file.data + 8, 4);
+    if (version != 1) return;
+
+    std::unordered_map<std::string, Thumbnail*> byName;
+    for (auto& t : thumbs) byName[std::filesystem::path(t->path).filename().string()] = t.get();
+
+    size_t pos = 12;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t nameLen, size;
+        long long mtime;
+        if (file.size - pos < 4) return;
+        memcpy(&nameLen, file.data + pos, 4); pos += 4;
+        if (file.size - pos < size_t(nameLen) + 12) return;
+        std::string name(reinterpret_cast<const char*>(file.data + pos), nameLen); pos += nameLen;
+        memcpy(&mtime, file.data + pos, 8); pos += 8;
+        memcpy(&size, file.data + pos, 4); pos += 4;
+        if (file.size - pos < size) return;
+        auto it = byName.find(name);
+        if (it != byName.end() && it->second->mtime == mtime)
+            it->second->jpeg.assign(file.data + pos, file.data + pos + size);
+        pos += size;
+    }
+}
+
+static void saveThumbCache(const FolderView& folder) {
+    // miniatury jeszcze w pracy pomijamy - ich bufor należy do wątku puli; lista raz, bo stan zmienia się w trakcie
+    std::vector<const Thumbnail*> ready;
+    for (auto& t : folder.thumbs)
+        if (t->state.load(std::memory_order_acquire) != 0 && !t->jpeg.empty()) ready.push_back(t.get());
+
+    // plik tymczasowy obok i podmiana dopiero po udanym zapisie - przerwany zapis nie psuje poprzedniej pamięci podręcznej
+    std::string fn = (std::filesystem::path(folder.dir) / THUMB_CACHE_NAME).string();
+    std::string tmp = fn + TEMP_SUFFIX;
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) { std::cerr << "Cannot write thumbnail cache: " << fn << "\n"; return; }
+    bool ok = true;
+    auto put = [&](const void* p, size_t n) { ok = ok && fwrite(p, 1, n, f) == n; };
+    uint32_t version = 1, count = uint32_t(ready.size());
+    put("PSTC", 4);
+    put(&version, 4);
+    put(&count, 4);
+    for (const Thumbnail* t : ready) {
+        std::string name = std::filesystem::path(t->path).filename().string();
+        uint32_t nameLen = uint32_t(name.size()), size = uint32_t(t->jpeg.size());
+        put(&nameLen, 4);
+        put(name.data(), nameLen);
+        put(&t->mtime, 8);
+        put(&size, 4);
+        put(t->jpeg.data(), size);
+    }
+    ok = (fclose(f) == 0) && ok;
+    if (!ok) std::cerr << "Cannot write thumbnail cache: " << fn << "\n";
+    replaceWithTemp(tmp, fn.c_str(), ok);
 }
 
-void scroll_cb(GLFWwindow*, double, double y) { g_zoomFactor *= (y > 0 ? 1.1f : 1 / 1.1f); }
-void mouse_btn_cb(GLFWwindow* win, int btn, int act, int) { if (btn == GLFW_MOUSE_BUTTON_LEFT) { g_dragging = (act == GLFW_PRESS); if (g_dragging) { glfwGetCursorPos(win, &g_dragStartX, &g_dragStartY); g_panStartX = g_panX; g_panStartY = g_panY; } } }
-void cursor_cb(GLFWwindow*, double x, double y) { if (g_dragging) { g_panX = g_panStartX + float(x - g_dragStartX); g_panY = g_panStartY - float(y - g_dragStartY); } }
-void setupGLFWCallbacks(GLFWwindow* w) { glfwSetScrollCallback(w, scroll_cb); glfwSetMouseButtonCallback(w, mouse_btn_cb); glfwSetCursorPosCallback(w, cursor_cb); }
+// --- metadane -------------------------------------------------------------
 
-void initImGui(GLFWwindow* w) { IMGUI_CHECKVERSION(); ImGui::CreateContext(); ImGui::StyleColorsDark(); ImGui_ImplGlfw_InitForOpenGL(w, true); ImGui_ImplOpenGL3_Init("#version 130"); }
-void cleanupImGui() { ImGui_ImplOpenGL3_Shutdown(); ImGui_ImplGlfw_Shutdown(); ImGui::DestroyContext(); }
+// liczby TIFF w kolejności bajtów z nagłówka EXIF (II - little endian, MM - big endian)
+static unsigned exifU16(const unsigned char* p, bool le) { return le ? p[0] | p[1] << 8 : p[0] << 8 | p[1]; }
+static unsigned exifU32(const unsigned char* p, bool le) {
+    return le ? p[0] | p[1] << 8 | p[2] << 16 | unsigned(p[3]) << 24 : unsigned(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
 
-// ==================== image load =================================
-bool loadImageFromFile(ImageData& img) {
-    const char* filters[] = { "*.jpg" };
-    const char* fn = tinyfd_openFileDialog("Select image", "", 1, filters, "Images", 0);
-    if (!fn) { std::cerr << "No file selected\n"; return false; }
-    int w, h, ch;
-    
-    unsigned char* data = stbi_load(fn, &w, &h, &ch, 0);
-    if (!data) { std::cerr << "Load failed\n"; return false; }
-    img.width = w; img.height = h; img.channels = ch;
-    img.pixels.assign(data, data + w * h * ch);
-    stbi_image_free(data);
-    uploadTexture(img);
-    computeHistograms(img);
-    return img.textureID != 0;
+// przechodzi po wpisach IFD pod offsetem off; onTag(tag, typ, liczba, wskaźnik na pole wartości)
+template <class F>
+static void walkExifIfd(const unsigned char* t, size_t n, size_t off, bool le, F onTag) {
+    if (off + 2 > n) return;
+    unsigned count = exifU16(t + off, le);
+    for (unsigned i = 0; i < count; ++i) {
+        size_t e = off + 2 + size_t(i) * 12;
+        if (e + 12 > n) return;
+        onTag(exifU16(t + e, le), exifU16(t + e + 2, le), exifU32(t + e + 4, le), t + e + 8);
+    }
 }
 
-void cleanupImage(ImageData& img) { if (img.textureID) { glDeleteTextures(1, &img.textureID); img.textureID = 0; } img.pixels.clear(); }
+// orientacja (0x0112) i czas wykonania (0x9003 w podkatalogu EXIF, awaryjnie 0x0132) z segmentu APP1
+static void parseExif(const unsigned char* d, size_t n, ImageInfo& info) {
+    if (n < 14 || memcmp(d, "Exif\0\0", 6) != 0) return;
+    const unsigned char* t = d + 6;
+    n -= 6;
+    bool le = (t[0] == 'I' && t[1] == 'I');
+    if (!le && !(t[0] == 'M' && t[1] == 'M')) return;
+    if (exifU16(t + 2, le) != 42) return;
+
+    // łańcuch ASCII dłuższy niż 4 bajty leży pod offsetem zapisanym w polu wartości
+    auto ascii = [&](unsigned type, unsigned count, const unsigned char* v) {
+        if (type != 2 || count < 20) return std::string();
+        size_t off = exifU32(v, le);
+        if (off + 19 > n) return std::string();
+        return std::string(reinterpret_cast<const char*>(t + off), 19);
+    };
 
-void uploadTexture(ImageData& img) {
-    if (!img.textureID) glGenTextures(1, &img.textureID);
-    glBindTexture(GL_TEXTURE_2D, img.textureID);
+    size_t exifIfd = 0;
+    std::string dateTime;
+    walkExifIfd(t, n, exifU32(t + 4, le), le, [&](unsigned tag, unsigned type, unsigned count, const unsigned char* v) {
+        if (tag == 0x0112 && type == 3) info.orientation = int(exifU16(v, le));
+        else if (tag == 0x0132) dateTime = ascii(type, count, v);
+        else if (tag == 0x8769) exifIfd = exifU32(v, le);
+    });
+    if (exifIfd)
+        walkExifIfd(t, n, exifIfd, le, [&](unsigned tag, unsigned type, unsigned count, const unsigned char* v) {
+            if (tag == 0x9003) info.captureTime = ascii(type, count, v);
+        });
+    if (info.captureTime.empty()) info.captureTime = dateTime;
+    if (info.orientation < 1 || info.orientation > 8) info.orientation = 1;
+}
 
-    // filtering & alignment
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+// czyta tylko nagłówek: jpeg_read_header (z zachowaniem APP1) albo nagłówek PNM
+bool readImageInfo(const char* fn, ImageInfo& info) {
+    MappedFile file(fn);
+    if (!file.valid()) return false;
 
-    // ——— swizzle gray → RGB
-    if (img.channels == 1) {
-#ifndef GL_TEXTURE_SWIZZLE_R
-        // define these once at the top of your file if missing:
-#define GL_TEXTURE_SWIZZLE_R 0x8E42
-#define GL_TEXTURE_SWIZZLE_G 0x8E43
-#define GL_TEXTURE_SWIZZLE_B 0x8E44
-#define GL_TEXTURE_SWIZZLE_A 0x8E45
-#endif
+    int w, h, C;
+    size_t pos;
+    if (parsePnmHeader(file, w, h, C, pos)) {
+        info.width = w; info.height = h; info.components = C;
+        return true;
+    }
+
+    jpeg_decompress_struct cinfo;
+    JpegErrorMgr jerr;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = jpegErrorExit;
+    if (setjmp(jerr.setjmpBuffer)) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, GL_RED);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_RED);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A, GL_ONE);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<unsigned char*>(file.data), (unsigned long)file.size);
+    jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xFFFF);
+    jpeg_read_header(&cinfo, TRUE);
+
+    info.width = int(cinfo.image_width);
+    info.height = int(cinfo.image_height);
+    info.components = cinfo.num_components;
+    info.progressive = cinfo.progressive_mode != 0;
+    for (int c = 0; c < std::min(cinfo.num_components, 3); ++c) {
+        info.hSamp[c] = cinfo.comp_info[c].h_samp_factor;
+        info.vSamp[c] = cinfo.comp_info[c].v_samp_factor;
     }
+    for (jpeg_saved_marker_ptr m = cinfo.marker_list; m; m = m->next)
+        if (m->marker == JPEG_APP0 + 1) parseExif(m->data, m->data_length, info);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
 
-    // choose the right format
-    GLenum fmt = (img.channels == 1 ? GL_RED
-        : img.channels == 3 ? GL_RGB
-        : GL_RGBA);
+// "4:2:0" itd. dla typowych układów YCbCr, inaczej współczynniki luminancji
+static std::string samplingLabel(const ImageInfo& info) {
+    if (info.components != 3) return info.components == 1 ? "gray" : std::to_string(info.components) + " comp";
+    int h = info.hSamp[0] / std::max(1, info.hSamp[1]), v = info.vSamp[0] / std::max(1, info.vSamp[1]);
+    if (h == 1 && v == 1) return "4:4:4";
+    if (h == 2 && v == 1) return "4:2:2";
+    if (h == 2 && v == 2) return "4:2:0";
+    return std::to_string(info.hSamp[0]) + "x" + std::to_string(info.vSamp[0]);
+}
 
-    // upload the pixels
-    glTexImage2D(GL_TEXTURE_2D,
-        0,      // mipmap level
-        fmt,    // internal format
-        img.width, img.height,
-        0,      // border
-        fmt,    // source pixel format
-        GL_UNSIGNED_BYTE,
-        img.pixels.data());
+// układa widoczne pliki według sortMode/showMode; do czasu skanu metadanych - kolejność nazw
+static void rebuildFolderOrder() {
+    std::vector<int>& order = g_folder.order;
+    order.clear();
+    for (int i = 0; i < int(g_folder.thumbs.size()); ++i) {
+        const Thumbnail& t = *g_folder.thumbs[i];
+        if (g_folder.showMode != 0 && t.infoState.load(std::memory_order_acquire) == 1) {
+            bool swap = t.info.orientation >= 5;
+            int w = swap ? t.info.height : t.info.width, h = swap ? t.info.width : t.info.height;
+            if ((g_folder.showMode == 1) != (w >= h)) continue;
+        }
+        order.push_back(i);
+    }
+    if (!g_folder.infoScanned || g_folder.sortMode == 0) return;
+
+    auto& th = g_folder.thumbs;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        const ImageInfo& A = th[a]->info;
+        const ImageInfo& B = th[b]->info;
+        if (g_folder.sortMode == 1) {
+            // pliki bez daty na końcu
+            if (A.captureTime.empty() != B.captureTime.empty()) return B.captureTime.empty();
+            return A.captureTime < B.captureTime;
+        }
+        return int64_t(A.width) * A.height > int64_t(B.width) * B.height;
+    });
 }
 
-void computeHistograms(ImageData& img) {
-    const int bins = 256;
-    size_t nPixels = img.width * img.height;
-    const unsigned char* p = img.pixels.data();
+// listuje JPEG/PNM w katalogu, podpina pamięć podręczną i zleca puli odczyt nagłówków oraz brakujące miniatury
+bool openFolder(const char* dir) {
+    closeFolder();
+
+    std::error_code ec;
+    std::vector<std::filesystem::path> files;
+    for (const auto& e : std::filesystem::directory_iterator(dir, ec)) {
+        if (!e.is_regular_file(ec)) continue;
+        std::string ext = e.path().extension().string();
+        for (char& c : ext) c = char(tolower((unsigned char)c));
+        if (ext == ".jpg" || ext == ".jpeg" || ext == ".ppm" || ext == ".pgm")
+            files.push_back(e.path());
+    }
+    if (ec) { std::cerr << "Cannot list folder: " << dir << "\n"; return false; }
+    std::sort(files.begin(), files.end());
+
+    g_folder.dir = dir;
+    g_folder.cancel = std::make_shared<std::atomic<bool>>(false);
+    for (const auto& p : files) {
+        auto t = std::make_shared<Thumbnail>();
+        t->path = p.string();
+        t->mtime = fileMTime(p);
+        g_folder.thumbs.push_back(t);
+    }
+    loadThumbCache(g_folder.dir, g_folder.thumbs);
+    rebuildFolderOrder();
+
+    // nagłówki najpierw - są tanie, a od nich zależy sortowanie i budżet pamięci
+    for (auto& t : g_folder.thumbs)
+        g_pool.submit([t, cancel = g_folder.cancel]() {
+            if (cancel->load(std::memory_order_relaxed)) return;
+            bool ok = readImageInfo(t->path.c_str(), t->info);
+            t->infoState.store(ok ? 1 : -1, std::memory_order_release);
+        });
+    for (auto& t : g_folder.thumbs) {
+        if (t->jpeg.empty()) g_folder.cacheDirty = true;
+        g_pool.submit([t, cancel = g_folder.cancel]() { buildThumbnail(t, cancel); });
+    }
+    return true;
+}
 
-    img.histGray.assign(bins, 0.0f);
-    img.histR   .assign(bins, 0.0f);
-    img.histG   .assign(bins, 0.0f);
-    img.histB   .assign(bins, 0.0f);
+void closeFolder() {
+    if (g_folder.cancel) g_folder.cancel->store(true);
+    if (g_folder.cacheDirty) saveThumbCache(g_folder);
+    for (auto& t : g_folder.thumbs)
+        if (t->textureID) glDeleteTextures(1, &t->textureID);
+    g_folder = FolderView();
+}
 
-    size_t idx = 0;
-    if (img.channels == 1) {
-        // grayscale
-        for (size_t i = 0; i < nPixels; ++i) {
-            unsigned char v = p[idx++];
-            img.histGray[v] += 1.0f;
-        }
+// wysyła gotowe miniatury jako tekstury (limit na klatkę), po ostatniej zapisuje pamięć podręczną; true - pasek się zmienił
+bool pollFolderThumbnails() {
+    int uploads = 0, pending = 0, infoPending = 0;
+    for (auto& t : g_folder.thumbs) {
+        if (t->infoState.load(std::memory_order_acquire) == 0) ++infoPending;
+        int st = t->state.load(std::memory_order_acquire);
+        if (st == 0) ++pending;
+        if (st != 1 || uploads >= 32) continue;
+        glGenTextures(1, &t->textureID);
+        glBindTexture(GL_TEXTURE_2D, t->textureID);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, t->width, t->height, 0, GL_RGB, GL_UNSIGNED_BYTE, t->rgb.data());
+        std::vector<unsigned char>().swap(t->rgb);
+        t->state.store(2, std::memory_order_relaxed);
+        ++uploads;
+    }
+    bool changed = uploads > 0;
+    if (infoPending == 0 && !g_folder.infoScanned && !g_folder.thumbs.empty()) {
+        g_folder.infoScanned = true;
+        rebuildFolderOrder();
+        changed = true;
+    }
+    if (pending == 0 && g_folder.cacheDirty) {
+        saveThumbCache(g_folder);
+        g_folder.cacheDirty = false;
+    }
+    return changed;
+}
+
+// pasek miniatur u dołu obszaru obrazu; clicked dostaje indeks klikniętego pliku
+void renderFilmstrip(int winW, int winH, int& clicked) {
+    if (g_folder.thumbs.empty()) return;
+    ImGui::SetNextWindowPos(ImVec2(0, float(winH - FILMSTRIP_HEIGHT)));
+    ImGui::SetNextWindowSize(ImVec2(float(winW - RIGHT_BAR_WIDTH), float(FILMSTRIP_HEIGHT)));
+    ImGui::Begin("Filmstrip", nullptr,
+        ImGuiWindowFlags_NoResize |
+        ImGuiWindowFlags_NoMove |
+        ImGuiWindowFlags_NoCollapse |
+        ImGuiWindowFlags_HorizontalScrollbar);
+    // sortowanie/filtr i szacunek pamięci z samych nagłówków
+    const char* sortItems[] = { "Name", "Capture time", "Megapixels" };
+    const char* showItems[] = { "All", "Landscape", "Portrait" };
+    ImGui::SetNextItemWidth(130);
+    bool reorder = ImGui::Combo("Sort", &g_folder.sortMode, sortItems, 3);
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(110);
+    reorder |= ImGui::Combo("Show", &g_folder.showMode, showItems, 3);
+    if (reorder) rebuildFolderOrder();
+    ImGui::SameLine();
+    if (!g_folder.infoScanned) {
+        int done = 0;
+        for (auto& t : g_folder.thumbs) done += (t->infoState.load(std::memory_order_relaxed) != 0);
+        ImGui::Text("%d files, reading headers %d/%d", int(g_folder.thumbs.size()), done, int(g_folder.thumbs.size()));
     }
     else {
-        // RGB / RGBA
-        for (size_t i = 0; i < nPixels; ++i) {
-            unsigned char r = p[idx++];
-            unsigned char g = p[idx++];
-            unsigned char b = p[idx++];
-            if (img.channels == 4) {
-                //skip alpha
-                idx++;
-            }
-            img.histR[r] += 1.0f;
-            img.histG[g] += 1.0f;
-            img.histB[b] += 1.0f;
+        double fullMB = 0, proxyMB = 0;
+        for (int i : g_folder.order) {
+            const ImageInfo& in = g_folder.thumbs[i]->info;
+            double bytes = double(in.width) * in.height * (in.components == 1 ? 1 : 3);
+            int d = chooseProxyScale(in.width, in.height);
+            fullMB += bytes / (1 << 20);
+            proxyMB += bytes / (double(d) * d) / (1 << 20);
         }
+        ImGui::Text("%d files, decoded %.0f MB (working proxies %.0f MB)", int(g_folder.order.size()), fullMB, proxyMB);
     }
 
-    float maxGray = 0.0f, maxR = 0.0f, maxG = 0.0f, maxB = 0.0f;
-    if (img.channels == 1) {
-        for (int i = 0; i < bins; ++i) {
-            if (img.histGray[i] > maxGray)
-                maxGray = img.histGray[i];
+    float side = FILMSTRIP_HEIGHT - 90.0f;
+    for (int k = 0; k < int(g_folder.order.size()); ++k) {
+        int i = g_folder.order[k];
+        const Thumbnail& t = *g_folder.thumbs[i];
+        if (k > 0) ImGui::SameLine();
+        ImGui::PushID(i);
+        bool selected = (i == g_folder.current);
+        if (selected) ImGui::PushStyleColor(ImGuiCol_Button, ImGui::GetStyleColorVec4(ImGuiCol_ButtonActive));
+        bool hit;
+        if (t.textureID) {
+            float s = side / float(std::max(t.width, t.height));
+            hit = ImGui::ImageButton("thumb", (ImTextureID)(uintptr_t)t.textureID, ImVec2(t.width * s, t.height * s));
+        }
+        else {
+            hit = ImGui::Button(t.state.load() < 0 ? "error" : "...", ImVec2(side, side));
+        }
+        if (selected) ImGui::PopStyleColor();
+        if (ImGui::IsItemHovered()) {
+            if (t.infoState.load(std::memory_order_acquire) == 1)
+                ImGui::SetTooltip("%s\n%dx%d, %s%s, orientation %d\n%s", t.path.c_str(), t.info.width, t.info.height,
+                    samplingLabel(t.info).c_str(), t.info.progressive ? ", progressive" : "", t.info.orientation,
+                    t.info.captureTime.empty() ? "no capture time" : t.info.captureTime.c_str());
+            else
+                ImGui::SetTooltip("%s", t.path.c_str());
         }
+        if (hit) clicked = i;
+        if (selected && g_folder.scrollToCurrent) {
+            ImGui::SetScrollHereX(0.5f);
+            g_folder.scrollToCurrent = false;
+        }
+        ImGui::PopID();
     }
-    else {
-        for (int i = 0; i < bins; ++i) {
-            if (img.histR[i] > maxR) maxR = img.histR[i];
-            if (img.histG[i] > maxG) maxG = img.histG[i];
-            if (img.histB[i] > maxB) maxB = img.histB[i];
+    ImGui::End();
+}
+
+// obraz roboczy tak jak przy zwykłym otwarciu: PNM wprost albo podgląd JPEG w skali DCT
+static bool decodeWorkingImage(const char* fn, ImageData& img) {
+    img.path = fn;
+    return decodePnm(fn, img) || decodeJpegScaled(fn, img, 0);
+}
+
+// zleca dekodowanie sąsiadów index (±PREFETCH_RADIUS), których nie ma jeszcze w LRU
+static void prefetchAround(int index) {
+    const std::vector<int>& order = g_folder.order;
+    int pos = int(std::find(order.begin(), order.end(), index) - order.begin());
+    if (pos == int(order.size())) return;
+    for (int d = 1; d <= PREFETCH_RADIUS; ++d) {
+        for (int k : { pos + d, pos - d }) {
+            if (k < 0 || k >= int(order.size())) continue;
+            const std::string& path = g_folder.thumbs[order[k]]->path;
+            auto it = std::find_if(g_folder.prefetch.begin(), g_folder.prefetch.end(),
+                [&](const std::shared_ptr<PrefetchEntry>& e) { return e->path == path; });
+            if (it != g_folder.prefetch.end()) continue;
+            auto e = std::make_shared<PrefetchEntry>();
+            e->path = path;
+            g_folder.prefetch.push_back(e);     // na końcu LRU - dopóki nie zostanie użyty
+            g_pool.submit([e, cancel = g_folder.cancel]() {
+                if (cancel->load(std::memory_order_relaxed)) return;
+                bool ok = decodeWorkingImage(e->path.c_str(), e->image);
+                e->state.store(ok ? 1 : -1, std::memory_order_release);
+            }, true);
         }
     }
 }
 
+// indeks pliku o step pozycji dalej w kolejności wyświetlania (-1 poza zakresem)
+int folderNeighbour(int step) {
+    const std::vector<int>& order = g_folder.order;
+    if (order.empty()) return -1;
+    int pos = int(std::find(order.begin(), order.end(), g_folder.current) - order.begin());
+    if (pos == int(order.size())) return order.front();
+    pos = std::clamp(pos + step, 0, int(order.size()) - 1);
+    return order[pos];
+}
+
+// otwiera plik index z folderu: gotowy obraz z LRU to tylko kopia i jedno wysłanie tekstury
+bool openFolderImage(int index, ImageData& img) {
+    if (index < 0 || index >= int(g_folder.thumbs.size())) return false;
+    g_folder.current = index;
+    g_folder.scrollToCurrent = true;
+    const std::string& path = g_folder.thumbs[index]->path;
+
+    auto it = std::find_if(g_folder.prefetch.begin(), g_folder.prefetch.end(),
+        [&](const std::shared_ptr<PrefetchEntry>& e) { return e->path == path; });
+    bool hit = (it != g_folder.prefetch.end() && (*it)->state.load(std::memory_order_acquire) == 1);
+    if (hit) {
+        g_folder.prefetch.splice(g_folder.prefetch.begin(), g_folder.prefetch, it);
+        cancelImageLoad();
+        const ImageData& src = g_folder.prefetch.front()->image;
+        img.width = src.width; img.height = src.height; img.channels = src.channels;
+        img.pixels = src.pixels;
+        img.luma = src.luma;
+        img.path = src.path;
+        img.scaleDenom = src.scaleDenom;
+        img.fullWidth = src.fullWidth; img.fullHeight = src.fullHeight;
+        img.mcuWidth = src.mcuWidth; img.mcuHeight = src.mcuHeight;
+        uploadTexture(img);
+        computeHistograms(img);
+    }
+    else {
+        // tekstura zostaje: kolejne zdjęcie tego samego rozmiaru tylko ją aktualizuje
+        img.pixels.clear(); img.luma.clear();
+        if (!startImageLoad(path.c_str(), img)) { cleanupImage(img); return false; }
+    }
+    prefetchAround(index);
+    return true;
+}
+
+// dolicza gotowe obrazy do budżetu i usuwa najdawniej używane ponad PREFETCH_BUDGET; true - któryś właśnie dotarł
+bool pollPrefetch() {
+    bool arrived = false;
+    for (auto& e : g_folder.prefetch) {
+        if (e->counted || e->state.load(std::memory_order_acquire) == 0) continue;
+        e->counted = arrived = true;
+        g_folder.prefetchBytes += e->image.pixels.size();
+    }
+    for (auto it = g_folder.prefetch.end(); g_folder.prefetchBytes > PREFETCH_BUDGET && it != g_folder.prefetch.begin(); ) {
+        --it;
+        if (!(*it)->counted) continue;      // jeszcze w dekodowaniu
+        g_folder.prefetchBytes -= (*it)->image.pixels.size();
+        it = g_folder.prefetch.erase(it);
+    }
+    return arrived;
+}
+
 // =================== VIEW SETUP / RENDER ===================================
 void setupProjection(int w, int h) { glViewport(0, 0, w, h); glMatrixMode(GL_PROJECTION); glLoadIdentity(); glOrtho(0, w, 0, h, -1, 1); glMatrixMode(GL_MODELVIEW); glLoadIdentity(); }
-void resetViewForImage(const ImageData& img, int winW, int winH) { g_zoomFactor = 1.0f; int cw = winW - RIGHT_BAR_WIDTH, ch = winH - TOP_BAR_HEIGHT; g_panX = (cw - img.width) * 0.5f; g_panY = (ch - img.height) * 0.5f; }
+void resetViewForImage(const ImageData& img, int winW, int winH) { g_zoomFactor = (g_loadJob.pending ? float(g_loadJob.targetWidth) / img.width : 1.0f); int cw = winW - RIGHT_BAR_WIDTH, ch = winH - TOP_BAR_HEIGHT; g_panX = (cw - img.width * g_zoomFactor) * 0.5f; g_panY = (ch - img.height * g_zoomFactor) * 0.5f; }
+
+// widoczna część obrazu w pikselach obrazu (y od góry) przy bieżącym przesunięciu i powiększeniu
+void visibleImageArea(const ImageData& img, int winW, int winH, float& ix0, float& iy0, float& ix1, float& iy1) {
+    ix0 = -g_panX / g_zoomFactor;
+    ix1 = (winW - g_panX) / g_zoomFactor;
+    iy0 = img.height - (winH - TOP_BAR_HEIGHT - g_panY) / g_zoomFactor;
+    iy1 = img.height - (-TOP_BAR_HEIGHT - g_panY) / g_zoomFactor;
+}
 
-void renderImage(const ImageData& img, int winW, int winH) {
-    if (!img.textureID) return; int regionW = winW - RIGHT_BAR_WIDTH; int regionH = winH - TOP_BAR_HEIGHT;
+void renderImage(ImageData& img, int winW, int winH) {
+    if (!img.display.width) return; int regionW = winW - RIGHT_BAR_WIDTH; int regionH = winH - TOP_BAR_HEIGHT;
     float dispW = img.width * g_zoomFactor, dispH = img.height * g_zoomFactor;
 
     if (dispW < regionW)
@@ -250,16 +3450,28 @@ void renderImage(const ImageData& img, int winW, int winH) {
     else
         g_panY = std::max(regionH - dispH, std::min(g_panY, 0.0f));
 
+    // tylko kafelki widocznej części trafiają na GPU
+    float ix0, iy0, ix1, iy1;
+    g_viewW = winW; g_viewH = winH;
+    visibleImageArea(img, winW, winH, ix0, iy0, ix1, iy1);
+
+    glPushMatrix(); glTranslatef(g_panX, TOP_BAR_HEIGHT + g_panY, 0); glScalef(g_zoomFactor, g_zoomFactor, 1);
+    drawVisibleTiles(img, g_zoomFactor, ix0, iy0, ix1, iy1);
+    glPopMatrix();
+}
+
+// ramka zaznaczenia (x, y, w, h w pikselach obrazu) rysowana nad obrazem
+void renderSelection(const ImageData& img, int x, int y, int w, int h) {
     glPushMatrix(); glTranslatef(g_panX, TOP_BAR_HEIGHT + g_panY, 0); glScalef(g_zoomFactor, g_zoomFactor, 1);
-    glEnable(GL_TEXTURE_2D); glBindTexture(GL_TEXTURE_2D, img.textureID);
-    glBegin(GL_QUADS);
-    glTexCoord2f(0, 1); glVertex2i(0, 0); glTexCoord2f(1, 1); glVertex2i(img.width, 0);
-    glTexCoord2f(1, 0); glVertex2i(img.width, img.height); glTexCoord2f(0, 0); glVertex2i(0, img.height);
-    glEnd(); glDisable(GL_TEXTURE_2D); glPopMatrix();
+    glColor3f(1.0f, 0.8f, 0.0f); glLineWidth(2.0f);
+    glBegin(GL_LINE_LOOP);
+    glVertex2i(x, img.height - y); glVertex2i(x + w, img.height - y);
+    glVertex2i(x + w, img.height - y - h); glVertex2i(x, img.height - y - h);
+    glEnd(); glColor3f(1.0f, 1.0f, 1.0f); glLineWidth(1.0f); glPopMatrix();
 }
 
 void renderHistogram(const ImageData& img) {
-    if (!img.textureID) return;
+    if (img.histGray.empty()) return;
 
     // detect gray vs color
     bool isGray = (img.channels == 1);
@@ -306,6 +3518,27 @@ void renderHistogram(const ImageData& img) {
     }
 }
 
+// ekspozycja pliku źródłowego ze współczynników DC - liczona w tle raz na plik, niezależnie od edycji
+void renderDcStats(const ImageData& img) {
+    if (img.path.empty() || isPnmPath(img.path.c_str())) return;
+    if (!g_dcStats || g_dcStats->path != img.path) {
+        g_dcStats = std::make_shared<DcStatsJob>();
+        g_dcStats->path = img.path;
+        g_pool.submit([job = g_dcStats]() {
+            bool ok = readJpegDcStats(job->path.c_str(), job->stats);
+            job->state.store(ok ? 1 : -1, std::memory_order_release);
+        }, true);
+    }
+
+    int state = g_dcStats->state.load(std::memory_order_acquire);
+    if (state == 0) { ImGui::Text("Source exposure: reading DC coefficients..."); return; }
+    if (state < 0) return;
+    const DcStats& s = g_dcStats->stats;
+    float maxCount = *std::max_element(s.hist.begin(), s.hist.end());
+    ImGui::Text("Source exposure (DC of %lld blocks): mean %.1f", s.blocks, s.mean);
+    ImGui::PlotHistogram("##DC", s.hist.data(), 256, 0, nullptr, 0.0f, maxCount, ImVec2(512, 80));
+}
+
 bool isBinaryImage(const ImageData& img)
 {
     for (unsigned char v : img.pixels)
@@ -317,7 +3550,7 @@ bool isBinaryImage(const ImageData& img)
 
 // obcina wartości wszystkich kanałów do przedziału [lo..hi]
 void clampImage(ImageData& img, int lo, int hi) {
-    size_t nPixels = img.width * img.height;
+    size_t nPixels = size_t(img.width) * img.height;
     int C = img.channels;
     for (size_t i = 0; i < nPixels; ++i) {
         size_t idx = i * C;
@@ -343,13 +3576,13 @@ void clampImage(ImageData& img, int lo, int hi) {
 // skaluje każdy kanał niezależnie tak, aby min = newLo, max = newHi
 void normalizeImagePerChannel(ImageData& img, int newLo, int newHi) {
     int C = img.channels;
-    int nPixels = img.width * img.height;
+    size_t nPixels = size_t(img.width) * img.height;
 
     for (int ch = 0; ch < C; ++ch) {
         // minmax dla kanału
         int minV = 255, maxV = 0;
-        for (int i = 0; i < nPixels; ++i) {
-            int idx = i * C + ch;
+        for (size_t i = 0; i < nPixels; ++i) {
+            size_t idx = i * C + ch;
             unsigned char v = img.pixels[idx];
             if (v < minV) minV = v;
             if (v > maxV) maxV = v;
@@ -360,8 +3593,8 @@ void normalizeImagePerChannel(ImageData& img, int newLo, int newHi) {
 
         // skaluj każdy piksel w tym kanale do [newLo..newHi]
         float scale = float(newHi - newLo) / float(maxV - minV);
-        for (int i = 0; i < nPixels; ++i) {
-            int idx = i * C + ch;
+        for (size_t i = 0; i < nPixels; ++i) {
+            size_t idx = i * C + ch;
             int v = img.pixels[idx];
             int mapped = int((v - minV) * scale + newLo + 0.5f);
             if (mapped < 0)      mapped = 0;
@@ -395,11 +3628,11 @@ void contrastImage(ImageData& img, float factor) {
 // rozciąga histogram liniowo pomiędzy percentylami pLow i pHigh
 void stretchHistogram(ImageData& img, float pLow = 0.01f, float pHigh = 0.99f) {
     int W = img.width, H = img.height, C = img.channels;
-    int N = W * H;
+    size_t N = size_t(W) * H;
 
     // tablica histogramów dla każdego kanału
     std::vector<std::vector<int>> hist(C, std::vector<int>(256, 0));
-    for (int i = 0, idx = 0; i < N; ++i) {
+    for (size_t i = 0, idx = 0; i < N; ++i) {
         for (int ch = 0; ch < C; ++ch, ++idx) {
             ++hist[ch][img.pixels[idx]];
         }
@@ -432,7 +3665,7 @@ void stretchHistogram(ImageData& img, float pLow = 0.01f, float pHigh = 0.99f) {
     }
 
     // przeskalowanie wartości pikseli: obcięcie do [lo..hi], a następnie rozciągnięcie do [0..255]
-    for (int i = 0, idx = 0; i < N; ++i) {
+    for (size_t i = 0, idx = 0; i < N; ++i) {
         for (int ch = 0; ch < C; ++ch, ++idx) {
             int v = img.pixels[idx];
             if (v <= lo[ch])      v = lo[ch];
@@ -444,15 +3677,22 @@ void stretchHistogram(ImageData& img, float pLow = 0.01f, float pHigh = 0.99f) {
     }
 }
 
+// jasność gotowa bez konwersji: piksele obrazu szarego albo Y z dekodera JPEG; nullptr - trzeba liczyć z RGB
+static const unsigned char* lumaPlane(const ImageData& img) {
+    if (img.channels == 1) return img.pixels.data();
+    return img.luma.size() == size_t(img.width) * img.height ? img.luma.data() : nullptr;
+}
+
 // binaryzuje obraz progiem T
 void thresholdManual(ImageData& img, int T) {
     int C = img.channels;
-    size_t nPixels = img.width * img.height;
+    size_t nPixels = size_t(img.width) * img.height;
+    const unsigned char* Y = lumaPlane(img);
     for (size_t i = 0; i < nPixels; ++i) {
         size_t idx = i * C;
         unsigned char gray;
-        if (C == 1) {
-            gray = img.pixels[idx];
+        if (Y) {
+            gray = Y[i];
         }
         else {
             gray = static_cast<unsigned char>(
@@ -474,13 +3714,14 @@ void thresholdManual(ImageData& img, int T) {
 int computeAutoMinThreshold(const ImageData& img) {
     // budowanie histogramu
     std::vector<float> hist(256, 0.0f);
-    size_t n = img.width * img.height;
+    size_t n = size_t(img.width) * img.height;
     size_t idx = 0;
+    const unsigned char* Y = lumaPlane(img);
 
     for (size_t i = 0; i < n; ++i) {
         unsigned char g;
-        if (img.channels == 1) {
-            g = img.pixels[idx++];
+        if (Y) {
+            g = Y[i];
         }
         else {
             g = static_cast<unsigned char>(
@@ -556,18 +3797,19 @@ int otsuThreshold(const std::vector<float>& hist, size_t total) {
 
 // binaryzuje obraz przy użyciu progu wyznaczonego metodą Otsu
 void thresholdOtsu(ImageData& img) {
-    size_t nPixels = img.width * img.height;
+    size_t nPixels = size_t(img.width) * img.height;
 
     // histogram poziomów szarości
     std::vector<float> hist(256, 0.0f);
 
     // konwersja na jeden kanal szarosci
     int C = img.channels;
+    const unsigned char* Y = lumaPlane(img);
     for (size_t i = 0; i < nPixels; ++i) {
         size_t idx = i * C;
         unsigned char gray;
-        if (C == 1) {
-            gray = img.pixels[idx];
+        if (Y) {
+            gray = Y[i];
         }
         else {
             gray = static_cast<unsigned char>(
@@ -585,9 +3827,11 @@ void thresholdOtsu(ImageData& img) {
 
 // dopuszcza piksele w przedziale [T1..T2), resztę ustawia na zero
 void thresholdDouble(ImageData& img, int T1, int T2) {
-    int C = img.channels, n = img.width * img.height;
-    for (int i = 0, idx = 0; i < n; ++i, idx += C) {
-        unsigned char gray = (C == 1 ? img.pixels[idx]
+    int C = img.channels;
+    size_t n = size_t(img.width) * img.height;
+    const unsigned char* Y = lumaPlane(img);
+    for (size_t i = 0, idx = 0; i < n; ++i, idx += C) {
+        unsigned char gray = (Y ? Y[i]
             : static_cast<unsigned char>(0.299f * img.pixels[idx]
                 + 0.587f * img.pixels[idx + 1]
                     + 0.114f * img.pixels[idx + 2] + 0.5f));
@@ -603,12 +3847,13 @@ void thresholdHysteresis(ImageData& img, int T_low, int T_high) {
     int w = img.width;
     int h = img.height;
     int C = img.channels;
-    int N = w * h;
+    size_t N = size_t(w) * h;
 
     std::vector<unsigned char> gray(N);
-    for (int i = 0, idx = 0; i < N; ++i, idx += C) {
-        if (C == 1) {
-            gray[i] = img.pixels[idx];
+    const unsigned char* Y = lumaPlane(img);
+    for (size_t i = 0, idx = 0; i < N; ++i, idx += C) {
+        if (Y) {
+            gray[i] = Y[i];
         }
         else {
             gray[i] = static_cast<unsigned char>(0.299f * img.pixels[idx] + 0.587f * img.pixels[idx + 1] + 0.114f * img.pixels[idx + 2] + 0.5f);
@@ -617,7 +3862,7 @@ void thresholdHysteresis(ImageData& img, int T_low, int T_high) {
 
     // wstępne oznaczenie: 0 - wyłączony, 1 - słaby, 2 - silny
     std::vector<unsigned char> mark(N, 0);
-    for (int i = 0; i < N; ++i) {
+    for (size_t i = 0; i < N; ++i) {
         if (gray[i] >= T_high)      mark[i] = 2;
         else if (gray[i] >= T_low)  mark[i] = 1;
     }
@@ -627,14 +3872,15 @@ void thresholdHysteresis(ImageData& img, int T_low, int T_high) {
     while (changed) {
         changed = false;
         for (int y = 1; y < h - 1; ++y) {
+            if (previewCancelled()) return;     // podgląd w tle: przyszły nowsze progi
             for (int x = 1; x < w - 1; ++x) {
-                int i = y * w + x;
+                size_t i = size_t(y) * w + x;
                 if (mark[i] == 1) {
                     // jeśli jest słaby, sprawdź jego 8 sąsiadów
                     for (int dy = -1; dy <= 1; ++dy) {
                         for (int dx = -1; dx <= 1; ++dx) {
                             if (dx == 0 && dy == 0) continue;
-                            int ni = (y + dy) * w + (x + dx);
+                            size_t ni = size_t(y + dy) * w + (x + dx);
                             if (mark[ni] == 2) {    // jeśli sąsiad jest silny, zamień i zaznacz zmianę
                                 mark[i] = 2;
                                 changed = true;
@@ -648,7 +3894,7 @@ void thresholdHysteresis(ImageData& img, int T_low, int T_high) {
     }
 
     // zapis do obrazu
-    for (int i = 0, idx = 0; i < N; ++i, idx += C) {
+    for (size_t i = 0, idx = 0; i < N; ++i, idx += C) {
         unsigned char v = (mark[i] == 2 ? 255 : 0);
         for (int c = 0; c < C; ++c)
             img.pixels[idx + c] = v;
@@ -661,16 +3907,17 @@ void thresholdNiblack(ImageData& img, int windowSize, float k) {
     int r = windowSize / 2;
 
     std::vector<unsigned char> orig = img.pixels;
-    std::vector<float> gray(w * h);
-    for (int i = 0, idx = 0; i < w * h; ++i, idx += C)
-        gray[i] = (C == 1 ? orig[idx] :
+    std::vector<float> gray(size_t(w) * h);
+    const unsigned char* Y = lumaPlane(img);
+    for (size_t i = 0, idx = 0, n = size_t(w) * h; i < n; ++i, idx += C)
+        gray[i] = (Y ? Y[i] :
             0.299f * orig[idx] + 0.587f * orig[idx + 1] + 0.114f * orig[idx + 2]);
 
     // sum[i]  : suma wartości jasności w oknie od (0,0) do (x,y)
     // sum2[i] : suma kwadratów wartości jasności w tym samym zakresie
-    std::vector<double> sum(w * h), sum2(w * h);
+    std::vector<double> sum(size_t(w) * h), sum2(size_t(w) * h);
     for (int y = 0; y < h; ++y) for (int x = 0; x < w; ++x) {
-        int i = y * w + x;
+        size_t i = size_t(y) * w + x;
         double v = gray[i], vsq = v * v;
 
         // S(x, y) = I(x, y) + S(x - 1, y) + S(x, y - 1) - S(x - 1, y - 1)
@@ -692,10 +3939,10 @@ void thresholdNiblack(ImageData& img, int windowSize, float k) {
         int x1 = std::min(w - 1, x + r), y1 = std::min(h - 1, y + r);
 
         // granice okna
-        int A = (y0 - 1) * w + (x0 - 1);
-        int B = (y0 - 1) * w + x1;
-        int Cc = y1 * w + (x0 - 1);
-        int D = y1 * w + x1;
+        ptrdiff_t A = ptrdiff_t(y0 - 1) * w + (x0 - 1);
+        ptrdiff_t B = ptrdiff_t(y0 - 1) * w + x1;
+        ptrdiff_t Cc = ptrdiff_t(y1) * w + (x0 - 1);
+        ptrdiff_t D = ptrdiff_t(y1) * w + x1;
 
         // obliczenie sumy wartości jasności S i sumy kwadratów S^2 w oknie
         double S = sum[D];
@@ -711,8 +3958,8 @@ void thresholdNiblack(ImageData& img, int windowSize, float k) {
 
         // T(x, y) = μ(x, y) + k * σ(x, y)
         float T = mean + k * stddev;
-        unsigned char out = (gray[y * w + x] >= T ? 255 : 0);
-        int base = (y * w + x) * C;
+        unsigned char out = (gray[size_t(y) * w + x] >= T ? 255 : 0);
+        size_t base = (size_t(y) * w + x) * C;
         for (int c = 0; c < C; ++c)
             img.pixels[base + c] = out;
     }
@@ -723,17 +3970,18 @@ void thresholdSauvola(ImageData& img, int windowSize, float k, float R) {
     int w = img.width, h = img.height, C = img.channels;
     int r = windowSize / 2;
 
-    std::vector<float> gray(w * h);
-    for (int i = 0, idx = 0; i < w * h; ++i, idx += C) {
-        gray[i] = (C == 1 ? img.pixels[idx] :
+    std::vector<float> gray(size_t(w) * h);
+    const unsigned char* Y = lumaPlane(img);
+    for (size_t i = 0, idx = 0, n = size_t(w) * h; i < n; ++i, idx += C) {
+        gray[i] = (Y ? Y[i] :
             0.299f * img.pixels[idx] + 0.587f * img.pixels[idx + 1] + 0.114f * img.pixels[idx + 2]);
     }
 
     // sum[i]  : suma wartości jasności w oknie od (0,0) do (x,y)
     // sum2[i] : suma kwadratów wartości jasności w tym samym zakresie
-    std::vector<double> sum(w * h), sum2(w * h);
+    std::vector<double> sum(size_t(w) * h), sum2(size_t(w) * h);
     for (int y = 0; y < h; ++y) for (int x = 0; x < w; ++x) {
-        int i = y * w + x;
+        size_t i = size_t(y) * w + x;
         double v = gray[i], vsq = v * v;
 
         // S(x, y) = I(x, y) + S(x - 1, y) + S(x, y - 1) - S(x - 1, y - 1)
@@ -755,10 +4003,10 @@ void thresholdSauvola(ImageData& img, int windowSize, float k, float R) {
         int x1 = std::min(w - 1, x + r), y1 = std::min(h - 1, y + r);
 
         // granice okna
-        int A = (y0 - 1) * w + (x0 - 1);
-        int B = (y0 - 1) * w + x1;
-        int Cc = y1 * w + (x0 - 1);
-        int D = y1 * w + x1;
+        ptrdiff_t A = ptrdiff_t(y0 - 1) * w + (x0 - 1);
+        ptrdiff_t B = ptrdiff_t(y0 - 1) * w + x1;
+        ptrdiff_t Cc = ptrdiff_t(y1) * w + (x0 - 1);
+        ptrdiff_t D = ptrdiff_t(y1) * w + x1;
 
         // obliczenie sumy wartości jasności S i sumy kwadratów S^2 w oknie
         double S = sum[D];
@@ -774,9 +4022,9 @@ void thresholdSauvola(ImageData& img, int windowSize, float k, float R) {
 
         // T(x, y) = μ(x, y) * (1 + k * ((σ(x,y)/R) - 1))
         double T = m * (1 + k * ((stddev / R) - 1));
-        int idx = y * w + x;
+        size_t idx = size_t(y) * w + x;
         unsigned char out = (gray[idx] >= T) ? 255 : 0;
-        int base = idx * C;
+        size_t base = idx * C;
         for (int c = 0; c < C; ++c)
             img.pixels[base + c] = out;
     }
@@ -788,9 +4036,10 @@ void thresholdWolfJolion(ImageData& img, int windowSize, float k) {
     int r = windowSize / 2;
 
     // konwersja na jeden kanal szarosci
-    std::vector<float> gray(w * h);
-    for (int i = 0, idx = 0; i < w * h; ++i, idx += C) {
-        gray[i] = (C == 1 ? img.pixels[idx] :
+    std::vector<float> gray(size_t(w) * h);
+    const unsigned char* Y = lumaPlane(img);
+    for (size_t i = 0, idx = 0, n = size_t(w) * h; i < n; ++i, idx += C) {
+        gray[i] = (Y ? Y[i] :
             0.299f * img.pixels[idx] + 0.587f * img.pixels[idx + 1] + 0.114f * img.pixels[idx + 2]);
     }
 
@@ -803,9 +4052,10 @@ void thresholdWolfJolion(ImageData& img, int windowSize, float k) {
 
     // sum[i]  : suma wartości jasności w oknie od (0,0) do (x,y)
     // sum2[i] : suma kwadratów wartości jasności w tym samym zakresie
-    std::vector<double> sum(w * h), sum2(w * h);
+    std::vector<double> sum(size_t(w) * h), sum2(size_t(w) * h);
     for (int y = 0; y < h; ++y) for (int x = 0; x < w; ++x) {
-        int i = y * w + x;
+        if (x == 0 && previewCancelled()) return;   // podgląd w tle: przyszły nowsze parametry
+        size_t i = size_t(y) * w + x;
         double v = gray[i], vsq = v * v;
 
         // S(x, y) = I(x, y) + S(x - 1, y) + S(x, y - 1) - S(x - 1, y - 1)
@@ -823,21 +4073,22 @@ void thresholdWolfJolion(ImageData& img, int windowSize, float k) {
 
     // mu[i] : średnia lokalna
     // sigma[i] : odchylenie standardowe
-    std::vector<double> mu(w * h), sigma(w * h);
+    std::vector<double> mu(size_t(w) * h), sigma(size_t(w) * h);
 
     // minimalne odchylenie w całym obrazaie
     double sigma_min = std::numeric_limits<double>::infinity();
     for (int y = 0; y < h; ++y) for (int x = 0; x < w; ++x) {
+        if (x == 0 && previewCancelled()) return;
 
         // wyznaczenie granic prostokątnego okna wokół piksela (x,y)
         int x0 = std::max(0, x - r), y0 = std::max(0, y - r);
         int x1 = std::min(w - 1, x + r), y1 = std::min(h - 1, y + r);
 
         // granice okna
-        int A = (y0 - 1) * w + (x0 - 1);
-        int B = (y0 - 1) * w + x1;
-        int Cc = y1 * w + (x0 - 1);
-        int D = y1 * w + x1;
+        ptrdiff_t A = ptrdiff_t(y0 - 1) * w + (x0 - 1);
+        ptrdiff_t B = ptrdiff_t(y0 - 1) * w + x1;
+        ptrdiff_t Cc = ptrdiff_t(y1) * w + (x0 - 1);
+        ptrdiff_t D = ptrdiff_t(y1) * w + x1;
 
         // obliczenie sumy wartości jasności S i sumy kwadratów S^2 w oknie
         double S = sum[D];
@@ -852,17 +4103,17 @@ void thresholdWolfJolion(ImageData& img, int windowSize, float k) {
         double sd = std::sqrt(std::max(0.0, var));  // odchylenie standardowe - sigma
 
         // średnia i odchylenie w pikselu (x, y)
-        int idx = y * w + x;
+        size_t idx = size_t(y) * w + x;
         mu[idx] = m;
         sigma[idx] = sd;
         sigma_min = std::min(sigma_min, sd);
     }
 
-    for (int i = 0; i < w * h; ++i) {
+    for (size_t i = 0, n = size_t(w) * h; i < n; ++i) {
         // T(x, y) = μ + k * (σ - σ_min) * ( (μ - Imin) / (Imax - Imin) )
         double T = mu[i] + k * (sigma[i] - sigma_min) * ((mu[i] - Imin) / (Imax - Imin));
         unsigned char out = (gray[i] >= T) ? 255 : 0;
-        int base = i * C;
+        size_t base = i * C;
         for (int c = 0; c < C; ++c)
             img.pixels[base + c] = out;
     }
@@ -878,6 +4129,7 @@ void erodeBinary(ImageData& img, int windowSize) {
     std::vector<unsigned char> original = img.pixels;
 
     for (int row = 0; row < H; ++row) {
+        if (previewCancelled()) return;         // podgląd w tle: przyszło nowsze okno
         for (int col = 0; col < W; ++col) {
             bool keepWhite = true;
 
@@ -888,7 +4140,7 @@ void erodeBinary(ImageData& img, int windowSize) {
                     int nx = col + dx;
                     // poprawka na granice zdjęcia
                     if (nx >= 0 && nx < W && ny >= 0 && ny < H) {
-                        int idx = (ny * W + nx) * C; 
+                        size_t idx = (size_t(ny) * W + nx) * C; 
                         if (original[idx] == 0) {
                             keepWhite = false;
                         }
@@ -898,7 +4150,7 @@ void erodeBinary(ImageData& img, int windowSize) {
 
             // ustalenie wartości piksela
             unsigned char outVal = keepWhite ? 255 : 0;
-            int base = (row * W + col) * C;
+            size_t base = (size_t(row) * W + col) * C;
             for (int ch = 0; ch < C; ++ch) {
                 img.pixels[base + ch] = outVal;
             }
@@ -916,6 +4168,7 @@ void dilateBinary(ImageData& img, int windowSize) {
     std::vector<unsigned char> original = img.pixels;
 
     for (int row = 0; row < H; ++row) {
+        if (previewCancelled()) return;         // podgląd w tle: przyszło nowsze okno
         for (int col = 0; col < W; ++col) {
             bool turnWhite = false;
 
@@ -926,7 +4179,7 @@ void dilateBinary(ImageData& img, int windowSize) {
                     int nx = col + dx;
                     // poprawka na granice zdjęcia
                     if (nx >= 0 && nx < W && ny >= 0 && ny < H) {
-                        int idx = (ny * W + nx) * C;
+                        size_t idx = (size_t(ny) * W + nx) * C;
                         if (original[idx] == 255) {
                             turnWhite = true;
                         }
@@ -936,7 +4189,7 @@ void dilateBinary(ImageData& img, int windowSize) {
 
             // ustalenie wartości piksela
             unsigned char outVal = turnWhite ? 255 : 0;
-            int base = (row * W + col) * C;
+            size_t base = (size_t(row) * W + col) * C;
             for (int ch = 0; ch < C; ++ch) {
                 img.pixels[base + ch] = outVal;
             }
@@ -960,8 +4213,9 @@ void minFilter(ImageData& img, int windowSize) {
     std::vector<unsigned char> original = img.pixels;
 
     for (int row = 0; row < H; ++row) {
+        if (previewCancelled()) return;         // podgląd w tle: przyszło nowsze okno
         for (int col = 0; col < W; ++col) {
-            int baseIndex = (row * W + col) * C;
+            size_t baseIndex = (size_t(row) * W + col) * C;
 
             for (int ch = 0; ch < C; ++ch) {
                 unsigned char minValue = 255;
@@ -974,7 +4228,7 @@ void minFilter(ImageData& img, int windowSize) {
                         int nx = col + dx;
                         if (nx < 0 || nx >= W) continue;
 
-                        unsigned char v = original[(ny * W + nx) * C + ch];
+                        unsigned char v = original[(size_t(ny) * W + nx) * C + ch];
                         if (v < minValue) {
                             minValue = v;
                         }
@@ -997,8 +4251,9 @@ void maxFilter(ImageData& img, int windowSize) {
     std::vector<unsigned char> original = img.pixels;
 
     for (int row = 0; row < H; ++row) {
+        if (previewCancelled()) return;         // podgląd w tle: przyszło nowsze okno
         for (int col = 0; col < W; ++col) {
-            int baseIndex = (row * W + col) * C;
+            size_t baseIndex = (size_t(row) * W + col) * C;
 
             for (int ch = 0; ch < C; ++ch) {
                 unsigned char maxValue = 0;
@@ -1010,7 +4265,7 @@ void maxFilter(ImageData& img, int windowSize) {
                         int nx = col + dx;
                         if (nx < 0 || nx >= W) continue;
 
-                        unsigned char v = original[(ny * W + nx) * C + ch];
+                        unsigned char v = original[(size_t(ny) * W + nx) * C + ch];
                         if (v > maxValue) {
                             maxValue = v;
                         }
@@ -1037,8 +4292,9 @@ void medianFilter(ImageData& img, int windowSize) {
     std::vector<unsigned char> original = img.pixels;
 
     for (int row = 0; row < H; ++row) {
+        if (previewCancelled()) return;         // podgląd w tle: przyszło nowsze okno
         for (int col = 0; col < W; ++col) {
-            int baseIndex = (row * W + col) * C;
+            size_t baseIndex = (size_t(row) * W + col) * C;
 
             for (int ch = 0; ch < C; ++ch) {
                 // lista sąsiedztw
@@ -1050,7 +4306,7 @@ void medianFilter(ImageData& img, int windowSize) {
                     for (int dx = -radius; dx <= radius; ++dx) {
                         int nx = col + dx;
                         if (nx < 0 || nx >= W) continue;
-                        neighborhood.push_back(original[(ny * W + nx) * C + ch]);
+                        neighborhood.push_back(original[(size_t(ny) * W + nx) * C + ch]);
                     }
                 }
 
@@ -1082,7 +4338,7 @@ void convolveFilter(ImageData& img, const std::vector<float>& kernel, int kSize)
     // dla każdego piksela (y, x) wykonujemy operację splotu
     for (int y = 0; y < height; ++y) {
         for (int x = 0; x < width; ++x) {
-            int baseIndex = (y * width + x) * channels;  // początkowy indeks piksela
+            size_t baseIndex = (size_t(y) * width + x) * channels;  // początkowy indeks piksela
 
             // filtrujemy każdy kanał
             for (int c = 0; c < channels; ++c) {
@@ -1101,7 +4357,7 @@ void convolveFilter(ImageData& img, const std::vector<float>& kernel, int kSize)
                         if (xx < 0)        xx = 0;
                         else if (xx >= width) xx = width - 1;
 
-                        int idxOriginal = (yy * width + xx) * channels + c;
+                        size_t idxOriginal = (size_t(yy) * width + xx) * channels + c;
                         float kval = kernel[(dy + radius) * kSize + (dx + radius)];
                         sum += original[idxOriginal] * kval;
                     }
@@ -1317,7 +4573,7 @@ void quantizeImage(ImageData& img, int L) {
     int W = img.width;
     int H = img.height;
     int C = img.channels;
-    int nPixels = W * H;
+    size_t nPixels = size_t(W) * H;
 
     // Przeliczniki:
     //   faktor_q   = L / 256.0f        (float), żeby dostać q = floor(v * L/256)
@@ -1326,8 +4582,8 @@ void quantizeImage(ImageData& img, int L) {
     float faktor_r = 256.0f / float(L);
 
     // Przetwarzamy każdy bajt pikseli:
-    for (int i = 0; i < nPixels; ++i) {
-        int base = i * C;
+    for (size_t i = 0; i < nPixels; ++i) {
+        size_t base = i * C;
         for (int ch = 0; ch < C; ++ch) {
             unsigned char v = img.pixels[base + ch];
             // oblicz q = floor(v * L / 256)
@@ -1352,7 +4608,7 @@ void posterizeImage(ImageData& img, int levels) {
     int W = img.width;
     int H = img.height;
     int C = img.channels;
-    int nPixels = W * H;
+    size_t nPixels = size_t(W) * H;
 
     // krok kwantyzacji (w przybliżeniu)
     int binSize = 256 / levels;
@@ -1361,8 +4617,8 @@ void posterizeImage(ImageData& img, int levels) {
     // off-set, aby poziom trafił na „środek” swojego binu: binSize/2
     int halfBin = binSize / 2;
 
-    for (int i = 0; i < nPixels; ++i) {
-        int base = i * C;
+    for (size_t i = 0; i < nPixels; ++i) {
+        size_t base = i * C;
         for (int ch = 0; ch < C; ++ch) {
             // oryginalna wartość 0..255
             int v = img.pixels[base + ch];
@@ -1389,37 +4645,38 @@ static double euclideanDistance(const std::vector<double>& a, const std::vector<
     return std::sqrt(sum);
 }
 
-// redukcja kolorów metodą k‑means na k centroidów
-void kMeansColorQuantization(ImageData& img, int k, int maxIters = 10) {
-    int W = img.width;
-    int H = img.height;
-    int C = img.channels;
-    int N = W * H;
-    if (N == 0 || k < 1) return;
+// redukcja kolorów metodą k‑means na k centroidów; sample - obraz, z którego liczyć centroidy (podgląd przy
+// zapisie w pełnej rozdzielczości), piksele img trafiają wtedy do najbliższego z nich
+void kMeansColorQuantization(ImageData& img, int k, int maxIters = 10, const ImageData* sample = nullptr) {
+    const ImageData& src = sample ? *sample : img;
+    int C = src.channels;
+    size_t N = size_t(src.width) * src.height;
+    if (N == 0 || k < 1 || img.channels != C) return;
 
     int dim = (C >= 3 ? 3 : 1);
 
     // wektor punktów w przestrzeni dim-wymiarowej
     std::vector<std::vector<double>> data(N, std::vector<double>(dim));
-    for (int i = 0; i < N; ++i) {
-        int base = i * C;
+    for (size_t i = 0; i < N; ++i) {
+        if ((i & 0xFFFF) == 0 && previewCancelled()) return;   // podgląd w tle: przyszło nowe k
+        size_t base = i * C;
         if (dim == 1) {
-            data[i][0] = static_cast<double>(img.pixels[base]);
+            data[i][0] = static_cast<double>(src.pixels[base]);
         }
         else {
-            data[i][0] = static_cast<double>(img.pixels[base]);       // R
-            data[i][1] = static_cast<double>(img.pixels[base + 1]);   // G
-            data[i][2] = static_cast<double>(img.pixels[base + 2]);   // B
+            data[i][0] = static_cast<double>(src.pixels[base]);       // R
+            data[i][1] = static_cast<double>(src.pixels[base + 1]);   // G
+            data[i][2] = static_cast<double>(src.pixels[base + 2]);   // B
         }
     }
 
-    // wybierz losowo k odrębnych punktów z data
+    // wybierz losowo k odrębnych punktów z data (stałe ziarno - ten sam podział przy każdym wywołaniu)
+    if (size_t(k) > N) k = int(N);
     std::vector<std::vector<double>> centroids(k, std::vector<double>(dim));
     {
-        std::vector<int> idx(N);
-        for (int i = 0; i < N; ++i) idx[i] = i;
-        std::random_device rd;
-        std::mt19937 gen(rd());
+        std::vector<size_t> idx(N);
+        for (size_t i = 0; i < N; ++i) idx[i] = i;
+        std::mt19937 gen(KMEANS_SEED);
         std::shuffle(idx.begin(), idx.end(), gen);
         for (int c = 0; c < k; ++c) {
             centroids[c] = data[idx[c]];
@@ -1443,7 +4700,8 @@ void kMeansColorQuantization(ImageData& img, int k, int maxIters = 10) {
         }
 
         // przypisz każdy punkt do najbliższego centroidu
-        for (int i = 0; i < N; ++i) {
+        for (size_t i = 0; i < N; ++i) {
+            if ((i & 0xFFFF) == 0 && previewCancelled()) return;
             // znajdź najbliższy centroid
             int bestCluster = 0;
             double bestDist = euclideanDistance(data[i], centroids[0]);
@@ -1480,9 +4738,24 @@ void kMeansColorQuantization(ImageData& img, int k, int maxIters = 10) {
         }
     }
 
+    // piksele obrazu spoza próbki - do najbliższego centroidu
+    if (sample) {
+        N = size_t(img.width) * img.height;
+        labels.assign(N, 0);
+        std::vector<double> p(dim);
+        for (size_t i = 0; i < N; ++i) {
+            for (int d = 0; d < dim; ++d) p[d] = img.pixels[i * C + d];
+            double bestDist = euclideanDistance(p, centroids[0]);
+            for (int c = 1; c < k; ++c) {
+                double d = euclideanDistance(p, centroids[c]);
+                if (d < bestDist) { bestDist = d; labels[i] = c; }
+            }
+        }
+    }
+
     // zastąp każdy piksel kolorem centroidu jego klastra
-    for (int i = 0; i < N; ++i) {
-        int base = i * C;
+    for (size_t i = 0; i < N; ++i) {
+        size_t base = i * C;
         int c = labels[i];
         if (dim == 1) {
             unsigned char v = static_cast<unsigned char>(std::round(centroids[c][0]));
@@ -1503,14 +4776,131 @@ void kMeansColorQuantization(ImageData& img, int k, int maxIters = 10) {
     }
 }
 
+// ==================== operacje geometryczne ====================
+
+// obrót o 90° zgodnie z ruchem wskazówek zegara
+void rotate90(ImageData& img) {
+    int W = img.width, H = img.height, C = img.channels;
+    std::vector<unsigned char> out(img.pixels.size());
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            // (x, y) -> (H - 1 - y, x), nowa szerokość to H
+            size_t src = (size_t(y) * W + x) * C;
+            size_t dst = (size_t(x) * H + (H - 1 - y)) * C;
+            for (int c = 0; c < C; ++c)
+                out[dst + c] = img.pixels[src + c];
+        }
+    }
+    img.pixels.swap(out);
+    std::swap(img.width, img.height);
+}
+
+// obrót o 180°
+void rotate180(ImageData& img) {
+    int C = img.channels;
+    size_t n = size_t(img.width) * img.height;
+    for (size_t i = 0, j = n - 1; i < j; ++i, --j)
+        for (int c = 0; c < C; ++c)
+            std::swap(img.pixels[i * C + c], img.pixels[j * C + c]);
+}
+
+// obrót o 90° przeciwnie do ruchu wskazówek zegara
+void rotate270(ImageData& img) {
+    int W = img.width, H = img.height, C = img.channels;
+    std::vector<unsigned char> out(img.pixels.size());
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            // (x, y) -> (y, W - 1 - x)
+            size_t src = (size_t(y) * W + x) * C;
+            size_t dst = (size_t(W - 1 - x) * H + y) * C;
+            for (int c = 0; c < C; ++c)
+                out[dst + c] = img.pixels[src + c];
+        }
+    }
+    img.pixels.swap(out);
+    std::swap(img.width, img.height);
+}
+
+// odbicie lustrzane w poziomie
+void flipHorizontal(ImageData& img) {
+    int W = img.width, H = img.height, C = img.channels;
+    for (int y = 0; y < H; ++y) {
+        unsigned char* row = img.pixels.data() + size_t(y) * W * C;
+        for (int l = 0, r = W - 1; l < r; ++l, --r)
+            for (int c = 0; c < C; ++c)
+                std::swap(row[l * C + c], row[r * C + c]);
+    }
+}
+
+// odbicie lustrzane w pionie
+void flipVertical(ImageData& img) {
+    size_t stride = size_t(img.width) * img.channels;
+    for (int t = 0, b = img.height - 1; t < b; ++t, --b)
+        std::swap_ranges(img.pixels.begin() + t * stride, img.pixels.begin() + (t + 1) * stride,
+            img.pixels.begin() + b * stride);
+}
+
+// wycina prostokąt (x, y, w, h), przycięty do granic obrazu
+void cropImage(ImageData& img, int x, int y, int w, int h) {
+    int C = img.channels;
+    x = std::clamp(x, 0, img.width - 1);
+    y = std::clamp(y, 0, img.height - 1);
+    w = std::clamp(w, 1, img.width - x);
+    h = std::clamp(h, 1, img.height - y);
+
+    std::vector<unsigned char> out(size_t(w) * h * C);
+    for (int row = 0; row < h; ++row)
+        std::copy_n(img.pixels.begin() + ((size_t(y + row) * img.width + x) * C), size_t(w) * C,
+            out.begin() + size_t(row) * w * C);
+    img.pixels.swap(out);
+    img.width = w;
+    img.height = h;
+}
+
 // ========================== MAIN LOOP =====================================
+// czy coś liczy się w tle (wczytywanie, zapis, podgląd, miniatury, wyprzedzające dekodowanie, statystyki DC)
+static bool backgroundBusy() {
+    if (g_loadJob.pending || g_exportJob.pending) return true;
+    if (g_previewWorker.shown < g_previewWorker.submitted) return true;
+    if (g_roiPreview.active && g_roiPreview.stage > 0) return true;     // podgląd pośredni czeka na dopracowanie
+    if (g_dcStats && g_dcStats->state.load(std::memory_order_acquire) == 0) return true;
+    for (auto& t : g_folder.thumbs) {
+        int st = t->state.load(std::memory_order_acquire);
+        if (st == 0 || st == 1 || t->infoState.load(std::memory_order_acquire) == 0) return true;
+    }
+    for (auto& e : g_folder.prefetch)
+        if (e->state.load(std::memory_order_acquire) == 0) return true;
+    return false;
+}
+
+// wyniki w tle widoczne dopiero w klatce: koniec i postęp zapisu, statystyki DC, podgląd pośredni do dopracowania
+static bool backgroundChanged() {
+    static int          shownPercent = -1;
+    static const void*  shownDc = nullptr;
+    bool changed = false;
+    int percent = g_exportJob.pending ? int(g_exportJob.progress.load(std::memory_order_relaxed) * 100) : -1;
+    if (percent != shownPercent || (g_exportJob.pending && g_exportJob.done.load(std::memory_order_acquire))) changed = true;
+    shownPercent = percent;
+    if (g_dcStats && g_dcStats.get() != shownDc && g_dcStats->state.load(std::memory_order_acquire) != 0) {
+        shownDc = g_dcStats.get();
+        changed = true;
+    }
+    const RoiPreview& rp = g_roiPreview;
+    if (rp.active && rp.stage > 0 && !rp.pending &&
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - rp.changed).count() >= PREVIEW_SETTLE_SECONDS)
+        changed = true;
+    return changed;
+}
+
 void mainLoop(GLFWwindow* win, ImageData& img) {
     static std::vector<Snapshot> undoStack;
     static bool                  undoInit = false;
     static bool                  undoPressedLast = false;
+    static bool                  navPressedLast = false;
 
     if (!undoInit) {
-        undoStack.push_back({ img.pixels, img.channels });
+        undoStack.push_back({ img.pixels, img.channels, img.width, img.height });
+        undoStack.back().luma = img.luma;
         undoInit = true;
     }
 
@@ -1556,7 +4946,11 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         showMedianFilter = false,
         showQuantize = false,
         showPosterize = false,
-        showKMeans = false;
+        showKMeans = false,
+        showCrop = false,
+        showSave = false;
+    static JpegExportOptions exportOpt;
+    int  cropX = 0, cropY = 0, cropW = 0, cropH = 0;
 
     int  clampLo = 0, clampHi = 255,
         normLo = 0, normHi = 255,
@@ -1572,7 +4966,6 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
     static int quantizeLevels = 4;  
     static int posterizeLevels = 4;
     static int kMeansClusters = 4;
-    static int prevKMeansClusters = -1;
 
     float contrastFactor = 1.0f,
         kParam = 0.2f,
@@ -1593,7 +4986,7 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         bpSobelX, bpSobelY, bpPrewittX, bpPrewittY,
         bpSobel45, bpSobel135, bpLapHor, bpLapVer,
         bpCmpX, bpCmpY, bpMinFilter, bpMaxFilter, bpMedianFilter,
-        bpQuantize, bpPosterize, bpKMeansOriginal, bpKMeansPreview;
+        bpQuantize, bpPosterize, bpKMeansOriginal;
 
     static bool
         initClamp = false,
@@ -1639,8 +5032,45 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         initPosterize = false,
         initKMeans = false;
 
+    // nowy obraz w oknie: świeża historia i widok
+    auto onImageOpened = [&]() {
+        undoStack.clear();
+        undoStack.push_back({ img.pixels, img.channels, img.width, img.height });
+        undoStack.back().luma = img.luma;
+        undoInit = true;
+        undoPressedLast = false;
+
+        int ww, hh; glfwGetFramebufferSize(win, &ww, &hh);
+        setupProjection(ww, hh);
+        resetViewForImage(img, ww, hh);
+    };
+
+    // klatki rysowane są tylko po zdarzeniu albo wyniku z tła (i kilka następnych, aż ImGui się ustabilizuje); bez
+    // zdarzeń wątek śpi w glfwWaitEvents, a gdy pracują zadania w tle - budzi się co BACKGROUND_POLL_SECONDS po ich wyniki
+    int framesLeft = REDRAW_FRAMES_AFTER_EVENT;         // pierwsze klatki bez czekania
+    uint64_t binaryVersion = ~uint64_t(0);
     while (!glfwWindowShouldClose(win)) {
-        glfwPollEvents();
+        if (framesLeft > 0) glfwPollEvents();
+        else if (backgroundBusy()) glfwWaitEventsTimeout(BACKGROUND_POLL_SECONDS);
+        else glfwWaitEvents();
+        bool news = g_windowEvent;
+        g_windowEvent = false;
+
+        // obraz roboczy dotarł z wątku wczytującego - nowa historia edycji
+        if (pollImageLoad(img)) {
+            undoStack.clear();
+            undoStack.push_back({ img.pixels, img.channels, img.width, img.height });
+            undoStack.back().luma = img.luma;
+            news = true;
+        }
+        news |= pollFolderThumbnails();
+        news |= pollPrefetch();
+        news |= collectPreview(img);
+        news |= backgroundChanged();
+        if (news) framesLeft = REDRAW_FRAMES_AFTER_EVENT;
+        if (framesLeft <= 0) continue;                  // pobudka po czasie bez nowych wyników - bez klatki
+        --framesLeft;
+        bool ready = !g_loadJob.pending;
 
         bool ctrl = (glfwGetKey(win, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS ||
             glfwGetKey(win, GLFW_KEY_RIGHT_CONTROL) == GLFW_PRESS);
@@ -1649,17 +5079,31 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         if (ctrl && z && !undoPressedLast && undoStack.size() > 1) {
             undoStack.pop_back();
             auto& snap = undoStack.back();
-            img.pixels = snap.pixels;
             img.channels = snap.channels;
-            uploadTexture(img);
-            computeHistograms(img);
+            img.width = snap.width;
+            img.height = snap.height;
+            img.luma = snap.luma;
+            showPixels(img, snap.pixels);
             undoPressedLast = true;
-            g_isBinary = isBinaryImage(img);
         }
         if (!(ctrl && z)) {
             undoPressedLast = false;
         }
-        g_isBinary = isBinaryImage(img);
+        // Y z dekodera opisuje tylko nieedytowany obraz; po operacji jasność liczona z RGB, cofnięcie go przywraca
+        if (undoStack.back().luma.empty() && !img.luma.empty()) img.luma.clear();
+
+        // strzałki w lewo/prawo: poprzedni/następny plik z otwartego folderu
+        int navigate = 0;
+        bool left = (glfwGetKey(win, GLFW_KEY_LEFT) == GLFW_PRESS);
+        bool right = (glfwGetKey(win, GLFW_KEY_RIGHT) == GLFW_PRESS);
+        if (!navPressedLast && !ImGui::GetIO().WantCaptureKeyboard)
+            navigate = (right ? +1 : left ? -1 : 0);
+        navPressedLast = (left || right);
+        // menu Binary zależy od tego, czy obraz jest dwubarwny - sprawdzane tylko po zmianie pikseli
+        if (binaryVersion != g_pixelsVersion) {
+            g_isBinary = isBinaryImage(img);
+            binaryVersion = g_pixelsVersion;
+        }
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
@@ -1669,34 +5113,44 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             if (ImGui::BeginMenu("File")) {
                 if (ImGui::MenuItem("Open")) {
                     cleanupImage(img);
-                    if (loadImageFromFile(img)) {
-                        undoStack.clear();
-                        undoStack.push_back({ img.pixels, img.channels });
-                        undoInit = true;
-                        undoPressedLast = false;
-
-                        int ww, hh; glfwGetFramebufferSize(win, &ww, &hh);
-                        setupProjection(ww, hh);
-                        resetViewForImage(img, ww, hh);
-                        g_isBinary = isBinaryImage(img);
-                    }
+                    if (loadImageFromFile(img))
+                        onImageOpened();
                 }
-                if (ImGui::MenuItem("Save")) {
-                    const char* filters[] = { "*.jpg" };
-                    const char* fn = tinyfd_saveFileDialog(
-                        "Save Image", "untitled.jpg", 1, filters, "JPEG files (*.jpg>"
-                    );
-                    if (fn) {
-                        stbi_write_jpg(fn, img.width, img.height, img.channels,
-                            img.pixels.data(), /*quality=*/100);
-                    }
+                if (ImGui::MenuItem("Open Folder...")) {
+                    const char* dir = tinyfd_selectFolderDialog("Select folder", "");
+                    if (dir) openFolder(dir);
                 }
+                bool inFolder = !g_folder.thumbs.empty();
+                if (ImGui::MenuItem("Next Image", "Right", false, inFolder)) navigate = +1;
+                if (ImGui::MenuItem("Previous Image", "Left", false, inFolder)) navigate = -1;
+                if (ImGui::MenuItem("Save", nullptr, false, !g_exportJob.pending))
+                    showSave = true;
                 if (ImGui::MenuItem("Exit"))
                     glfwSetWindowShouldClose(win, true);
                 ImGui::EndMenu();
             }
 
-            if (ImGui::BeginMenu("Histogram")) {
+            if (ImGui::BeginMenu("Transform", ready)) {
+                // obroty i odbicia wykonywane od razu; bezstratnie przy zapisie, jeśli w historii nie ma innych operacji
+                auto applyGeom = [&](void (*fn)(ImageData&), GeomOp::Kind kind) {
+                    fn(img);
+                    undoStack.push_back({ img.pixels, img.channels, img.width, img.height, fn, -1, GeomOp{ kind } });
+                    uploadTexture(img); computeHistograms(img);
+                };
+                if (ImGui::MenuItem("Rotate 90 CW"))    applyGeom(rotate90, GeomOp::Rot90);
+                if (ImGui::MenuItem("Rotate 180"))      applyGeom(rotate180, GeomOp::Rot180);
+                if (ImGui::MenuItem("Rotate 90 CCW"))   applyGeom(rotate270, GeomOp::Rot270);
+                if (ImGui::MenuItem("Flip horizontal")) applyGeom(flipHorizontal, GeomOp::FlipH);
+                if (ImGui::MenuItem("Flip vertical"))   applyGeom(flipVertical, GeomOp::FlipV);
+                ImGui::Separator();
+                if (ImGui::MenuItem("Crop")) {
+                    showCrop = true;
+                    cropX = cropY = 0; cropW = img.width; cropH = img.height;
+                }
+                ImGui::EndMenu();
+            }
+
+            if (ImGui::BeginMenu("Histogram", ready)) {
                 ImGui::MenuItem("Clamp", nullptr, &showClamp);
                 ImGui::MenuItem("Normalize", nullptr, &showNorm);
                 ImGui::MenuItem("Brightness", nullptr, &showBright);
@@ -1705,12 +5159,12 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
                 ImGui::EndMenu();
             }
 
-            if (ImGui::BeginMenu("Thresholding")) {
+            if (ImGui::BeginMenu("Thresholding", ready)) {
                 ImGui::MenuItem("Manual", nullptr, &showTManual);
                 if (ImGui::MenuItem("Automatic (minima)")) showTAutoMin = true;
                 if (ImGui::MenuItem("Otsu")) {
                     showTOtsu = true;
-                    /*undoStack.push_back({ img.pixels, img.channels });
+                    /*undoStack.push_back({ img.pixels, img.channels, img.width, img.height });
                     thresholdOtsu(img);
                     uploadTexture(img); computeHistograms(img);*/
                 }
@@ -1723,7 +5177,7 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
                 ImGui::EndMenu();
             }
 
-            if (g_isBinary && ImGui::BeginMenu("Binary")) {
+            if (g_isBinary && ImGui::BeginMenu("Binary", ready)) {
                 ImGui::MenuItem("Erode", nullptr, &showErode);
                 ImGui::MenuItem("Dilate", nullptr, &showDilate);
                 ImGui::MenuItem("Open", nullptr, &showOpen);
@@ -1731,7 +5185,7 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
                 ImGui::EndMenu();
             }
 
-            if (ImGui::BeginMenu("Filters")) {
+            if (ImGui::BeginMenu("Filters", ready)) {
                 // low‐pass filters
                 if (ImGui::BeginMenu("Low-bands")) {
                     ImGui::MenuItem("Box 3x3", nullptr, &showBox3);
@@ -1778,22 +5232,53 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
                 ImGui::EndMenu();
             }
 
-            if (ImGui::BeginMenu("Color Reduction")) {
+            if (ImGui::BeginMenu("Color Reduction", ready)) {
                 ImGui::MenuItem("Quantize", nullptr, &showQuantize);
                 ImGui::MenuItem("Posterize", nullptr, &showPosterize);
                 ImGui::MenuItem("K-means", nullptr, &showKMeans);
                 ImGui::EndMenu();
             }
 
+            // postęp zapisu w tle
+            pollImageExport();
+            if (g_exportJob.pending) {
+                ImGui::Separator();
+                ImGui::Text("Saving");
+                ImGui::ProgressBar(g_exportJob.progress.load(std::memory_order_relaxed), ImVec2(200, 0));
+            }
+
             ImGui::EndMainMenuBar();
         }
 
+        // ─── SAVE (JPEG EXPORT) POPUP ────────────────────────
+        if (showSave) {
+            ImGui::Begin("Save JPEG", &showSave, ImGuiWindowFlags_AlwaysAutoResize);
+            ImGui::SliderInt("Quality", &exportOpt.quality, 1, 100);
+            ImGui::Checkbox("Optimized Huffman tables", &exportOpt.optimize);
+            ImGui::Checkbox("Progressive", &exportOpt.progressive);
+            ImGui::RadioButton("4:4:4", &exportOpt.subsampling, 444); ImGui::SameLine();
+            ImGui::RadioButton("4:2:2", &exportOpt.subsampling, 422); ImGui::SameLine();
+            ImGui::RadioButton("4:2:0", &exportOpt.subsampling, 420);
+            ImGui::TextDisabled(".ppm/.pgm are written raw, without these options");
+            if (ImGui::Button("Save...")) {
+                const char* filters[] = { "*.jpg", "*.ppm", "*.pgm" };
+                const char* fn = tinyfd_saveFileDialog(
+                    "Save Image", "untitled.jpg", 3, filters, "JPEG / raw PNM files"
+                );
+                if (fn) {
+                    startImageExport(img, undoStack, fn, exportOpt);
+                    showSave = false;
+                }
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Cancel")) showSave = false;
+            ImGui::End();
+        }
+
         // ─── CLAMP POPUP ───────────────────────────────────────
         if (showClamp) {
             if (!initClamp) { bpClamp = img.pixels; initClamp = true; }
-            img.pixels = bpClamp;
-            clampImage(img, clampLo, clampHi);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpClamp, [&](ImageData& im) { clampImage(im, clampLo, clampHi); }, 0, previewParams(clampLo, clampHi));
 
             ImGui::Begin("Clamp", &showClamp, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::SliderInt("Low", &clampLo, 0, 255); ImGui::SameLine();
@@ -1801,14 +5286,14 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             ImGui::SliderInt("High", &clampHi, 0, 255); ImGui::SameLine();
             ImGui::InputInt("High##i", &clampHi, 1);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=](ImageData& im) { clampImage(im, clampLo, clampHi); }, 0 });
                 bpClamp = img.pixels;
                 showClamp = initClamp = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpClamp;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpClamp);
                 showClamp = initClamp = false;
             }
             ImGui::End();
@@ -1817,9 +5302,7 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── NORMALIZE POPUP ───────────────────────────────────
         if (showNorm) {
             if (!initNorm) { bpNorm = img.pixels; initNorm = true; }
-            img.pixels = bpNorm;
-            normalizeImagePerChannel(img, normLo, normHi);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpNorm, [&](ImageData& im) { normalizeImagePerChannel(im, normLo, normHi); }, -1, previewParams(normLo, normHi));
 
             ImGui::Begin("Normalize", &showNorm, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::SliderInt("New Low", &normLo, 0, 255); ImGui::SameLine();
@@ -1827,14 +5310,14 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             ImGui::SliderInt("New High", &normHi, 0, 255); ImGui::SameLine();
             ImGui::InputInt("New High##i", &normHi, 1);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=](ImageData& im) { normalizeImagePerChannel(im, normLo, normHi); } });
                 bpNorm = img.pixels;
                 showNorm = initNorm = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpNorm;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpNorm);
                 showNorm = initNorm = false;
             }
             ImGui::End();
@@ -1843,22 +5326,20 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── BRIGHTNESS POPUP ─────────────────────────────────
         if (showBright) {
             if (!initBright) { bpBright = img.pixels; initBright = true; }
-            img.pixels = bpBright;
-            brightnessImage(img, brightDelta);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpBright, [&](ImageData& im) { brightnessImage(im, brightDelta); }, 0, previewParams(brightDelta));
 
             ImGui::Begin("Brightness", &showBright, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::SliderInt("Delta", &brightDelta, -255, 255); ImGui::SameLine();
             ImGui::InputInt("Delta##i", &brightDelta, 1);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=](ImageData& im) { brightnessImage(im, brightDelta); }, 0, GeomOp{}, false, brightDelta });
                 bpBright = img.pixels;
                 showBright = initBright = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpBright;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpBright);
                 showBright = initBright = false;
             }
             ImGui::End();
@@ -1867,22 +5348,20 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── CONTRAST POPUP ───────────────────────────────────
         if (showContrast) {
             if (!initContrast) { bpContrast = img.pixels; initContrast = true; }
-            img.pixels = bpContrast;
-            contrastImage(img, contrastFactor);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpContrast, [&](ImageData& im) { contrastImage(im, contrastFactor); }, 0, previewParams(contrastFactor));
 
             ImGui::Begin("Contrast", &showContrast, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::SliderFloat("Factor", &contrastFactor, 0.1f, 3.0f); ImGui::SameLine();
             ImGui::InputFloat("Factor##i", &contrastFactor, 0.01f, 0.1f, "%.2f");
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=](ImageData& im) { contrastImage(im, contrastFactor); }, 0 });
                 bpContrast = img.pixels;
                 showContrast = initContrast = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpContrast;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpContrast);
                 showContrast = initContrast = false;
             }
             ImGui::End();
@@ -1894,15 +5373,11 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
                 bpStretch = img.pixels;
                 initStretch = true;
             }
-            img.pixels = bpStretch;
 
             // perform the true histogram stretch using percentiles
             float pLow = stretchLo * 0.01f;   // e.g. 1 → 0.01
             float pHigh = stretchHi * 0.01f;   // e.g. 99 → 0.99
-            stretchHistogram(img, pLow, pHigh);
-
-            uploadTexture(img);
-            computeHistograms(img);
+            previewOp(img, bpStretch, [&](ImageData& im) { stretchHistogram(im, pLow, pHigh); }, -1, previewParams(pLow, pHigh));
 
             ImGui::Begin("Contrast Stretch", &showStretch, ImGuiWindowFlags_AlwaysAutoResize);
 
@@ -1926,16 +5401,15 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             }
 
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=](ImageData& im) { stretchHistogram(im, stretchLo * 0.01f, stretchHi * 0.01f); } });
                 bpStretch = img.pixels;
                 showStretch = false;
                 initStretch = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpStretch;
-                uploadTexture(img);
-                computeHistograms(img);
+                showPixels(img, bpStretch);
                 showStretch = false;
                 initStretch = false;
             }
@@ -1947,23 +5421,20 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         static bool initTManual = false;
         if (showTManual) {
             if (!initTManual) { bpTManual = img.pixels; initTManual = true; }
-            img.pixels = bpTManual;
-            thresholdManual(img, tManual);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpTManual, [&](ImageData& im) { thresholdManual(im, tManual); }, 0, previewParams(tManual));
 
             ImGui::Begin("Threshold Manual", &showTManual, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::SliderInt("T", &tManual, 0, 255); ImGui::SameLine();
             ImGui::InputInt("T##i", &tManual, 1);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=](ImageData& im) { thresholdManual(im, tManual); }, 0, GeomOp{}, true });
                 bpTManual = img.pixels;
                 showTManual = initTManual = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpTManual;
-                uploadTexture(img); g_isBinary = isBinaryImage(img);
-                computeHistograms(img);
+                showPixels(img, bpTManual);
                 showTManual = initTManual = false;
             }
             ImGui::End();
@@ -1974,33 +5445,26 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             if (!initTAutoMin) {
                 bpTAutoMin = img.pixels;
                 initTAutoMin = true;
+                // Compute threshold via standalone function (once, on the original pixels):
+                tAutoMin = computeAutoMinThreshold(img);
             }
-            // Restore original pixels before computing each preview:
-            img.pixels = bpTAutoMin;
-
-            // Compute threshold via standalone function:
-            int tAutoMin = computeAutoMinThreshold(img);
 
-            // Apply threshold and update UI:
-            thresholdManual(img, tAutoMin);
-            uploadTexture(img);
-            computeHistograms(img);
-            g_isBinary = isBinaryImage(img);
+            // Apply threshold to a copy of the original and update UI:
+            previewOp(img, bpTAutoMin, [&](ImageData& im) { thresholdManual(im, tAutoMin); }, 0, previewParams(tAutoMin));
 
             ImGui::Begin("Auto‐Minima Threshold", &showTAutoMin, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::Text("T = %d", tAutoMin);
             if (ImGui::Button("Apply")) {
+                commitPreview(img);
                 // Push current state onto undo stack:
-                undoStack.push_back({ img.pixels, img.channels });
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=](ImageData& im) { thresholdManual(im, tAutoMin); }, 0, GeomOp{}, true });
                 bpTAutoMin = img.pixels;
                 showTAutoMin = initTAutoMin = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
                 // Revert to backup and recompute histograms:
-                img.pixels = bpTAutoMin;
-                uploadTexture(img);
-                computeHistograms(img);
+                showPixels(img, bpTAutoMin);
                 showTAutoMin = initTAutoMin = false;
             }
             ImGui::End();
@@ -2011,45 +5475,39 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             if (!initTOtsu) {
                 bpTOtsu = img.pixels;   // zachowujemy oryginał
                 initTOtsu = true;
-            }
-            img.pixels = bpTOtsu;
-            uploadTexture(img);
-            computeHistograms(img);
 
-            // histogram szarości
-            std::vector<float> hist(256);
-            if (img.channels == 1) {
-                // jeśli to obraz w skali szarości, użyj bezpośrednio histGray
-                hist = img.histGray;
-            }
-            else {
-                // w przeciwnym razie uśredniamy kanały
-                for (int i = 0; i < 256; ++i) {
-                    hist[i] = (img.histR[i] + img.histG[i] + img.histB[i]) * (1.0f / 3.0f);
+                // histogram szarości (histogramy opisują jeszcze oryginał, więc próg liczony raz)
+                std::vector<float> hist(256);
+                if (img.channels == 1) {
+                    // jeśli to obraz w skali szarości, użyj bezpośrednio histGray
+                    hist = img.histGray;
+                }
+                else {
+                    // w przeciwnym razie uśredniamy kanały
+                    for (int i = 0; i < 256; ++i) {
+                        hist[i] = (img.histR[i] + img.histG[i] + img.histB[i]) * (1.0f / 3.0f);
+                    }
                 }
-            }
 
-            // policz próg i zastosuj binaryzację
-            size_t total = size_t(img.width) * img.height;
-            tOtsu = otsuThreshold(hist, total);
-            thresholdManual(img, tOtsu);
+                // policz próg
+                size_t total = size_t(img.width) * img.height;
+                tOtsu = otsuThreshold(hist, total);
+            }
 
-            uploadTexture(img);
-            computeHistograms(img);
-            g_isBinary = isBinaryImage(img);
+            // zastosuj binaryzację na kopii oryginału
+            previewOp(img, bpTOtsu, [&](ImageData& im) { thresholdManual(im, tOtsu); }, 0, previewParams(tOtsu));
 
             ImGui::Begin("Otsu Threshold", &showTOtsu, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::Text("T = %d", tOtsu);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=](ImageData& im) { thresholdManual(im, tOtsu); }, 0, GeomOp{}, true });
                 bpTOtsu = img.pixels;
                 initTOtsu = showTOtsu = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpTOtsu;
-                uploadTexture(img);
-                computeHistograms(img);
+                showPixels(img, bpTOtsu);
                 initTOtsu = showTOtsu = false;
             }
             ImGui::End();
@@ -2058,9 +5516,7 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── DOUBLE THRESHOLD POPUP ─────────────────────────
         if (showTDouble) {
             if (!initTDouble) { bpTDouble = img.pixels; initTDouble = true; }
-            img.pixels = bpTDouble;
-            thresholdDouble(img, t1, t2);
-            uploadTexture(img); computeHistograms(img); g_isBinary = isBinaryImage(img);
+            previewOp(img, bpTDouble, [&](ImageData& im) { thresholdDouble(im, t1, t2); }, 0, previewParams(t1, t2));
 
             ImGui::Begin("Double Threshold", &showTDouble, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::SliderInt("T1", &t1, 0, 255); ImGui::SameLine();
@@ -2068,14 +5524,14 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             ImGui::SliderInt("T2", &t2, 0, 255); ImGui::SameLine();
             ImGui::InputInt("T2##i", &t2, 1);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels,img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=](ImageData& im) { thresholdDouble(im, t1, t2); }, 0, GeomOp{}, true });
                 bpTDouble = img.pixels;
                 showTDouble = initTDouble = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpTDouble;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpTDouble);
                 showTDouble = initTDouble = false;
             }
             ImGui::End();
@@ -2084,9 +5540,7 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── HYSTERESIS POPUP ───────────────────────────────
         if (showTHyst) {
             if (!initTHyst) { bpTHyst = img.pixels; initTHyst = true; }
-            img.pixels = bpTHyst;
-            thresholdHysteresis(img, tLow, tHigh);
-            uploadTexture(img); computeHistograms(img); g_isBinary = isBinaryImage(img);
+            previewOp(img, bpTHyst, [lo = tLow, hi = tHigh](ImageData& im) { thresholdHysteresis(im, lo, hi); }, -1, previewParams(tLow, tHigh), true);
 
             ImGui::Begin("Hysteresis Threshold", &showTHyst, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::SliderInt("Low", &tLow, 0, 255); ImGui::SameLine();
@@ -2094,14 +5548,14 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             ImGui::SliderInt("High", &tHigh, 0, 255); ImGui::SameLine();
             ImGui::InputInt("High##i", &tHigh, 1);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels,img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=](ImageData& im) { thresholdHysteresis(im, tLow, tHigh); }, -1, GeomOp{}, true });
                 bpTHyst = img.pixels;
                 showTHyst = initTHyst = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpTHyst;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpTHyst);
                 showTHyst = initTHyst = false;
             }
             ImGui::End();
@@ -2117,19 +5571,16 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             ImGui::SliderFloat("k", &kParam, -1.0f, 1.0f); ImGui::SameLine();
             ImGui::InputFloat("k##i", &kParam, 0.01f, 0.1f, "%.3f");
 
-            img.pixels = bpTNiblack;
-            thresholdNiblack(img, winSize, kParam);
-            uploadTexture(img); g_isBinary = isBinaryImage(img);
-            computeHistograms(img);
+            previewOp(img, bpTNiblack, [ws = winSize, k = kParam](ImageData& im) { thresholdNiblack(im, ws, k); }, winSize / 2, previewParams(winSize, kParam), true);
 
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels,img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=, d = img.scaleDenom](ImageData& im) { thresholdNiblack(im, scaleWindow(winSize, d, im.scaleDenom), kParam); }, scaleWindow(winSize, img.scaleDenom, 1) / 2, GeomOp{}, true });
                 initTNiblack = showTNiblack = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpTNiblack;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpTNiblack);
                 initTNiblack = showTNiblack = false;
             }
             ImGui::End();
@@ -2147,19 +5598,17 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             ImGui::SliderFloat("R", &Rparam, 1.0f, 255.0f); ImGui::SameLine();
             ImGui::InputFloat("R##i", &Rparam, 1.0f, 10.0f, "%.1f");
 
-            img.pixels = bpTSauvola;
-            thresholdSauvola(img, winSize, kParam, Rparam);
-            uploadTexture(img); g_isBinary = isBinaryImage(img);
-            computeHistograms(img);
+            previewOp(img, bpTSauvola, [ws = winSize, k = kParam, R = Rparam](ImageData& im) { thresholdSauvola(im, ws, k, R); }, winSize / 2,
+                      previewParams(winSize, kParam, Rparam), true);
 
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels,img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=, d = img.scaleDenom](ImageData& im) { thresholdSauvola(im, scaleWindow(winSize, d, im.scaleDenom), kParam, Rparam); }, scaleWindow(winSize, img.scaleDenom, 1) / 2, GeomOp{}, true });
                 initTSauvola = showTSauvola = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpTSauvola;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpTSauvola);
                 initTSauvola = showTSauvola = false;
             }
             ImGui::End();
@@ -2175,19 +5624,16 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             ImGui::SliderFloat("k", &kParam, -1.0f, 1.0f); ImGui::SameLine();
             ImGui::InputFloat("k##i", &kParam, 0.01f, 0.1f, "%.3f");
 
-            img.pixels = bpTWolf;
-            thresholdWolfJolion(img, winSize, kParam);
-            uploadTexture(img); g_isBinary = isBinaryImage(img);
-            computeHistograms(img);
+            previewOp(img, bpTWolf, [ws = winSize, k = kParam](ImageData& im) { thresholdWolfJolion(im, ws, k); }, -1, previewParams(winSize, kParam), true);
 
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels,img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=, d = img.scaleDenom](ImageData& im) { thresholdWolfJolion(im, scaleWindow(winSize, d, im.scaleDenom), kParam); }, -1, GeomOp{}, true });
                 initTWolf = showTWolf = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpTWolf;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpTWolf);
                 initTWolf = showTWolf = false;
             }
             ImGui::End();
@@ -2196,22 +5642,20 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── ERODE POPUP ──────────────────────────────────────
         if (showErode) {
             if (!initErode) { bpErode = img.pixels; initErode = true; }
-            img.pixels = bpErode;
-            erodeBinary(img, binWin);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpErode, [w = binWin](ImageData& im) { erodeBinary(im, w); }, binWin / 2, previewParams(binWin), true);
 
             ImGui::Begin("Erode", &showErode, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::SliderInt("Window", &binWin, 1, 101); ImGui::SameLine();
             ImGui::InputInt("Win##i", &binWin, 1);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels,img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=, d = img.scaleDenom](ImageData& im) { erodeBinary(im, scaleWindow(binWin, d, im.scaleDenom)); }, scaleWindow(binWin, img.scaleDenom, 1) / 2 });
                 bpErode = img.pixels;
                 initErode = showErode = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpErode;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpErode);
                 initErode = showErode = false;
             }
             ImGui::End();
@@ -2220,22 +5664,20 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── DILATE POPUP ─────────────────────────────────────
         if (showDilate) {
             if (!initDilate) { bpDilate = img.pixels; initDilate = true; }
-            img.pixels = bpDilate;
-            dilateBinary(img, binWin);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpDilate, [w = binWin](ImageData& im) { dilateBinary(im, w); }, binWin / 2, previewParams(binWin), true);
 
             ImGui::Begin("Dilate", &showDilate, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::SliderInt("Window", &binWin, 1, 101); ImGui::SameLine();
             ImGui::InputInt("Win##i", &binWin, 1);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels,img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=, d = img.scaleDenom](ImageData& im) { dilateBinary(im, scaleWindow(binWin, d, im.scaleDenom)); }, scaleWindow(binWin, img.scaleDenom, 1) / 2 });
                 bpDilate = img.pixels;
                 initDilate = showDilate = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpDilate;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpDilate);
                 initDilate = showDilate = false;
             }
             ImGui::End();
@@ -2244,22 +5686,20 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── OPEN (ERODE→DILATE) POPUP ─────────────────────────
         if (showOpen) {
             if (!initOpen) { bpOpen = img.pixels; initOpen = true; }
-            img.pixels = bpOpen;
-            openBinary(img, binWin);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpOpen, [w = binWin](ImageData& im) { openBinary(im, w); }, 2 * (binWin / 2), previewParams(binWin), true);
 
             ImGui::Begin("Open (Erode→Dilate)", &showOpen, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::SliderInt("Window", &binWin, 1, 101); ImGui::SameLine();
             ImGui::InputInt("Win##i", &binWin, 1);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels,img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=, d = img.scaleDenom](ImageData& im) { openBinary(im, scaleWindow(binWin, d, im.scaleDenom)); }, 2 * (scaleWindow(binWin, img.scaleDenom, 1) / 2) });
                 bpOpen = img.pixels;
                 initOpen = showOpen = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpOpen;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpOpen);
                 initOpen = showOpen = false;
             }
             ImGui::End();
@@ -2268,22 +5708,20 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── CLOSE (DILATE→ERODE) POPUP ───────────────────────
         if (showClose) {
             if (!initClose) { bpClose = img.pixels; initClose = true; }
-            img.pixels = bpClose;
-            closeBinary(img, binWin);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpClose, [w = binWin](ImageData& im) { closeBinary(im, w); }, 2 * (binWin / 2), previewParams(binWin), true);
 
             ImGui::Begin("Close (Dilate→Erode)", &showClose, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::SliderInt("Window", &binWin, 1, 101); ImGui::SameLine();
             ImGui::InputInt("Win##i", &binWin, 1);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels,img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=, d = img.scaleDenom](ImageData& im) { closeBinary(im, scaleWindow(binWin, d, im.scaleDenom)); }, 2 * (scaleWindow(binWin, img.scaleDenom, 1) / 2) });
                 bpClose = img.pixels;
                 initClose = showClose = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpClose;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpClose);
                 initClose = showClose = false;
             }
             ImGui::End();
@@ -2292,20 +5730,18 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── BOX 3×3 POPUP ─────────────────
         if (showBox3) {
             if (!initBox3) { bpBox3 = img.pixels; initBox3 = true; }
-            img.pixels = bpBox3;
-            boxFilter3x3(img);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpBox3, [](ImageData& im) { boxFilter3x3(im); }, 1, previewParams(), true);
 
             ImGui::Begin("Box Filter 3×3", &showBox3, ImGuiWindowFlags_AlwaysAutoResize);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, boxFilter3x3, 1 });
                 bpBox3 = img.pixels;
                 initBox3 = showBox3 = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpBox3;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpBox3);
                 initBox3 = showBox3 = false;
             }
             ImGui::End();
@@ -2314,20 +5750,18 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── BOX 5×5 POPUP ─────────────────
         if (showBox5) {
             if (!initBox5) { bpBox5 = img.pixels; initBox5 = true; }
-            img.pixels = bpBox5;
-            boxFilter5x5(img);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpBox5, [](ImageData& im) { boxFilter5x5(im); }, 2, previewParams(), true);
 
             ImGui::Begin("Box Filter 5×5", &showBox5, ImGuiWindowFlags_AlwaysAutoResize);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, boxFilter5x5, 2 });
                 bpBox5 = img.pixels;
                 initBox5 = showBox5 = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpBox5;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpBox5);
                 initBox5 = showBox5 = false;
             }
             ImGui::End();
@@ -2336,20 +5770,18 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── GAUSS 5×5 POPUP ──────────────
         if (showGauss5) {
             if (!initGauss5) { bpGauss5 = img.pixels; initGauss5 = true; }
-            img.pixels = bpGauss5;
-            gaussFilter5x5(img);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpGauss5, [](ImageData& im) { gaussFilter5x5(im); }, 2, previewParams(), true);
 
             ImGui::Begin("Gauss Filter 5×5", &showGauss5, ImGuiWindowFlags_AlwaysAutoResize);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, gaussFilter5x5, 2 });
                 bpGauss5 = img.pixels;
                 initGauss5 = showGauss5 = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpGauss5;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpGauss5);
                 initGauss5 = showGauss5 = false;
             }
             ImGui::End();
@@ -2358,20 +5790,18 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── LAPLACIAN 3×3 (4-sąs.) POPUP ──────────────
         if (showLap3) {
             if (!initLap3) { bpLap3 = img.pixels; initLap3 = true; }
-            img.pixels = bpLap3;
-            laplacian3x3(img);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpLap3, [](ImageData& im) { laplacian3x3(im); }, 1, previewParams(), true);
 
             ImGui::Begin("Laplacian 3×3 (4-sąs.)", &showLap3, ImGuiWindowFlags_AlwaysAutoResize);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, laplacian3x3, 1 });
                 bpLap3 = img.pixels;
                 initLap3 = showLap3 = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpLap3;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpLap3);
                 initLap3 = showLap3 = false;
             }
             ImGui::End();
@@ -2380,20 +5810,18 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── LAPLACIAN 3×3 (8-sąs.) POPUP ──────────────
         if (showLap8) {
             if (!initLap8) { bpLap8 = img.pixels; initLap8 = true; }
-            img.pixels = bpLap8;
-            laplacian8x8(img);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpLap8, [](ImageData& im) { laplacian8x8(im); }, 1, previewParams(), true);
 
             ImGui::Begin("Laplacian 3×3 (8-sąs.)", &showLap8, ImGuiWindowFlags_AlwaysAutoResize);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, laplacian8x8, 1 });
                 bpLap8 = img.pixels;
                 initLap8 = showLap8 = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpLap8;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpLap8);
                 initLap8 = showLap8 = false;
             }
             ImGui::End();
@@ -2402,20 +5830,18 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── SHARPEN 3×3 POPUP ─────────────
         if (showSharpen) {
             if (!initSharpen) { bpSharpen = img.pixels; initSharpen = true; }
-            img.pixels = bpSharpen;
-            sharpen3x3(img);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpSharpen, [](ImageData& im) { sharpen3x3(im); }, 1, previewParams(), true);
 
             ImGui::Begin("Sharpen 3×3", &showSharpen, ImGuiWindowFlags_AlwaysAutoResize);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, sharpen3x3, 1 });
                 bpSharpen = img.pixels;
                 initSharpen = showSharpen = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpSharpen;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpSharpen);
                 initSharpen = showSharpen = false;
             }
             ImGui::End();
@@ -2424,20 +5850,18 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── SOBEL X POPUP ──────────
         if (showSobelX) {
             if (!initSobelX) { bpSobelX = img.pixels; initSobelX = true; }
-            img.pixels = bpSobelX;
-            sobelX(img);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpSobelX, [](ImageData& im) { sobelX(im); }, 1, previewParams(), true);
 
             ImGui::Begin("Sobel X", &showSobelX, ImGuiWindowFlags_AlwaysAutoResize);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, sobelX, 1 });
                 bpSobelX = img.pixels;
                 initSobelX = showSobelX = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpSobelX;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpSobelX);
                 initSobelX = showSobelX = false;
             }
             ImGui::End();
@@ -2446,20 +5870,18 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── SOBEL Y POPUP ──────────
         if (showSobelY) {
             if (!initSobelY) { bpSobelY = img.pixels; initSobelY = true; }
-            img.pixels = bpSobelY;
-            sobelY(img);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpSobelY, [](ImageData& im) { sobelY(im); }, 1, previewParams(), true);
 
             ImGui::Begin("Sobel Y", &showSobelY, ImGuiWindowFlags_AlwaysAutoResize);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, sobelY, 1 });
                 bpSobelY = img.pixels;
                 initSobelY = showSobelY = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpSobelY;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpSobelY);
                 initSobelY = showSobelY = false;
             }
             ImGui::End();
@@ -2468,20 +5890,18 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── PREWITT X POPUP ─────────
         if (showPrewittX) {
             if (!initPrewittX) { bpPrewittX = img.pixels; initPrewittX = true; }
-            img.pixels = bpPrewittX;
-            prewittX(img);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpPrewittX, [](ImageData& im) { prewittX(im); }, 1, previewParams(), true);
 
             ImGui::Begin("Prewitt X", &showPrewittX, ImGuiWindowFlags_AlwaysAutoResize);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, prewittX, 1 });
                 bpPrewittX = img.pixels;
                 initPrewittX = showPrewittX = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpPrewittX;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpPrewittX);
                 initPrewittX = showPrewittX = false;
             }
             ImGui::End();
@@ -2490,20 +5910,18 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── PREWITT Y POPUP ─────────
         if (showPrewittY) {
             if (!initPrewittY) { bpPrewittY = img.pixels; initPrewittY = true; }
-            img.pixels = bpPrewittY;
-            prewittY(img);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpPrewittY, [](ImageData& im) { prewittY(im); }, 1, previewParams(), true);
 
             ImGui::Begin("Prewitt Y", &showPrewittY, ImGuiWindowFlags_AlwaysAutoResize);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, prewittY, 1 });
                 bpPrewittY = img.pixels;
                 initPrewittY = showPrewittY = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpPrewittY;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpPrewittY);
                 initPrewittY = showPrewittY = false;
             }
             ImGui::End();
@@ -2512,20 +5930,18 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── SOBEL 45° POPUP ────────
         if (showSobel45) {
             if (!initSobel45) { bpSobel45 = img.pixels; initSobel45 = true; }
-            img.pixels = bpSobel45;
-            sobel45(img);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpSobel45, [](ImageData& im) { sobel45(im); }, 1, previewParams(), true);
 
             ImGui::Begin("Sobel 45°", &showSobel45, ImGuiWindowFlags_AlwaysAutoResize);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, sobel45, 1 });
                 bpSobel45 = img.pixels;
                 initSobel45 = showSobel45 = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpSobel45;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpSobel45);
                 initSobel45 = showSobel45 = false;
             }
             ImGui::End();
@@ -2534,20 +5950,18 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── SOBEL 135° POPUP ───────
         if (showSobel135) {
             if (!initSobel135) { bpSobel135 = img.pixels; initSobel135 = true; }
-            img.pixels = bpSobel135;
-            sobel135(img);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpSobel135, [](ImageData& im) { sobel135(im); }, 1, previewParams(), true);
 
             ImGui::Begin("Sobel 135°", &showSobel135, ImGuiWindowFlags_AlwaysAutoResize);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, sobel135, 1 });
                 bpSobel135 = img.pixels;
                 initSobel135 = showSobel135 = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpSobel135;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpSobel135);
                 initSobel135 = showSobel135 = false;
             }
             ImGui::End();
@@ -2556,20 +5970,18 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── LAPLACE HORIZONTAL POPUP ────────────
         if (showLapHor) {
             if (!initLapHor) { bpLapHor = img.pixels; initLapHor = true; }
-            img.pixels = bpLapHor;
-            laplaceHorizontal(img);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpLapHor, [](ImageData& im) { laplaceHorizontal(im); }, 1, previewParams(), true);
 
             ImGui::Begin("Laplace Horizontal", &showLapHor, ImGuiWindowFlags_AlwaysAutoResize);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, laplaceHorizontal, 1 });
                 bpLapHor = img.pixels;
                 initLapHor = showLapHor = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpLapHor;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpLapHor);
                 initLapHor = showLapHor = false;
             }
             ImGui::End();
@@ -2578,20 +5990,18 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── LAPLACE VERTICAL POPUP ──────────────
         if (showLapVer) {
             if (!initLapVer) { bpLapVer = img.pixels; initLapVer = true; }
-            img.pixels = bpLapVer;
-            laplaceVertical(img);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpLapVer, [](ImageData& im) { laplaceVertical(im); }, 1, previewParams(), true);
 
             ImGui::Begin("Laplace Vertical", &showLapVer, ImGuiWindowFlags_AlwaysAutoResize);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, laplaceVertical, 1 });
                 bpLapVer = img.pixels;
                 initLapVer = showLapVer = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpLapVer;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpLapVer);
                 initLapVer = showLapVer = false;
             }
             ImGui::End();
@@ -2600,20 +6010,18 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── PORÓWNANIE KONTRU X POPUP ─
         if (showCompareX) {
             if (!initCmpX) { bpCmpX = img.pixels; initCmpX = true; }
-            img.pixels = bpCmpX;
-            compareContourX(img);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpCmpX, [](ImageData& im) { compareContourX(im); }, 1, previewParams(), true);
 
             ImGui::Begin("Compare Contour X", &showCompareX, ImGuiWindowFlags_AlwaysAutoResize);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, compareContourX, 1 });
                 bpCmpX = img.pixels;
                 initCmpX = showCompareX = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpCmpX;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpCmpX);
                 initCmpX = showCompareX = false;
             }
             ImGui::End();
@@ -2622,20 +6030,18 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
         // ─── PORÓWNANIE KONTRU Y POPUP ─
         if (showCompareY) {
             if (!initCmpY) { bpCmpY = img.pixels; initCmpY = true; }
-            img.pixels = bpCmpY;
-            compareContourY(img);
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpCmpY, [](ImageData& im) { compareContourY(im); }, 1, previewParams(), true);
 
             ImGui::Begin("Compare Contour Y", &showCompareY, ImGuiWindowFlags_AlwaysAutoResize);
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, compareContourY, 1 });
                 bpCmpY = img.pixels;
                 initCmpY = showCompareY = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpCmpY;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpCmpY);
                 initCmpY = showCompareY = false;
             }
             ImGui::End();
@@ -2647,9 +6053,8 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
                 bpMinFilter = img.pixels;
                 initMinFilter = true;
             }
-            img.pixels = bpMinFilter;
-            uploadTexture(img); computeHistograms(img);
             // (binary status does not apply to grayscale filters)
+            previewOp(img, bpMinFilter, [ws = minWinSize](ImageData& im) { minFilter(im, ws); }, minWinSize / 2, previewParams(minWinSize), true);
 
             ImGui::Begin("Min Filter", &showMinFilter, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::SliderInt("Window Size", &minWinSize, 1, 15);
@@ -2659,16 +6064,14 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             if (minWinSize < 1) minWinSize = 1;
 
             if (ImGui::Button("Apply")) {
-                minFilter(img, minWinSize);
-                uploadTexture(img); computeHistograms(img);
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=, d = img.scaleDenom](ImageData& im) { minFilter(im, scaleWindow(minWinSize, d, im.scaleDenom)); }, scaleWindow(minWinSize, img.scaleDenom, 1) / 2 });
                 bpMinFilter = img.pixels;
                 initMinFilter = showMinFilter = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpMinFilter;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpMinFilter);
                 initMinFilter = showMinFilter = false;
             }
             ImGui::End();
@@ -2680,9 +6083,7 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
                 bpMaxFilter = img.pixels;
                 initMaxFilter = true;
             }
-            img.pixels = bpMaxFilter;
-            // preview with the current window size
-            uploadTexture(img); computeHistograms(img);
+            previewOp(img, bpMaxFilter, [ws = maxWinSize](ImageData& im) { maxFilter(im, ws); }, maxWinSize / 2, previewParams(maxWinSize), true);
 
             ImGui::Begin("Max Filter", &showMaxFilter, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::SliderInt("Window Size", &maxWinSize, 1, 15);
@@ -2692,16 +6093,14 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             if (maxWinSize < 1) maxWinSize = 1;
 
             if (ImGui::Button("Apply")) {
-                maxFilter(img, maxWinSize);
-                uploadTexture(img); computeHistograms(img);
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=, d = img.scaleDenom](ImageData& im) { maxFilter(im, scaleWindow(maxWinSize, d, im.scaleDenom)); }, scaleWindow(maxWinSize, img.scaleDenom, 1) / 2 });
                 bpMaxFilter = img.pixels;
                 initMaxFilter = showMaxFilter = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpMaxFilter;
-                uploadTexture(img); computeHistograms(img);
+                showPixels(img, bpMaxFilter);
                 initMaxFilter = showMaxFilter = false;
             }
             ImGui::End();
@@ -2713,9 +6112,9 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
                 bpMedianFilter = img.pixels;
                 initMedianFilter = true;
             }
-            img.pixels = bpMedianFilter;
-            // preview with the current window size
-            uploadTexture(img); computeHistograms(img);
+            // mediana jest wolna - podgląd liczy się w tle, klatka na niego nie czeka
+            previewOp(img, bpMedianFilter, [ws = medianWinSize](ImageData& im) { medianFilter(im, ws); }, medianWinSize / 2,
+                      previewParams(medianWinSize), true);
 
             ImGui::Begin("Median Filter", &showMedianFilter, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::SliderInt("Window Size", &medianWinSize, 1, 15);
@@ -2725,16 +6124,14 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             if (medianWinSize < 1) medianWinSize = 1;
 
             if (ImGui::Button("Apply")) {
-                medianFilter(img, medianWinSize);
-                uploadTexture(img);
-                computeHistograms(img);
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [=, d = img.scaleDenom](ImageData& im) { medianFilter(im, scaleWindow(medianWinSize, d, im.scaleDenom)); }, scaleWindow(medianWinSize, img.scaleDenom, 1) / 2 });
                 bpMedianFilter = img.pixels;
                 initMedianFilter = showMedianFilter = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpMedianFilter;
+                showPixels(img, bpMedianFilter);
                 initMedianFilter = showMedianFilter = false;
             }
             ImGui::End();
@@ -2746,13 +6143,8 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
                 bpQuantize = img.pixels;
                 initQuantize = true;
             }
-            // przywróć oryginał przed każdą aktualizacją podglądu
-            img.pixels = bpQuantize;
-
-            // podgląd kwantyzacji na img
-            quantizeImage(img, quantizeLevels);
-            uploadTexture(img);
-            computeHistograms(img);
+            // podgląd kwantyzacji na kopii oryginału
+            previewOp(img, bpQuantize, [&](ImageData& im) { quantizeImage(im, quantizeLevels); }, 0, previewParams(quantizeLevels));
 
             ImGui::Begin("Quantize Image", &showQuantize, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::SliderInt("Levels (L)", &quantizeLevels, 2, 10);
@@ -2762,16 +6154,15 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             if (quantizeLevels > 10) quantizeLevels = 10;
 
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [L = quantizeLevels](ImageData& im) { quantizeImage(im, L); }, 0 });
                 bpQuantize = img.pixels;
                 initQuantize = false;
                 showQuantize = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpQuantize;
-                uploadTexture(img);
-                computeHistograms(img);
+                showPixels(img, bpQuantize);
                 initQuantize = false;
                 showQuantize = false;
             }
@@ -2783,11 +6174,7 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
                 bpPosterize = img.pixels;
                 initPosterize = true;
             }
-            img.pixels = bpPosterize;
-
-            posterizeImage(img, posterizeLevels);
-            uploadTexture(img);
-            computeHistograms(img);
+            previewOp(img, bpPosterize, [&](ImageData& im) { posterizeImage(im, posterizeLevels); }, 0, previewParams(posterizeLevels));
 
             ImGui::Begin("Posterize Image", &showPosterize, ImGuiWindowFlags_AlwaysAutoResize);
             ImGui::SliderInt("Levels", &posterizeLevels, 2, 10);
@@ -2797,16 +6184,15 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             if (posterizeLevels > 10) posterizeLevels = 10;
 
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height, [L = posterizeLevels](ImageData& im) { posterizeImage(im, L); }, 0 });
                 bpPosterize = img.pixels;
                 initPosterize = false;
                 showPosterize = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpPosterize;
-                uploadTexture(img);
-                computeHistograms(img);
+                showPixels(img, bpPosterize);
                 initPosterize = false;
                 showPosterize = false;
             }
@@ -2817,28 +6203,10 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             if (!initKMeans) {
                 bpKMeansOriginal = img.pixels;
                 initKMeans = true;
-                prevKMeansClusters = -1;
-            }
-
-            // sprawdź czy zmienił się kMeansClusters od ostatniego razu
-            if (kMeansClusters != prevKMeansClusters) {
-                // przywróć oryginał na wejście
-                img.pixels = bpKMeansOriginal;
-                // uruchom k-means tylko raz
-                kMeansColorQuantization(img, kMeansClusters, /* maxIters= */ 10);
-
-                // zapisz efekt do bufora podglądu
-                bpKMeansPreview = img.pixels;
-                prevKMeansClusters = kMeansClusters;
             }
-            else {
-                // nie zmieniało się k
-                img.pixels = bpKMeansPreview;
-            }
-
-            // wyślij do tekstury i histogram:
-            uploadTexture(img);
-            computeHistograms(img);
+            // k-means na kopii oryginału w tle, tylko dla nowego k; do czasu wyniku na ekranie poprzedni podział
+            previewOp(img, bpKMeansOriginal, [k = kMeansClusters](ImageData& im) { kMeansColorQuantization(im, k, /* maxIters= */ 10); }, -1,
+                      previewParams(kMeansClusters), true);
 
             // rysuj okno ImGui:
             ImGui::Begin("K-means Quantization", &showKMeans, ImGuiWindowFlags_AlwaysAutoResize);
@@ -2849,27 +6217,67 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             if (kMeansClusters > 256) kMeansClusters = 256;
 
             if (ImGui::Button("Apply")) {
-                undoStack.push_back({ img.pixels, img.channels });
+                commitPreview(img);
+                // przy zapisie centroidy liczone z tego samego podglądu co na ekranie, nie z pełnego obrazu
+                auto sample = std::make_shared<ImageData>();
+                sample->width = img.width; sample->height = img.height; sample->channels = img.channels;
+                sample->pixels = bpKMeansOriginal;
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height,
+                                      [k = kMeansClusters, sample](ImageData& im) { kMeansColorQuantization(im, k, 10, sample.get()); } });
                 bpKMeansOriginal = img.pixels;
                 initKMeans = false;
                 showKMeans = false;
             }
             ImGui::SameLine();
             if (ImGui::Button("Cancel")) {
-                img.pixels = bpKMeansOriginal;
-                uploadTexture(img);
-                computeHistograms(img);
+                showPixels(img, bpKMeansOriginal);
                 initKMeans = false;
                 showKMeans = false;
             }
             ImGui::End();
         }
 
+        // ─── CROP POPUP ──────────────────────────────────────
+        if (showCrop) {
+            // lewy górny róg na granicy iMCU (w skali podglądu), żeby kadr dało się wyciąć bezstratnie
+            bool swapped = false;
+            for (auto& snap : undoStack)
+                if (snap.geom.kind == GeomOp::Rot90 || snap.geom.kind == GeomOp::Rot270) swapped = !swapped;
+            int stepX = std::max(1, (swapped ? img.mcuHeight : img.mcuWidth) / img.scaleDenom);
+            int stepY = std::max(1, (swapped ? img.mcuWidth : img.mcuHeight) / img.scaleDenom);
+
+            ImGui::Begin("Crop", &showCrop, ImGuiWindowFlags_AlwaysAutoResize);
+            ImGui::SliderInt("X", &cropX, 0, img.width - 1);
+            ImGui::SliderInt("Y", &cropY, 0, img.height - 1);
+            cropX -= cropX % stepX;
+            cropY -= cropY % stepY;
+            ImGui::SliderInt("Width", &cropW, 1, img.width - cropX);
+            ImGui::SliderInt("Height", &cropH, 1, img.height - cropY);
+            cropW = std::clamp(cropW, 1, img.width - cropX);
+            cropH = std::clamp(cropH, 1, img.height - cropY);
+            ImGui::Text("Offsets snap to %dx%d (JPEG MCU)", stepX, stepY);
+
+            if (ImGui::Button("Apply")) {
+                int s = img.scaleDenom;
+                cropImage(img, cropX, cropY, cropW, cropH);
+                undoStack.push_back({ img.pixels, img.channels, img.width, img.height,
+                    [=](ImageData& im) { cropImage(im, cropX * s, cropY * s, cropW * s, cropH * s); }, -1,
+                    GeomOp{ GeomOp::Crop, cropX * s, cropY * s, cropW * s, cropH * s } });
+                uploadTexture(img); computeHistograms(img);
+                showCrop = false;
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Cancel")) showCrop = false;
+            ImGui::End();
+        }
+
         // ─── RENDER IMAGE & HISTOGRAM ───────────────────────
         int w, h; glfwGetFramebufferSize(win, &w, &h);
         setupProjection(w, h);
         glClear(GL_COLOR_BUFFER_BIT);
+        endIdlePreview(img);
         renderImage(img, w, h);
+        if (showCrop) renderSelection(img, cropX, cropY, cropW, cropH);
 
         ImGui::SetNextWindowPos(ImVec2(w - RIGHT_BAR_WIDTH, TOP_BAR_HEIGHT));
         ImGui::SetNextWindowSize(ImVec2(RIGHT_BAR_WIDTH, h - TOP_BAR_HEIGHT));
@@ -2877,9 +6285,22 @@ void mainLoop(GLFWwindow* win, ImageData& img) {
             ImGuiWindowFlags_NoResize |
             ImGuiWindowFlags_NoMove |
             ImGuiWindowFlags_NoCollapse);
-        renderHistogram(img);
+        if (g_loadJob.pending)
+            ImGui::Text("Loading %dx%d...", img.fullWidth, img.fullHeight);
+        else if (img.scaleDenom > 1)
+            ImGui::Text("Proxy 1/%d: %dx%d of %dx%d (full resolution on Save)",
+                img.scaleDenom, img.width, img.height, img.fullWidth, img.fullHeight);
+        renderHistogram(histogramSource(img));
+        renderDcStats(img);
         ImGui::End();
 
+        int clicked = -1;
+        renderFilmstrip(w, h, clicked);
+        if (navigate != 0 && !g_folder.thumbs.empty())
+            clicked = folderNeighbour(navigate);
+        if (clicked >= 0 && clicked != g_folder.current && openFolderImage(clicked, img))
+            onImageOpened();
+
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
         glfwSwapBuffers(win);